@@ -13,12 +13,13 @@
 #include "provision.h"
 
 #include "obj/gitversion.h"
-#include "flasher.h"
 
 #include "crypto/rsa.h"
 #include "crypto/sha.h"
 #include "obj/cert.h"
 
+#include "flasher.h"
+
 void __initialize_hardware_early(void) {
   early_initialization();
 }
@@ -10,16 +10,163 @@
     spans multiple transfers/chunks.
   * the overflow buffers are reset by a dedicated control transfer handler,
     which is sent by the host on each start of a connection.
+
+  The host may switch the RX direction to a compressed stream for the rest of
+  the connection. Each frame becomes a record of:
+  * DLC << 4 | CAN_RX_REC_NO_INDEX | CAN_RX_REC_NEW | CAN_RX_REC_XOR
+  * the dictionary index of the ID, unless CAN_RX_REC_NO_INDEX is set
+  * with CAN_RX_REC_NEW or CAN_RX_REC_NO_INDEX, the 5 header bytes of the frame
+    (the bus byte without the DLC and the rejected/returned/extended/addr
+    word). A new header is stored at the index.
+  * the payload, or with CAN_RX_REC_XOR a bitmap of the bytes that differ from
+    the previous payload at the index (one bit per byte, LSB first) followed
+    by those bytes XORed with the previous ones.
+  * the CANPacket_t checksum of the frame, so the receiver can tell a frame
+    rebuilt from a stale dictionary or XOR base.
+  The dictionary is an insert only hash table, IDs that don't fit are always
+  sent with their header. Both ends start with an empty dictionary on every
+  reset, which also falls back to the uncompressed stream.
+  Every CAN_RX_SYNC_INTERVAL records a sync record (CAN_RX_REC_SYNC and the
+  CAN_RX_SYNC_MAGIC bytes) empties the dictionary on both ends. A receiver that
+  lost or garbled part of the stream drops everything up to the next one.
 */
 
 typedef struct {
   uint32_t ptr;
   uint32_t tail_size;
-  uint8_t data[72];
+  uint8_t data[80];
 } asm_buffer;
 
 asm_buffer can_read_buffer = {.ptr = 0U, .tail_size = 0U};
 
+#define CAN_RX_DICT_SIZE_BITS 8U
+#define CAN_RX_DICT_SIZE (1U << CAN_RX_DICT_SIZE_BITS)
+#define CAN_RX_DICT_HEADER_SIZE 5U
+
+#define CAN_RX_REC_XOR 0x1U
+#define CAN_RX_REC_NEW 0x2U
+#define CAN_RX_REC_NO_INDEX 0x4U
+#define CAN_RX_REC_SYNC 0x8U
+
+#define CAN_RX_SYNC_INTERVAL 4096U
+#define CAN_RX_SYNC_SIZE 7U
+const uint8_t CAN_RX_SYNC_MAGIC[CAN_RX_SYNC_SIZE - 1U] = {0xA5U, 0x5AU, 0xC3U, 0x3CU, 0x96U, 0x69U};
+
+typedef struct {
+  uint8_t gen; // valid if it matches can_rx_dict_gen
+  uint8_t header[CAN_RX_DICT_HEADER_SIZE];
+  uint8_t data_len_code; // of the previous payload
+  uint8_t data[CANPACKET_DATA_SIZE_MAX];
+} can_rx_dict_entry_t;
+
+bool can_rx_compressed = false;
+uint8_t can_rx_dict_gen = 1U; // bumped by sync records, so the dictionary needs no clearing
+uint32_t can_rx_sync_cnt = 0U; // records since the last sync record
+#ifdef STM32H7
+__attribute__((section(".ram_d1"))) can_rx_dict_entry_t can_rx_dict[CAN_RX_DICT_SIZE];
+#else
+can_rx_dict_entry_t can_rx_dict[CAN_RX_DICT_SIZE];
+#endif
+
+// Start over with an empty dictionary, on both ends
+uint32_t can_compress_sync(uint8_t *out) {
+  can_rx_dict_gen += 1U;
+  if (can_rx_dict_gen == 0U) {
+    // generations wrapped around, old entries could match again
+    (void)memset(can_rx_dict, 0, sizeof(can_rx_dict));
+    can_rx_dict_gen = 1U;
+  }
+  can_rx_sync_cnt = 0U;
+  out[0] = CAN_RX_REC_SYNC;
+  (void)memcpy(&out[1], CAN_RX_SYNC_MAGIC, sizeof(CAN_RX_SYNC_MAGIC));
+  return CAN_RX_SYNC_SIZE;
+}
+
+// Record of the packet in the compressed stream, preceded by a sync record when one is due.
+// At most 79 bytes so it fits the overflow buffer.
+uint32_t can_compress_packet(const CANPacket_t *packet, uint8_t *out) {
+  uint32_t sync_len = (can_rx_sync_cnt >= CAN_RX_SYNC_INTERVAL) ? can_compress_sync(out) : 0U;
+  can_rx_sync_cnt += 1U;
+  uint8_t *rec = &out[sync_len];
+  const uint8_t *raw = (const uint8_t *)packet;
+  uint8_t header[CAN_RX_DICT_HEADER_SIZE];
+  header[0] = raw[0] & 0x0EU;
+  (void)memcpy(&header[1], &raw[1], 4U);
+
+  // linear probing from the Fibonacci hash of the header
+  uint32_t word;
+  (void)memcpy(&word, &raw[1], 4U);
+  uint32_t hash = ((word ^ ((uint32_t)header[0] << 28)) * 2654435761U) >> (32U - CAN_RX_DICT_SIZE_BITS);
+  uint32_t slot = 0U;
+  can_rx_dict_entry_t *entry = NULL;
+  uint8_t flags = 0U;
+  for (uint32_t i = 0U; i < CAN_RX_DICT_SIZE; i++) {
+    slot = (hash + i) & (CAN_RX_DICT_SIZE - 1U);
+    can_rx_dict_entry_t *e = &can_rx_dict[slot];
+    if (e->gen != can_rx_dict_gen) {
+      (void)memcpy(e->header, header, CAN_RX_DICT_HEADER_SIZE);
+      e->gen = can_rx_dict_gen;
+      entry = e;
+      flags = CAN_RX_REC_NEW;
+      break;
+    }
+    if (memcmp(e->header, header, CAN_RX_DICT_HEADER_SIZE) == 0) {
+      entry = e;
+      break;
+    }
+  }
+
+  uint32_t pos = 1U;
+  if (entry != NULL) {
+    rec[pos] = (uint8_t)slot;
+    pos += 1U;
+  } else {
+    flags = CAN_RX_REC_NO_INDEX;
+  }
+  if (flags != 0U) {
+    (void)memcpy(&rec[pos], header, CAN_RX_DICT_HEADER_SIZE);
+    pos += CAN_RX_DICT_HEADER_SIZE;
+  }
+
+  uint8_t len = dlc_to_len[packet->data_len_code];
+  if ((flags == 0U) && (entry->data_len_code == packet->data_len_code)) {
+    uint32_t bitmap_len = (len + 7U) / 8U;
+    uint32_t changed = 0U;
+    for (uint8_t i = 0U; i < len; i++) {
+      changed += (packet->data[i] != entry->data[i]) ? 1U : 0U;
+    }
+
+    if ((bitmap_len + changed) < len) {
+      flags = CAN_RX_REC_XOR;
+      (void)memset(&rec[pos], 0, bitmap_len);
+      uint32_t data_pos = pos + bitmap_len;
+      for (uint8_t i = 0U; i < len; i++) {
+        uint8_t diff = packet->data[i] ^ entry->data[i];
+        if (diff != 0U) {
+          rec[pos + (i / 8U)] |= (uint8_t)(1U << (i % 8U));
+          rec[data_pos] = diff;
+          data_pos += 1U;
+        }
+      }
+      pos = data_pos;
+    }
+  }
+  if (flags != CAN_RX_REC_XOR) {
+    (void)memcpy(&rec[pos], packet->data, len);
+    pos += len;
+  }
+  rec[0] = (uint8_t)(packet->data_len_code << 4) | flags;
+
+  rec[pos] = packet->checksum;
+  pos += 1U;
+
+  if (entry != NULL) {
+    entry->data_len_code = packet->data_len_code;
+    (void)memcpy(entry->data, packet->data, len);
+  }
+  return sync_len + pos;
+}
+
 int comms_can_read(uint8_t *data, uint32_t max_len) {
   uint32_t pos = 0U;
 
@@ -32,19 +179,34 @@ int comms_can_read(uint8_t *data, uint32_t max_len) {
     can_read_buffer.ptr -= overflow_len;
   }
 
-  if (can_read_buffer.ptr == 0U) {
+  // a bulk snapshot of the CAN ID statistics goes between the CAN stream bytes already in flight and new ones
+  if ((can_read_buffer.ptr == 0U) && can_id_stats_streaming()) {
+    pos += can_id_stats_stream_read(&data[pos], max_len - pos);
+  }
+
+  if ((can_read_buffer.ptr == 0U) && !can_id_stats_streaming()) {
     // Fill rest of buffer with new data
     CANPacket_t can_packet;
-    while ((pos < max_len) && can_pop(&can_rx_q, &can_packet)) {
-      uint32_t pckt_len = CANPACKET_HEAD_SIZE + dlc_to_len[can_packet.data_len_code];
+    uint8_t record[sizeof(can_read_buffer.data)];
+    // priority ID frames go out first
+    while ((pos < max_len) && (can_pop(&can_rx_prio_q, &can_packet) || can_pop(&can_rx_q, &can_packet))) {
+      const uint8_t *pckt = (const uint8_t *)&can_packet;
+      uint32_t pckt_len;
+      if (can_rx_compressed) {
+        pckt_len = can_compress_packet(&can_packet, record);
+        pckt = record;
+      } else {
+        pckt_len = CANPACKET_HEAD_SIZE + dlc_to_len[can_packet.data_len_code];
+      }
+
       if ((pos + pckt_len) <= max_len) {
-        (void)memcpy(&data[pos], &can_packet, pckt_len);
+        (void)memcpy(&data[pos], pckt, pckt_len);
         pos += pckt_len;
       } else {
-        (void)memcpy(&data[pos], &can_packet, max_len - pos);
+        (void)memcpy(&data[pos], pckt, max_len - pos);
         can_read_buffer.ptr += pckt_len - (max_len - pos);
         // cppcheck-suppress objectIndex
-        (void)memcpy(can_read_buffer.data, &((uint8_t*)&can_packet)[(max_len - pos)], can_read_buffer.ptr);
+        (void)memcpy(can_read_buffer.data, &pckt[(max_len - pos)], can_read_buffer.ptr);
         pos = max_len;
       }
     }
@@ -109,6 +271,11 @@ void comms_can_reset(void) {
   can_write_buffer.tail_size = 0U;
   can_read_buffer.ptr = 0U;
   can_read_buffer.tail_size = 0U;
+  can_rx_compressed = false;
+  (void)memset(can_rx_dict, 0, sizeof(can_rx_dict));
+  can_rx_dict_gen = 1U;
+  can_rx_sync_cnt = 0U;
+  can_id_stats_stream_stop();
 }
 
 void refresh_can_tx_slots_available(void) {
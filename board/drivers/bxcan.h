@@ -4,6 +4,13 @@
 
 CAN_TypeDef *cans[] = {CAN1, CAN2, CAN3};
 
+// RX0 and TX interrupt lines of each CAN module
+const IRQn_Type can_irq_number[3][2] = {
+  {CAN1_RX0_IRQn, CAN1_TX_IRQn},
+  {CAN2_RX0_IRQn, CAN2_TX_IRQn},
+  {CAN3_RX0_IRQn, CAN3_TX_IRQn},
+};
+
 bool can_set_speed(uint8_t can_number) {
   bool ret = true;
   CAN_TypeDef *CAN = CANIF_FROM_CAN_NUM(can_number);
@@ -12,8 +19,9 @@ bool can_set_speed(uint8_t can_number) {
   ret &= llcan_set_speed(
     CAN,
     bus_config[bus_number].can_speed,
-    can_loopback,
-    (unsigned int)(can_silent) & (1U << can_number)
+    (unsigned int)(can_loopback) & (1U << can_number),
+    // no restricted operation mode on bxCAN, silent is the closest
+    ((unsigned int)(can_silent) | (unsigned int)(can_restricted)) & (1U << can_number)
   );
   return ret;
 }
@@ -76,10 +84,7 @@ void process_can(uint8_t can_number) {
           to_push.bus = bus_number;
           WORD_TO_BYTE_ARRAY(&to_push.data[0], CAN->sTxMailBox[0].TDLR);
           WORD_TO_BYTE_ARRAY(&to_push.data[4], CAN->sTxMailBox[0].TDHR);
-          can_set_checksum(&to_push);
-
-          current_board->set_led(LED_BLUE, true);
-          rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+          can_echo(&to_push, can_number);
         }
 
         // clear interrupt
@@ -87,6 +92,8 @@ void process_can(uint8_t can_number) {
         CAN->TSR |= CAN_TSR_RQCP0;
       }
 
+      can_isotp_refill(bus_number);
+      can_traffic_gen_refill(bus_number);
       if (can_pop(can_queues[bus_number], &to_send)) {
         if (can_check_checksum(&to_send)) {
           can_health[can_number].total_tx_cnt += 1U;
@@ -156,8 +163,17 @@ void can_rx(uint8_t can_number) {
       can_health[can_number].total_fwd_cnt += 1U;
     }
 
+    // bxCAN doesn't timestamp frames without time triggered mode
+    can_responder_rx(&to_push, bus_number, 0U);
+    can_latency_probe_rx(&to_push, bus_number, 0U);
+    can_isotp_rx(&to_push, bus_number);
+    can_response_table_rx(&to_push, bus_number);
+    bool queue = can_id_stats_rx(&to_push, bus_number, microsecond_timer_get());
+
     current_board->set_led(LED_BLUE, true);
-    rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    if (queue) {
+      rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    }
 
     // next
     update_can_health_pkt(can_number, false);
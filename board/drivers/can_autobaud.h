@@ -0,0 +1,159 @@
+// Automatic bitrate detection. The bus listens in restricted operation mode (silent on bxCAN), first through
+// the nominal_timings[] speeds, then through data_timings[] if CAN FD data phase errors were seen at the locked nominal rate.
+// Each candidate is listened to for CAN_AUTOBAUD_DWELL_TICKS ticks of the 8Hz tick, so a full scan takes at most ~5s.
+
+#define CAN_AUTOBAUD_IDLE 0U
+#define CAN_AUTOBAUD_NOMINAL 1U
+#define CAN_AUTOBAUD_DATA 2U
+#define CAN_AUTOBAUD_LOCKED 3U
+#define CAN_AUTOBAUD_FAILED 4U // no traffic decoded, previous speeds restored
+
+#define CAN_AUTOBAUD_DWELL_TICKS 2U
+
+typedef struct __attribute__((packed)) {
+  uint8_t state;
+  uint32_t can_speed; // kbps multiplied by 10, same as bus_config
+  uint32_t can_data_speed;
+  uint32_t rx_cnt; // Frames received at the best candidate
+  uint32_t error_cnt; // Error interrupts at the best candidate
+} can_autobaud_result_t;
+
+typedef struct {
+  can_autobaud_result_t result;
+  uint8_t candidate;
+  uint8_t ticks;
+  uint8_t best;
+  uint32_t best_score;
+  bool data_errors; // data phase errors at the best nominal candidate
+  uint32_t rx_cnt_start;
+  uint32_t error_cnt_start;
+  uint32_t saved_speed;
+  uint32_t saved_data_speed;
+} can_autobaud_t;
+
+can_autobaud_t can_autobaud[3];
+
+void can_autobaud_try(uint8_t bus) {
+  can_autobaud_t *ab = &can_autobaud[bus];
+  uint8_t can_number = CAN_NUM_FROM_BUS_NUM(bus);
+
+  if (ab->result.state == CAN_AUTOBAUD_NOMINAL) {
+    bus_config[bus].can_speed = nominal_timings[ab->candidate].speed;
+    bus_config[bus].can_data_speed = MAX(ab->saved_data_speed, nominal_timings[ab->candidate].speed);
+  } else {
+    bus_config[bus].can_data_speed = data_timings[ab->candidate].speed;
+  }
+  bool ret = can_init(can_number);
+  UNUSED(ret);
+
+  ab->ticks = 0U;
+  ab->rx_cnt_start = can_health[can_number].total_rx_cnt;
+  ab->error_cnt_start = can_health[can_number].total_error_cnt;
+  can_health[can_number].last_data_stored_error = 0U;
+}
+
+void can_autobaud_finish(uint8_t bus, uint8_t state) {
+  can_autobaud_t *ab = &can_autobaud[bus];
+  if (state == CAN_AUTOBAUD_FAILED) {
+    bus_config[bus].can_speed = ab->saved_speed;
+    bus_config[bus].can_data_speed = ab->saved_data_speed;
+  }
+  ab->result.state = state;
+  ab->result.can_speed = bus_config[bus].can_speed;
+  ab->result.can_data_speed = bus_config[bus].can_data_speed;
+
+  can_restricted &= ~(1U << CAN_NUM_FROM_BUS_NUM(bus));
+  bool ret = can_init(CAN_NUM_FROM_BUS_NUM(bus));
+  UNUSED(ret);
+}
+
+// Score the current candidate and move on to the next one
+void can_autobaud_next(uint8_t bus) {
+  can_autobaud_t *ab = &can_autobaud[bus];
+  uint8_t can_number = CAN_NUM_FROM_BUS_NUM(bus);
+  uint32_t rx_cnt = can_health[can_number].total_rx_cnt - ab->rx_cnt_start;
+  uint32_t error_cnt = can_health[can_number].total_error_cnt - ab->error_cnt_start;
+  bool data_errors = (can_health[can_number].last_data_stored_error != 0U);
+
+  // valid frames count most, FD frames that only failed in the data phase still prove the nominal rate.
+  // Each error interrupt costs half a valid frame, down to half the frames' weight, so a rate that decodes frames
+  // only between errors loses to a clean one. Ties go to fewer errors.
+  uint32_t score = (rx_cnt * 2U) - MIN(rx_cnt, error_cnt);
+  score += (data_errors && (ab->result.state == CAN_AUTOBAUD_NOMINAL)) ? 1U : 0U;
+  bool fewer_errors = (ab->best_score > 0U) && (error_cnt < ab->result.error_cnt);
+  if ((score > ab->best_score) || ((score == ab->best_score) && fewer_errors)) {
+    ab->best = ab->candidate;
+    ab->best_score = score;
+    ab->data_errors = data_errors;
+    ab->result.rx_cnt = rx_cnt;
+    ab->result.error_cnt = error_cnt;
+  }
+
+  ab->candidate += 1U;
+  if (ab->result.state == CAN_AUTOBAUD_NOMINAL) {
+    if (ab->candidate < CAN_BIT_TIMING_CNT(nominal_timings)) {
+      can_autobaud_try(bus);
+    } else if (ab->best_score == 0U) {
+      can_autobaud_finish(bus, CAN_AUTOBAUD_FAILED);
+    } else {
+      bus_config[bus].can_speed = nominal_timings[ab->best].speed;
+      bus_config[bus].can_data_speed = MAX(ab->saved_data_speed, nominal_timings[ab->best].speed);
+      if (current_board->has_canfd && ab->data_errors) {
+        // CAN FD traffic with an unknown data rate, data speeds below the nominal one are skipped
+        ab->result.state = CAN_AUTOBAUD_DATA;
+        ab->candidate = 0U;
+        ab->best_score = 0U;
+        while ((ab->candidate < CAN_BIT_TIMING_CNT(data_timings)) && (data_timings[ab->candidate].speed < bus_config[bus].can_speed)) {
+          ab->candidate += 1U;
+        }
+        can_autobaud_try(bus);
+      } else {
+        can_autobaud_finish(bus, CAN_AUTOBAUD_LOCKED);
+      }
+    }
+  } else {
+    if (ab->candidate < CAN_BIT_TIMING_CNT(data_timings)) {
+      can_autobaud_try(bus);
+    } else {
+      // nominal rate is locked either way, keep the data rate it started with if no candidate decoded FD frames
+      bus_config[bus].can_data_speed = (ab->best_score > 0U) ? data_timings[ab->best].speed : MAX(ab->saved_data_speed, bus_config[bus].can_speed);
+      can_autobaud_finish(bus, CAN_AUTOBAUD_LOCKED);
+    }
+  }
+}
+
+// Called at 8Hz
+void can_autobaud_tick(void) {
+  for (uint8_t bus = 0U; bus < PANDA_CAN_CNT; bus++) {
+    can_autobaud_t *ab = &can_autobaud[bus];
+    if ((ab->result.state == CAN_AUTOBAUD_NOMINAL) || (ab->result.state == CAN_AUTOBAUD_DATA)) {
+      ab->ticks += 1U;
+      if (ab->ticks >= CAN_AUTOBAUD_DWELL_TICKS) {
+        can_autobaud_next(bus);
+      }
+    }
+  }
+}
+
+void can_autobaud_start(uint8_t bus) {
+  can_autobaud_t *ab = &can_autobaud[bus];
+  if ((ab->result.state != CAN_AUTOBAUD_NOMINAL) && (ab->result.state != CAN_AUTOBAUD_DATA)) {
+    ab->saved_speed = bus_config[bus].can_speed;
+    ab->saved_data_speed = bus_config[bus].can_data_speed;
+    (void)memset(&ab->result, 0, sizeof(ab->result));
+    ab->result.state = CAN_AUTOBAUD_NOMINAL;
+    ab->candidate = 0U;
+    ab->best = 0U;
+    ab->best_score = 0U;
+    ab->data_errors = false;
+    can_restricted |= (1U << CAN_NUM_FROM_BUS_NUM(bus));
+    can_autobaud_try(bus);
+  }
+}
+
+void can_autobaud_abort(uint8_t bus) {
+  can_autobaud_t *ab = &can_autobaud[bus];
+  if ((ab->result.state == CAN_AUTOBAUD_NOMINAL) || (ab->result.state == CAN_AUTOBAUD_DATA)) {
+    can_autobaud_finish(bus, CAN_AUTOBAUD_FAILED);
+  }
+}
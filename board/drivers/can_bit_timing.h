@@ -0,0 +1,42 @@
+// Bit timing tables shared by the bxCAN and FDCAN drivers.
+// Each MCU lists its speeds as X(speed, prescaler, tq, sample point) and expands the list twice:
+// into COMPILE_TIME_ASSERTs against its clock and register limits, and into a const table of can_bit_timing_t.
+// Speed setters and the drivers only look entries up, nothing is computed from the requested speed at runtime.
+
+typedef struct {
+  uint32_t speed; // kbps multiplied by 10
+  uint16_t prescaler;
+  uint16_t tq; // time quanta per bit
+  uint16_t seg1; // time quanta between the sync segment and the sample point
+  uint8_t seg2; // time quanta after the sample point
+  uint8_t sjw;
+  uint16_t sample_point; // actual sample point after rounding to time quanta, in 0.1 %
+} can_bit_timing_t;
+
+// Segments around the sample point (%) rounded to the nearest time quantum, the sync segment is 1 time quantum
+#define CAN_SEG2(tq, sp) ((((tq) * (100U - (sp))) + 50U) / 100U)
+#define CAN_SEG1(tq, sp) ((tq) - 1U - CAN_SEG2((tq), (sp)))
+#define CAN_SAMPLE_POINT(tq, sp) ((1000U * (1U + CAN_SEG1((tq), (sp)))) / (tq))
+#define CAN_SJW(tq, sp, sjw_max) ((CAN_SEG2((tq), (sp)) < (sjw_max)) ? CAN_SEG2((tq), (sp)) : (sjw_max))
+
+#define CAN_BIT_TIMING_ENTRY(speed, prescaler, tq, sp, sjw_max) \
+  { (speed), (prescaler), (tq), CAN_SEG1((tq), (sp)), CAN_SEG2((tq), (sp)), CAN_SJW((tq), (sp), (sjw_max)), CAN_SAMPLE_POINT((tq), (sp)) },
+
+// Bitrate is exact and the segments fit the register fields at the given sample point
+#define CAN_BIT_TIMING_VALID(speed, prescaler, tq, sp, pclk, prescaler_max, seg1_max, seg2_max) \
+  COMPILE_TIME_ASSERT((((speed) % 10U) == 0U) && (((speed) / 10U * (prescaler) * (tq)) == (pclk))); \
+  COMPILE_TIME_ASSERT(((prescaler) >= 1U) && ((prescaler) <= (prescaler_max))); \
+  COMPILE_TIME_ASSERT((CAN_SEG1((tq), (sp)) >= 1U) && (CAN_SEG1((tq), (sp)) <= (seg1_max))); \
+  COMPILE_TIME_ASSERT((CAN_SEG2((tq), (sp)) >= 1U) && (CAN_SEG2((tq), (sp)) <= (seg2_max)));
+
+#define CAN_BIT_TIMING_CNT(timings) ((uint8_t)(sizeof(timings) / sizeof((timings)[0])))
+
+const can_bit_timing_t *can_bit_timing_lookup(const can_bit_timing_t *timings, uint8_t len, uint32_t speed) {
+  const can_bit_timing_t *ret = NULL;
+  for (uint8_t i = 0U; i < len; i++) {
+    if (timings[i].speed == speed) {
+      ret = &timings[i];
+    }
+  }
+  return ret;
+}
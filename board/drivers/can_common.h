@@ -14,8 +14,21 @@ typedef struct {
   bool canfd_enabled;
   bool brs_enabled;
   bool canfd_non_iso;
+  uint16_t rx_coalesce_latency;
+  uint8_t rx_ram_share; // % of the CAN controller message RAM used for RX, the rest is for TX
+  uint8_t echo_mode;
+  uint16_t echo_sample_rate; // echo every Nth transmitted frame in CAN_ECHO_SAMPLED mode
+  uint8_t sample_point; // %, 0 for the default of the speed
+  uint8_t data_sample_point;
+  uint16_t change_heartbeat_ms; // change-only mode: unchanged frames reach the host at most this often, 0 to send all frames
 } bus_config_t;
 
+// Echo modes of transmitted frames, sent back to the host with returned = 1
+#define CAN_ECHO_FULL 0U
+#define CAN_ECHO_OFF 1U
+#define CAN_ECHO_COUNT 2U // only counted in the CAN health packet
+#define CAN_ECHO_SAMPLED 3U
+
 uint32_t safety_tx_blocked = 0;
 uint32_t safety_rx_invalid = 0;
 uint32_t tx_buffer_overflow = 0;
@@ -23,13 +36,24 @@ uint32_t rx_buffer_overflow = 0;
 uint32_t gmlan_send_errs = 0;
 
 can_health_t can_health[] = {{0}, {0}, {0}};
+// Priority frames lost to a full RX FIFO 1 or can_rx_prio_q, per CAN module. Not in can_health_t, which is full.
+uint32_t can_rx_prio_lost_cnt[] = {0U, 0U, 0U};
 
 extern int can_live;
 extern int pending_can_live;
 
-// must reinit after changing these
+// must reinit after changing these, bitmasks by CAN number
 extern int can_loopback;
 extern int can_silent;
+extern int can_restricted;
+
+// IDs received on a separate fast lane (RX FIFO 1 + can_rx_prio_q), must reinit after changing these
+#define CAN_PRIO_ID_MAX_CNT 8U
+#define CAN_PRIO_ID_EXTENDED 0x80000000U // flag of extended IDs in can_prio_ids
+uint32_t can_prio_ids[3][CAN_PRIO_ID_MAX_CNT];
+uint8_t can_prio_id_cnt[3] = {0U, 0U, 0U};
+
+uint16_t can_echo_sample_cnt[3] = {0U, 0U, 0U};
 
 // Ignition detected from CAN meessages
 bool ignition_can = false;
@@ -42,6 +66,7 @@ int can_live = 0;
 int pending_can_live = 0;
 int can_loopback = 0;
 int can_silent = ALL_CAN_LIVE;
+int can_restricted = 0; // receive and acknowledge only, used by autobaud
 
 // ******************* functions prototypes *********************
 bool can_init(uint8_t can_number);
@@ -54,10 +79,12 @@ void process_can(uint8_t can_number);
 
 #ifdef STM32H7
 __attribute__((section(".ram_d1"))) can_buffer(rx_q, 0x1000)
+__attribute__((section(".ram_d1"))) can_buffer(rx_prio_q, 0x80)
 __attribute__((section(".ram_d1"))) can_buffer(tx2_q, 0x1A0)
 __attribute__((section(".ram_d2"))) can_buffer(txgmlan_q, 0x1A0)
 #else
 can_buffer(rx_q, 0x1000)
+can_buffer(rx_prio_q, 0x80)
 can_buffer(tx2_q, 0x1A0)
 can_buffer(txgmlan_q, 0x1A0)
 #endif
@@ -111,6 +138,8 @@ bool can_push(can_ring *q, CANPacket_t *elem) {
       print("can_push to ");
       if (q == &can_rx_q) {
         print("can_rx_q");
+      } else if (q == &can_rx_prio_q) {
+        print("can_rx_prio_q");
       } else if (q == &can_tx1_q) {
         print("can_tx1_q");
       } else if (q == &can_tx2_q) {
@@ -163,10 +192,10 @@ void can_clear(can_ring *q) {
 // Helpers
 // Panda:       Bus 0=CAN1   Bus 1=CAN2   Bus 2=CAN3
 bus_config_t bus_config[] = {
-  { .bus_lookup = 0U, .can_num_lookup = 0U, .forwarding_bus = -1, .can_speed = 5000U, .can_data_speed = 20000U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false },
-  { .bus_lookup = 1U, .can_num_lookup = 1U, .forwarding_bus = -1, .can_speed = 5000U, .can_data_speed = 20000U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false },
-  { .bus_lookup = 2U, .can_num_lookup = 2U, .forwarding_bus = -1, .can_speed = 5000U, .can_data_speed = 20000U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false },
-  { .bus_lookup = 0xFFU, .can_num_lookup = 0xFFU, .forwarding_bus = -1, .can_speed = 333U, .can_data_speed = 333U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false },
+  { .bus_lookup = 0U, .can_num_lookup = 0U, .forwarding_bus = -1, .can_speed = 5000U, .can_data_speed = 20000U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false, .rx_coalesce_latency = 0U, .rx_ram_share = 64U, .echo_mode = CAN_ECHO_FULL, .echo_sample_rate = 1U, .sample_point = 0U, .data_sample_point = 0U, .change_heartbeat_ms = 0U },
+  { .bus_lookup = 1U, .can_num_lookup = 1U, .forwarding_bus = -1, .can_speed = 5000U, .can_data_speed = 20000U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false, .rx_coalesce_latency = 0U, .rx_ram_share = 64U, .echo_mode = CAN_ECHO_FULL, .echo_sample_rate = 1U, .sample_point = 0U, .data_sample_point = 0U, .change_heartbeat_ms = 0U },
+  { .bus_lookup = 2U, .can_num_lookup = 2U, .forwarding_bus = -1, .can_speed = 5000U, .can_data_speed = 20000U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false, .rx_coalesce_latency = 0U, .rx_ram_share = 64U, .echo_mode = CAN_ECHO_FULL, .echo_sample_rate = 1U, .sample_point = 0U, .data_sample_point = 0U, .change_heartbeat_ms = 0U },
+  { .bus_lookup = 0xFFU, .can_num_lookup = 0xFFU, .forwarding_bus = -1, .can_speed = 333U, .can_data_speed = 333U, .canfd_enabled = false, .brs_enabled = false, .canfd_non_iso = false, .rx_coalesce_latency = 0U, .rx_ram_share = 64U, .echo_mode = CAN_ECHO_FULL, .echo_sample_rate = 1U, .sample_point = 0U, .data_sample_point = 0U, .change_heartbeat_ms = 0U },
 };
 
 #define CANIF_FROM_CAN_NUM(num) (cans[num])
@@ -185,6 +214,29 @@ void can_init_all(void) {
   UNUSED(ret);
 }
 
+// Change the mode of a single controller, queued frames and the other buses are left alone
+void can_set_loopback(uint8_t bus, bool enabled) {
+  uint8_t can_number = CAN_NUM_FROM_BUS_NUM(bus);
+  if (enabled) {
+    can_loopback |= (1U << can_number);
+  } else {
+    can_loopback &= ~(1U << can_number);
+  }
+  bool ret = can_init(can_number);
+  UNUSED(ret);
+}
+
+void can_set_silent(uint8_t bus, bool enabled) {
+  uint8_t can_number = CAN_NUM_FROM_BUS_NUM(bus);
+  if (enabled) {
+    can_silent |= (1U << can_number);
+  } else {
+    can_silent &= ~(1U << can_number);
+  }
+  bool ret = can_init(can_number);
+  UNUSED(ret);
+}
+
 void can_flip_buses(uint8_t bus1, uint8_t bus2){
   bus_config[bus1].bus_lookup = bus2;
   bus_config[bus2].bus_lookup = bus1;
@@ -221,6 +273,32 @@ bool can_check_checksum(CANPacket_t *packet) {
   return (calculate_checksum((uint8_t *) packet, CANPACKET_HEAD_SIZE + GET_LEN(packet)) == 0U);
 }
 
+// Echo a transmitted frame back to the host according to the echo mode of its bus
+void can_echo(CANPacket_t *to_echo, uint8_t can_number) {
+  uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
+  if (bus_config[bus_number].echo_mode != CAN_ECHO_OFF) {
+    can_health[can_number].total_tx_echo_cnt += 1U;
+
+    bool push = (bus_config[bus_number].echo_mode == CAN_ECHO_FULL);
+    if (bus_config[bus_number].echo_mode == CAN_ECHO_SAMPLED) {
+      can_echo_sample_cnt[bus_number] += 1U;
+      if (can_echo_sample_cnt[bus_number] >= bus_config[bus_number].echo_sample_rate) {
+        can_echo_sample_cnt[bus_number] = 0U;
+        push = true;
+      }
+    }
+
+    if (push) {
+      to_echo->returned = 1U;
+      to_echo->rejected = 0U;
+      can_set_checksum(to_echo);
+
+      current_board->set_led(LED_BLUE, true);
+      rx_buffer_overflow += can_push(&can_rx_q, to_echo) ? 0U : 1U;
+    }
+  }
+}
+
 void can_send(CANPacket_t *to_push, uint8_t bus_number) {
   if (bus_number < PANDA_BUS_CNT) {
     // add CAN packet to send queue
@@ -229,12 +307,22 @@ void can_send(CANPacket_t *to_push, uint8_t bus_number) {
   }
 }
 
-bool is_speed_valid(uint32_t speed, const uint32_t *speeds, uint8_t len) {
-  bool ret = false;
-  for (uint8_t i = 0U; i < len; i++) {
-    if (speeds[i] == speed) {
-      ret = true;
-    }
+// Approximate frame duration in 10ns units, without stuff bits
+uint32_t can_frame_time(const CANPacket_t *pkt, uint8_t bus_number) {
+  uint32_t data_bits = 8U * dlc_to_len[pkt->data_len_code];
+  uint32_t ret;
+  if (bus_config[bus_number].canfd_enabled) {
+    uint32_t arb_bits = (pkt->extended != 0U) ? 50U : 30U;
+    data_bits += (pkt->data_len_code > 10U) ? 30U : 26U; // control, CRC and ACK
+    uint32_t data_speed = bus_config[bus_number].brs_enabled ? bus_config[bus_number].can_data_speed : bus_config[bus_number].can_speed;
+    ret = ((arb_bits * 1000000U) / bus_config[bus_number].can_speed) + ((data_bits * 1000000U) / data_speed);
+  } else {
+    uint32_t frame_bits = ((pkt->extended != 0U) ? 67U : 47U) + data_bits;
+    ret = (frame_bits * 1000000U) / bus_config[bus_number].can_speed;
   }
   return ret;
 }
+
+bool is_speed_valid(uint32_t speed, const can_bit_timing_t *timings, uint8_t len) {
+  return can_bit_timing_lookup(timings, len, speed) != NULL;
+}
@@ -0,0 +1,308 @@
+// Per CAN ID statistics, so a monitor view can poll snapshots instead of streaming every frame.
+// Open addressed hash table keyed by (bus, ID) with linear probing. Entries are never removed, only cleared all at once.
+// The table also backs the per bus change-only mode: frames whose payload matches the last one sent to the host are
+// dropped from can_rx_q until the bus' heartbeat interval elapses.
+// Snapshots are streamed on the bulk IN endpoint ahead of the CAN stream (0xd7 param2 = 2), or read in pages of
+// control transfers.
+
+#define CAN_ID_STATS_SIZE_BITS 8U
+#define CAN_ID_STATS_SIZE (1U << CAN_ID_STATS_SIZE_BITS)
+#define CAN_ID_STATS_PERIOD_EWMA_SHIFT 4U // mean period averaged over ~16 periods
+#define CAN_ID_STATS_PAGE_ENTRIES 2U // records per control read
+#define CAN_ID_SUPPRESSED_PAGE_ENTRIES 7U
+
+#define CAN_ID_STATS_KEY(bus, extended, addr) (((uint32_t)(bus) << 30) | ((uint32_t)(extended) << 29) | (addr))
+
+typedef struct {
+  uint32_t key; // ID in bits 0-28, extended in bit 29, bus in bits 30-31
+  bool valid;
+  uint32_t cnt;
+  uint8_t dlc;
+  uint8_t data[8]; // first 8 bytes of the last payload, also the last one queued in change-only mode
+  uint32_t last_ts; // us
+  uint32_t period_min; // us
+  uint32_t period_max; // us
+  uint32_t period_mean; // us, exponentially weighted
+  bool change_tracked; // dlc, data, payload_hash and last_queued_ts are set
+  uint32_t payload_hash; // of the last frame queued to the host, CAN FD payloads above 8 bytes only
+  uint32_t last_queued_ts; // us
+  uint32_t suppressed_cnt; // frames dropped by change-only mode
+} can_id_stats_entry_t;
+
+// Snapshot record, periods in 100 us units saturating at 6.5 s
+typedef struct __attribute__((packed)) {
+  uint32_t key;
+  uint32_t cnt;
+  uint8_t dlc;
+  uint8_t data[8];
+  uint32_t last_ts;
+  uint16_t period_min;
+  uint16_t period_max;
+  uint16_t period_mean;
+} can_id_stats_record_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t next; // slot to continue the snapshot from, CAN_ID_STATS_SIZE when done
+  uint16_t used; // IDs in the table
+  uint32_t overflow_cnt; // frames of IDs that didn't fit in the table
+  can_id_stats_record_t records[CAN_ID_STATS_PAGE_ENTRIES];
+} can_id_stats_page_t;
+
+// Control read reply that starts a bulk snapshot. The bulk IN endpoint then sends tail_len bytes of the CAN stream
+// that were already in flight, then record_cnt records, then the CAN stream continues.
+typedef struct __attribute__((packed)) {
+  uint16_t tail_len;
+  uint16_t record_cnt;
+  uint16_t used;
+  uint32_t overflow_cnt;
+} can_id_stats_stream_header_t;
+
+typedef struct {
+  uint16_t remaining; // records left to send
+  uint16_t slot; // next slot to look at
+  uint8_t record_pos; // bytes of record already sent
+  can_id_stats_record_t record;
+} can_id_stats_stream_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t key;
+  uint32_t suppressed_cnt;
+} can_id_suppressed_record_t;
+
+typedef struct __attribute__((packed)) {
+  uint16_t next;
+  uint16_t used;
+  uint32_t overflow_cnt;
+  can_id_suppressed_record_t records[CAN_ID_SUPPRESSED_PAGE_ENTRIES];
+} can_id_suppressed_page_t;
+
+typedef struct {
+  bool enabled;
+  uint16_t used;
+  uint32_t overflow_cnt;
+  can_id_stats_entry_t entries[CAN_ID_STATS_SIZE];
+} can_id_stats_t;
+
+can_id_stats_t can_id_stats;
+can_id_stats_stream_t can_id_stats_stream = {.remaining = 0U, .slot = 0U, .record_pos = sizeof(can_id_stats_record_t)};
+
+// Entry of the ID, inserted if it's new. NULL when the table is full.
+// Called from the RX interrupts of every CAN module, the insert must not be interrupted by the USB snapshot or clear.
+can_id_stats_entry_t *can_id_stats_lookup(uint32_t key) {
+  can_id_stats_entry_t *ret = NULL;
+  uint32_t slot = (key * 2654435761U) >> (32U - CAN_ID_STATS_SIZE_BITS); // Fibonacci hashing
+  ENTER_CRITICAL();
+  for (uint32_t i = 0U; i < CAN_ID_STATS_SIZE; i++) {
+    can_id_stats_entry_t *entry = &can_id_stats.entries[(slot + i) & (CAN_ID_STATS_SIZE - 1U)];
+    if (!entry->valid) {
+      (void)memset(entry, 0, sizeof(can_id_stats_entry_t));
+      entry->key = key;
+      entry->valid = true;
+      can_id_stats.used += 1U;
+      ret = entry;
+      break;
+    }
+    if (entry->key == key) {
+      ret = entry;
+      break;
+    }
+  }
+  EXIT_CRITICAL();
+  return ret;
+}
+
+// FNV-1a over DLC and payload, for CAN FD payloads that don't fit in the entry.
+// A hash collision between consecutive payloads only delays a change to the next heartbeat.
+uint32_t can_payload_hash(const CANPacket_t *msg) {
+  uint32_t hash = 2166136261U;
+  hash = (hash ^ msg->data_len_code) * 16777619U;
+  for (uint8_t i = 0U; i < dlc_to_len[msg->data_len_code]; i++) {
+    hash = (hash ^ msg->data[i]) * 16777619U;
+  }
+  return hash;
+}
+
+// ts: reception time in us. Returns false if change-only mode suppresses the frame.
+bool can_id_stats_rx(const CANPacket_t *msg, uint8_t bus_number, uint32_t ts) {
+  bool ret = true;
+  uint16_t heartbeat_ms = bus_config[bus_number].change_heartbeat_ms;
+  if (can_id_stats.enabled || (heartbeat_ms != 0U)) {
+    can_id_stats_entry_t *entry = can_id_stats_lookup(CAN_ID_STATS_KEY(bus_number, msg->extended, msg->addr));
+    if (entry != NULL) {
+      // Payloads up to 8 bytes are compared with the entry's copy, only longer ones by hash. Suppressed frames repeat
+      // the last queued payload, so the last received one is the last queued one.
+      uint8_t len = dlc_to_len[msg->data_len_code];
+      uint32_t hash = (len > 8U) ? can_payload_hash(msg) : 0U;
+      bool unchanged = entry->change_tracked && (msg->data_len_code == entry->dlc) &&
+                       ((len > 8U) ? (hash == entry->payload_hash) : (memcmp(entry->data, msg->data, len) == 0));
+
+      if (can_id_stats.enabled) {
+        if (entry->cnt > 0U) {
+          uint32_t period = get_ts_elapsed(ts, entry->last_ts);
+          entry->period_min = (entry->cnt == 1U) ? period : MIN(entry->period_min, period);
+          entry->period_max = MAX(entry->period_max, period);
+          if (entry->cnt == 1U) {
+            entry->period_mean = period;
+          } else if (period >= entry->period_mean) {
+            entry->period_mean += (period - entry->period_mean) >> CAN_ID_STATS_PERIOD_EWMA_SHIFT;
+          } else {
+            entry->period_mean -= (entry->period_mean - period) >> CAN_ID_STATS_PERIOD_EWMA_SHIFT;
+          }
+        }
+        entry->cnt += 1U;
+        entry->last_ts = ts;
+      }
+      entry->dlc = msg->data_len_code;
+      (void)memcpy(entry->data, msg->data, 8U);
+
+      if (heartbeat_ms != 0U) {
+        if (unchanged && (get_ts_elapsed(ts, entry->last_queued_ts) < ((uint32_t)heartbeat_ms * 1000U))) {
+          entry->suppressed_cnt += 1U;
+          ret = false;
+        } else {
+          entry->change_tracked = true;
+          entry->payload_hash = hash;
+          entry->last_queued_ts = ts;
+        }
+      }
+    } else {
+      // IDs that don't fit are never suppressed
+      can_id_stats.overflow_cnt += 1U;
+    }
+  }
+  return ret;
+}
+
+void can_id_stats_clear(void) {
+  ENTER_CRITICAL();
+  (void)memset(can_id_stats.entries, 0, sizeof(can_id_stats.entries));
+  can_id_stats.used = 0U;
+  can_id_stats.overflow_cnt = 0U;
+  EXIT_CRITICAL();
+}
+
+uint16_t can_id_stats_period(uint32_t period_us) {
+  return (uint16_t)MIN(period_us / 100U, 0xFFFFU);
+}
+
+void can_id_stats_record(const can_id_stats_entry_t *entry, can_id_stats_record_t *record) {
+  record->key = entry->key;
+  record->cnt = entry->cnt;
+  record->dlc = entry->dlc;
+  (void)memcpy(record->data, entry->data, 8U);
+  record->last_ts = entry->last_ts;
+  record->period_min = can_id_stats_period(entry->period_min);
+  record->period_max = can_id_stats_period(entry->period_max);
+  record->period_mean = can_id_stats_period(entry->period_mean);
+}
+
+// Next CAN_ID_STATS_PAGE_ENTRIES used slots from first
+uint32_t can_id_stats_page(uint16_t first, uint8_t *data) {
+  can_id_stats_page_t page = {0};
+  uint8_t cnt = 0U;
+  uint16_t slot = first;
+
+  ENTER_CRITICAL();
+  for (; (slot < CAN_ID_STATS_SIZE) && (cnt < CAN_ID_STATS_PAGE_ENTRIES); slot++) {
+    const can_id_stats_entry_t *entry = &can_id_stats.entries[slot];
+    if (entry->valid && (entry->cnt > 0U)) {
+      can_id_stats_record(entry, &page.records[cnt]);
+      cnt += 1U;
+    }
+  }
+  page.next = slot;
+  page.used = can_id_stats.used;
+  page.overflow_cnt = can_id_stats.overflow_cnt;
+  EXIT_CRITICAL();
+
+  uint32_t len = sizeof(page) - ((CAN_ID_STATS_PAGE_ENTRIES - cnt) * sizeof(can_id_stats_record_t));
+  (void)memcpy(data, &page, len);
+  return len;
+}
+
+// Suppressed frame counts of the next CAN_ID_SUPPRESSED_PAGE_ENTRIES IDs seen in change-only mode from first
+uint32_t can_id_suppressed_page(uint16_t first, uint8_t *data) {
+  can_id_suppressed_page_t page = {0};
+  uint8_t cnt = 0U;
+  uint16_t slot = first;
+
+  ENTER_CRITICAL();
+  for (; (slot < CAN_ID_STATS_SIZE) && (cnt < CAN_ID_SUPPRESSED_PAGE_ENTRIES); slot++) {
+    const can_id_stats_entry_t *entry = &can_id_stats.entries[slot];
+    if (entry->valid && entry->change_tracked) {
+      page.records[cnt].key = entry->key;
+      page.records[cnt].suppressed_cnt = entry->suppressed_cnt;
+      cnt += 1U;
+    }
+  }
+  page.next = slot;
+  page.used = can_id_stats.used;
+  page.overflow_cnt = can_id_stats.overflow_cnt;
+  EXIT_CRITICAL();
+
+  uint32_t len = sizeof(page) - ((CAN_ID_SUPPRESSED_PAGE_ENTRIES - cnt) * sizeof(can_id_suppressed_record_t));
+  (void)memcpy(data, &page, len);
+  return len;
+}
+
+// Starts a bulk snapshot of the IDs seen so far, tail_len: CAN stream bytes the bulk IN endpoint sends first
+uint32_t can_id_stats_stream_start(uint16_t tail_len, uint8_t *data) {
+  can_id_stats_stream_header_t header;
+
+  ENTER_CRITICAL();
+  uint16_t cnt = 0U;
+  for (uint16_t slot = 0U; slot < CAN_ID_STATS_SIZE; slot++) {
+    if (can_id_stats.entries[slot].valid && (can_id_stats.entries[slot].cnt > 0U)) {
+      cnt += 1U;
+    }
+  }
+  can_id_stats_stream.remaining = cnt;
+  can_id_stats_stream.slot = 0U;
+  can_id_stats_stream.record_pos = sizeof(can_id_stats_record_t);
+  header.tail_len = tail_len;
+  header.record_cnt = cnt;
+  header.used = can_id_stats.used;
+  header.overflow_cnt = can_id_stats.overflow_cnt;
+  EXIT_CRITICAL();
+
+  (void)memcpy(data, &header, sizeof(header));
+  return sizeof(header);
+}
+
+bool can_id_stats_streaming(void) {
+  return (can_id_stats_stream.remaining > 0U) || (can_id_stats_stream.record_pos < sizeof(can_id_stats_record_t));
+}
+
+void can_id_stats_stream_stop(void) {
+  can_id_stats_stream.remaining = 0U;
+  can_id_stats_stream.record_pos = sizeof(can_id_stats_record_t);
+}
+
+// Next bytes of the bulk snapshot. Exactly record_cnt records are sent: IDs added behind the cursor are left out,
+// and if the table is cleared meanwhile the rest are empty records with cnt 0.
+uint32_t can_id_stats_stream_read(uint8_t *data, uint32_t max_len) {
+  can_id_stats_stream_t *stream = &can_id_stats_stream;
+  uint32_t pos = 0U;
+  while ((pos < max_len) && can_id_stats_streaming()) {
+    if (stream->record_pos >= sizeof(can_id_stats_record_t)) {
+      (void)memset(&stream->record, 0, sizeof(can_id_stats_record_t));
+      ENTER_CRITICAL();
+      for (; stream->slot < CAN_ID_STATS_SIZE; stream->slot++) {
+        const can_id_stats_entry_t *entry = &can_id_stats.entries[stream->slot];
+        if (entry->valid && (entry->cnt > 0U)) {
+          can_id_stats_record(entry, &stream->record);
+          stream->slot++;
+          break;
+        }
+      }
+      EXIT_CRITICAL();
+      stream->remaining -= 1U;
+      stream->record_pos = 0U;
+    }
+    uint32_t len = MIN(max_len - pos, sizeof(can_id_stats_record_t) - stream->record_pos);
+    (void)memcpy(&data[pos], &((const uint8_t *)&stream->record)[stream->record_pos], len);
+    stream->record_pos += len;
+    pos += len;
+  }
+  return pos;
+}
@@ -0,0 +1,404 @@
+// ISO-TP (ISO 15765-2) transport engine. The host uploads a whole PDU for a channel (bus, tx_id, rx_id),
+// firmware segments it, follows the peer's flow control and reassembles the response PDU received on rx_id.
+// Classic 8 byte frames with normal addressing, PDUs up to 4095 bytes.
+// Consecutive frames are queued from the process_can refill path, STmin gaps are timed by ISOTP_TIMER.
+
+#define CAN_ISOTP_CHANNEL_CNT 2U
+#define CAN_ISOTP_MAX_LEN 4095U
+#define CAN_ISOTP_WFT_MAX 16U // FC.WAIT frames accepted in a row (N_WFTmax)
+#define CAN_ISOTP_TIMER_TICK_US 10U
+
+// Protocol control information, high nibble of the first byte
+#define CAN_ISOTP_PCI_SF 0x0U
+#define CAN_ISOTP_PCI_FF 0x1U
+#define CAN_ISOTP_PCI_CF 0x2U
+#define CAN_ISOTP_PCI_FC 0x3U
+
+// Flow status of flow control frames
+#define CAN_ISOTP_FC_CTS 0x0U
+#define CAN_ISOTP_FC_WAIT 0x1U
+#define CAN_ISOTP_FC_OVFLW 0x2U
+
+#define CAN_ISOTP_TX_IDLE 0U
+#define CAN_ISOTP_TX_WAIT_FC 1U
+#define CAN_ISOTP_TX_SENDING 2U
+
+#define CAN_ISOTP_RX_IDLE 0U
+#define CAN_ISOTP_RX_RECEIVING 1U
+#define CAN_ISOTP_RX_DONE 2U // complete PDU waiting to be read by the host
+
+#define CAN_ISOTP_ERR_NONE 0U
+#define CAN_ISOTP_ERR_TIMEOUT_FC 1U // N_Bs, no flow control from the peer
+#define CAN_ISOTP_ERR_TIMEOUT_CF 2U // N_Cr, no consecutive frame from the peer
+#define CAN_ISOTP_ERR_OVERFLOW 3U // peer rejected the PDU, or too many FC.WAIT
+#define CAN_ISOTP_ERR_WRONG_SN 4U
+#define CAN_ISOTP_ERR_RX_BUSY 5U // received PDU dropped, the previous one wasn't read yet
+#define CAN_ISOTP_ERR_TIMEOUT_TX 6U // N_As, consecutive frames not getting out (no ACK, or the bus is busy)
+
+typedef struct __attribute__((packed)) {
+  uint8_t channel;
+  uint8_t bus;
+  uint32_t tx_id; // IDs above 0x7FF are extended
+  uint32_t rx_id;
+  uint8_t block_size; // sent in our flow control frames, 0 for no limit
+  uint8_t st_min; // sent in our flow control frames, ISO 15765-2 encoding
+  uint8_t padding; // fill byte of frames shorter than 8 bytes
+  uint16_t timeout_ms; // N_As, N_Bs and N_Cr
+} can_isotp_config_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t enabled;
+  uint8_t tx_state;
+  uint8_t rx_state;
+  uint8_t last_error;
+  uint16_t tx_len;
+  uint16_t tx_offset; // bytes of the PDU queued for sending
+  uint16_t rx_len;
+  uint16_t rx_offset; // bytes of the PDU received
+  uint32_t tx_pdu_cnt; // PDUs sent completely
+  uint32_t rx_pdu_cnt; // PDUs received completely
+  uint32_t error_cnt;
+} can_isotp_status_t;
+
+typedef struct {
+  can_isotp_config_t config;
+  can_isotp_status_t status;
+  uint8_t tx_buf[CAN_ISOTP_MAX_LEN];
+  uint8_t rx_buf[CAN_ISOTP_MAX_LEN];
+  uint8_t tx_sn;
+  uint8_t tx_bs; // block size of the peer, 0 for no limit
+  uint8_t tx_bs_cnt;
+  uint8_t tx_wft_cnt;
+  uint32_t tx_st_min_us; // STmin of the peer
+  uint32_t tx_ts; // last FF/FC event, or last CF queued
+  uint32_t tx_gap_us; // wait after tx_ts before the next CF
+  uint8_t rx_sn;
+  uint8_t rx_bs_cnt;
+  uint32_t rx_ts; // last frame received, for N_Cr
+} can_isotp_t;
+
+can_isotp_t can_isotp[CAN_ISOTP_CHANNEL_CNT];
+
+void can_isotp_error(can_isotp_t *iso, uint8_t error) {
+  iso->status.last_error = error;
+  iso->status.error_cnt += 1U;
+}
+
+// Reserved values are treated as the longest STmin
+uint32_t can_isotp_st_min_us(uint8_t st_min) {
+  uint32_t ret = 127000U;
+  if (st_min <= 0x7FU) {
+    ret = st_min * 1000U;
+  } else if ((st_min >= 0xF1U) && (st_min <= 0xF9U)) {
+    ret = (st_min - 0xF0U) * 100U;
+  } else {
+    // reserved
+  }
+  return ret;
+}
+
+void can_isotp_build(const can_isotp_t *iso, const uint8_t *data, uint8_t len, CANPacket_t *pkt) {
+  pkt->returned = 0U;
+  pkt->rejected = 0U;
+  pkt->extended = (iso->config.tx_id > 0x7FFU) ? 1U : 0U;
+  pkt->addr = iso->config.tx_id;
+  pkt->bus = iso->config.bus;
+  pkt->data_len_code = 8U;
+  for (uint8_t i = 0U; i < 8U; i++) {
+    pkt->data[i] = (i < len) ? data[i] : iso->config.padding;
+  }
+  can_set_checksum(pkt);
+}
+
+void can_isotp_send_fc(const can_isotp_t *iso, uint8_t flow_status) {
+  uint8_t fc[3] = {(CAN_ISOTP_PCI_FC << 4) | flow_status, iso->config.block_size, iso->config.st_min};
+  CANPacket_t pkt;
+  can_isotp_build(iso, fc, sizeof(fc), &pkt);
+  can_send(&pkt, iso->config.bus);
+}
+
+// One-shot wakeup after delay_us, an earlier pending wakeup is kept
+void can_isotp_timer_arm(uint32_t delay_us) {
+  uint32_t ticks = MIN((delay_us / CAN_ISOTP_TIMER_TICK_US) + 1U, 0xFFFFU);
+  if (((ISOTP_TIMER->CR1 & TIM_CR1_CEN) == 0U) || (ticks < (ISOTP_TIMER->ARR - ISOTP_TIMER->CNT))) {
+    ISOTP_TIMER->CR1 &= ~TIM_CR1_CEN;
+    ISOTP_TIMER->ARR = ticks;
+    ISOTP_TIMER->CNT = 0U;
+    ISOTP_TIMER->CR1 |= TIM_CR1_CEN;
+  }
+}
+
+void can_isotp_timer_handler(void) {
+  if (ISOTP_TIMER->SR != 0U) {
+    ISOTP_TIMER->SR = 0U;
+    for (uint8_t ch = 0U; ch < CAN_ISOTP_CHANNEL_CNT; ch++) {
+      if (can_isotp[ch].status.tx_state == CAN_ISOTP_TX_SENDING) {
+        process_can(CAN_NUM_FROM_BUS_NUM(can_isotp[ch].config.bus));
+      }
+    }
+  }
+}
+
+void can_isotp_init(void) {
+  REGISTER_INTERRUPT(ISOTP_TIMER_IRQ, can_isotp_timer_handler, 12000U, FAULT_INTERRUPT_RATE_ISOTP)
+  register_set(&(ISOTP_TIMER->PSC), ((CAN_ISOTP_TIMER_TICK_US * APB1_TIMER_FREQ) - 1U), 0xFFFFU);
+  register_set(&(ISOTP_TIMER->CR1), TIM_CR1_OPM | TIM_CR1_URS, 0x3FU);
+  ISOTP_TIMER->EGR = TIM_EGR_UG; // load the prescaler
+  ISOTP_TIMER->SR = 0U;
+  register_set(&(ISOTP_TIMER->DIER), TIM_DIER_UIE, 0x5F5FU);
+  NVIC_EnableIRQ(ISOTP_TIMER_IRQ);
+}
+
+// Called from process_can before popping the TX queue of the bus, queues the next consecutive frame
+void can_isotp_refill(uint8_t bus_number) {
+  can_ring *q = can_queues[bus_number];
+  for (uint8_t ch = 0U; ch < CAN_ISOTP_CHANNEL_CNT; ch++) {
+    can_isotp_t *iso = &can_isotp[ch];
+    if ((iso->status.tx_state == CAN_ISOTP_TX_SENDING) && (iso->config.bus == bus_number) && (q->w_ptr == q->r_ptr)) {
+      uint32_t ts = microsecond_timer_get();
+      uint32_t elapsed = get_ts_elapsed(ts, iso->tx_ts);
+      if (elapsed >= iso->tx_gap_us) {
+        uint8_t cf[8];
+        uint8_t len = (uint8_t)MIN(7U, (uint32_t)iso->status.tx_len - iso->status.tx_offset);
+        cf[0] = (CAN_ISOTP_PCI_CF << 4) | iso->tx_sn;
+        (void)memcpy(&cf[1], &iso->tx_buf[iso->status.tx_offset], len);
+
+        CANPacket_t pkt;
+        can_isotp_build(iso, cf, len + 1U, &pkt);
+        tx_buffer_overflow += can_push(q, &pkt) ? 0U : 1U;
+
+        iso->status.tx_offset += len;
+        iso->tx_sn = (iso->tx_sn + 1U) & 0xFU;
+        iso->tx_ts = ts;
+        // STmin counts from the end of the frame
+        iso->tx_gap_us = (iso->tx_st_min_us > 0U) ? (iso->tx_st_min_us + (can_frame_time(&pkt, bus_number) / 100U)) : 0U;
+
+        if (iso->status.tx_offset >= iso->status.tx_len) {
+          iso->status.tx_state = CAN_ISOTP_TX_IDLE;
+          iso->status.tx_pdu_cnt += 1U;
+        } else if (iso->tx_bs != 0U) {
+          iso->tx_bs_cnt += 1U;
+          if (iso->tx_bs_cnt >= iso->tx_bs) {
+            iso->status.tx_state = CAN_ISOTP_TX_WAIT_FC;
+            iso->tx_wft_cnt = 0U;
+          }
+        } else {
+          // no block limit
+        }
+      } else {
+        can_isotp_timer_arm(iso->tx_gap_us - elapsed);
+      }
+    }
+  }
+}
+
+void can_isotp_rx_fc(can_isotp_t *iso, const CANPacket_t *msg, uint8_t len) {
+  if ((iso->status.tx_state == CAN_ISOTP_TX_WAIT_FC) && (len >= 3U)) {
+    uint8_t flow_status = msg->data[0] & 0xFU;
+    iso->tx_ts = microsecond_timer_get();
+    if (flow_status == CAN_ISOTP_FC_CTS) {
+      iso->tx_bs = msg->data[1];
+      iso->tx_bs_cnt = 0U;
+      iso->tx_st_min_us = can_isotp_st_min_us(msg->data[2]);
+      iso->tx_gap_us = 0U;
+      iso->status.tx_state = CAN_ISOTP_TX_SENDING;
+      process_can(CAN_NUM_FROM_BUS_NUM(iso->config.bus));
+    } else if ((flow_status == CAN_ISOTP_FC_WAIT) && (iso->tx_wft_cnt < CAN_ISOTP_WFT_MAX)) {
+      iso->tx_wft_cnt += 1U;
+    } else {
+      iso->status.tx_state = CAN_ISOTP_TX_IDLE;
+      can_isotp_error(iso, CAN_ISOTP_ERR_OVERFLOW);
+    }
+  }
+}
+
+void can_isotp_rx_data(can_isotp_t *iso, const CANPacket_t *msg, uint8_t len) {
+  uint8_t pci = msg->data[0] >> 4;
+  can_isotp_status_t *status = &iso->status;
+
+  if (pci == CAN_ISOTP_PCI_SF) {
+    uint8_t pdu_len = msg->data[0] & 0xFU;
+    if ((pdu_len > 0U) && (pdu_len < len)) {
+      if (status->rx_state == CAN_ISOTP_RX_DONE) {
+        can_isotp_error(iso, CAN_ISOTP_ERR_RX_BUSY);
+      } else {
+        // a single frame also aborts a reception in progress
+        (void)memcpy(iso->rx_buf, &msg->data[1], pdu_len);
+        status->rx_len = pdu_len;
+        status->rx_offset = pdu_len;
+        status->rx_state = CAN_ISOTP_RX_DONE;
+        status->rx_pdu_cnt += 1U;
+      }
+    }
+  } else if ((pci == CAN_ISOTP_PCI_FF) && (len == 8U)) {
+    uint16_t pdu_len = ((msg->data[0] & 0xFU) << 8) | msg->data[1];
+    if ((status->rx_state == CAN_ISOTP_RX_DONE) || (pdu_len == 0U)) {
+      // no room for another PDU, or longer than 4095 bytes (escape sequence)
+      can_isotp_error(iso, CAN_ISOTP_ERR_RX_BUSY);
+      can_isotp_send_fc(iso, CAN_ISOTP_FC_OVFLW);
+    } else if (pdu_len > 7U) {
+      (void)memcpy(iso->rx_buf, &msg->data[2], 6U);
+      status->rx_len = pdu_len;
+      status->rx_offset = 6U;
+      status->rx_state = CAN_ISOTP_RX_RECEIVING;
+      iso->rx_sn = 1U;
+      iso->rx_bs_cnt = 0U;
+      iso->rx_ts = microsecond_timer_get();
+      can_isotp_send_fc(iso, CAN_ISOTP_FC_CTS);
+    } else {
+      // first frame of a PDU that fits a single frame, ignored
+    }
+  } else if ((pci == CAN_ISOTP_PCI_CF) && (status->rx_state == CAN_ISOTP_RX_RECEIVING)) {
+    if ((msg->data[0] & 0xFU) != iso->rx_sn) {
+      status->rx_state = CAN_ISOTP_RX_IDLE;
+      can_isotp_error(iso, CAN_ISOTP_ERR_WRONG_SN);
+    } else {
+      uint16_t n = MIN((uint16_t)(len - 1U), (uint16_t)(status->rx_len - status->rx_offset));
+      (void)memcpy(&iso->rx_buf[status->rx_offset], &msg->data[1], n);
+      status->rx_offset += n;
+      iso->rx_sn = (iso->rx_sn + 1U) & 0xFU;
+      iso->rx_ts = microsecond_timer_get();
+
+      if (status->rx_offset >= status->rx_len) {
+        status->rx_state = CAN_ISOTP_RX_DONE;
+        status->rx_pdu_cnt += 1U;
+      } else if (iso->config.block_size != 0U) {
+        iso->rx_bs_cnt += 1U;
+        if (iso->rx_bs_cnt >= iso->config.block_size) {
+          iso->rx_bs_cnt = 0U;
+          can_isotp_send_fc(iso, CAN_ISOTP_FC_CTS);
+        }
+      } else {
+        // no block limit
+      }
+    }
+  } else {
+    // unexpected frame, ignored
+  }
+}
+
+void can_isotp_rx(const CANPacket_t *msg, uint8_t bus_number) {
+  uint8_t len = dlc_to_len[msg->data_len_code];
+  for (uint8_t ch = 0U; ch < CAN_ISOTP_CHANNEL_CNT; ch++) {
+    can_isotp_t *iso = &can_isotp[ch];
+    if ((iso->status.enabled != 0U) && (iso->config.bus == bus_number) && (msg->addr == iso->config.rx_id) &&
+        (msg->extended == ((iso->config.rx_id > 0x7FFU) ? 1U : 0U)) && (len > 0U)) {
+      if ((msg->data[0] >> 4) == CAN_ISOTP_PCI_FC) {
+        can_isotp_rx_fc(iso, msg, len);
+      } else {
+        can_isotp_rx_data(iso, msg, len);
+      }
+    }
+  }
+}
+
+// Called at 8Hz, N_As, N_Bs and N_Cr timeouts. While sending, the next CF is queued once the previous one left
+// the TX queue, so a CF stuck in the queue stops tx_ts from advancing.
+void can_isotp_tick(void) {
+  ENTER_CRITICAL();
+  uint32_t ts = microsecond_timer_get();
+  for (uint8_t ch = 0U; ch < CAN_ISOTP_CHANNEL_CNT; ch++) {
+    can_isotp_t *iso = &can_isotp[ch];
+    uint32_t timeout_us = iso->config.timeout_ms * 1000U;
+    if ((iso->status.tx_state == CAN_ISOTP_TX_WAIT_FC) && (get_ts_elapsed(ts, iso->tx_ts) > timeout_us)) {
+      iso->status.tx_state = CAN_ISOTP_TX_IDLE;
+      can_isotp_error(iso, CAN_ISOTP_ERR_TIMEOUT_FC);
+    }
+    if ((iso->status.tx_state == CAN_ISOTP_TX_SENDING) && (get_ts_elapsed(ts, iso->tx_ts) > (iso->tx_gap_us + timeout_us))) {
+      iso->status.tx_state = CAN_ISOTP_TX_IDLE;
+      can_isotp_error(iso, CAN_ISOTP_ERR_TIMEOUT_TX);
+    }
+    if ((iso->status.rx_state == CAN_ISOTP_RX_RECEIVING) && (get_ts_elapsed(ts, iso->rx_ts) > timeout_us)) {
+      iso->status.rx_state = CAN_ISOTP_RX_IDLE;
+      can_isotp_error(iso, CAN_ISOTP_ERR_TIMEOUT_CF);
+    }
+  }
+  EXIT_CRITICAL();
+}
+
+bool can_isotp_configure(const uint8_t *data, uint32_t len) {
+  bool ret = false;
+  if (len == sizeof(can_isotp_config_t)) {
+    can_isotp_config_t config;
+    (void)memcpy(&config, data, sizeof(config));
+    if ((config.channel < CAN_ISOTP_CHANNEL_CNT) && (config.bus < PANDA_BUS_CNT) &&
+        (config.tx_id <= 0x1FFFFFFFU) && (config.rx_id <= 0x1FFFFFFFU) && (config.timeout_ms > 0U)) {
+      can_isotp_t *iso = &can_isotp[config.channel];
+      ENTER_CRITICAL();
+      iso->config = config;
+      (void)memset(&iso->status, 0, sizeof(iso->status));
+      iso->status.enabled = 1U;
+      EXIT_CRITICAL();
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+// PDU upload in endpoint 2 packets: channel, offset (uint16), data
+bool can_isotp_write(const uint8_t *data, uint32_t len) {
+  bool ret = false;
+  if (len >= 3U) {
+    uint8_t ch = data[0];
+    uint32_t offset = data[1] | ((uint32_t)data[2] << 8);
+    uint32_t n = len - 3U;
+    if ((ch < CAN_ISOTP_CHANNEL_CNT) && (can_isotp[ch].status.tx_state == CAN_ISOTP_TX_IDLE) && ((offset + n) <= CAN_ISOTP_MAX_LEN)) {
+      (void)memcpy(&can_isotp[ch].tx_buf[offset], &data[3], n);
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+// Sends the first len bytes of the uploaded PDU
+bool can_isotp_send(uint8_t ch, uint16_t len) {
+  bool ret = false;
+  if ((ch < CAN_ISOTP_CHANNEL_CNT) && (len > 0U) && (len <= CAN_ISOTP_MAX_LEN)) {
+    can_isotp_t *iso = &can_isotp[ch];
+    ENTER_CRITICAL();
+    if ((iso->status.enabled != 0U) && (iso->status.tx_state == CAN_ISOTP_TX_IDLE)) {
+      uint8_t frame[8];
+      iso->status.tx_len = len;
+      iso->status.last_error = CAN_ISOTP_ERR_NONE;
+      if (len <= 7U) {
+        frame[0] = (CAN_ISOTP_PCI_SF << 4) | len;
+        (void)memcpy(&frame[1], iso->tx_buf, len);
+        iso->status.tx_offset = len;
+        iso->status.tx_pdu_cnt += 1U;
+      } else {
+        frame[0] = (CAN_ISOTP_PCI_FF << 4) | (len >> 8);
+        frame[1] = len & 0xFFU;
+        (void)memcpy(&frame[2], iso->tx_buf, 6U);
+        iso->status.tx_offset = 6U;
+        iso->status.tx_state = CAN_ISOTP_TX_WAIT_FC;
+        iso->tx_sn = 1U;
+        iso->tx_wft_cnt = 0U;
+        iso->tx_ts = microsecond_timer_get();
+      }
+      CANPacket_t pkt;
+      can_isotp_build(iso, frame, (len <= 7U) ? (len + 1U) : 8U, &pkt);
+      can_send(&pkt, iso->config.bus);
+      ret = true;
+    }
+    EXIT_CRITICAL();
+  }
+  return ret;
+}
+
+// Copies up to max_len bytes of the received PDU from offset, reading the last byte releases the PDU
+uint32_t can_isotp_read(uint8_t ch, uint16_t offset, uint8_t *data, uint32_t max_len) {
+  uint32_t ret = 0U;
+  if (ch < CAN_ISOTP_CHANNEL_CNT) {
+    can_isotp_t *iso = &can_isotp[ch];
+    ENTER_CRITICAL();
+    if ((iso->status.rx_state == CAN_ISOTP_RX_DONE) && (offset < iso->status.rx_len)) {
+      ret = MIN(max_len, (uint32_t)iso->status.rx_len - offset);
+      (void)memcpy(data, &iso->rx_buf[offset], ret);
+      if ((offset + ret) >= iso->status.rx_len) {
+        iso->status.rx_state = CAN_ISOTP_RX_IDLE;
+      }
+    }
+    EXIT_CRITICAL();
+  }
+  return ret;
+}
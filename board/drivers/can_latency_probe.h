@@ -0,0 +1,129 @@
+// Round-trip latency probe: a ping frame carrying its send time is sent on one bus and matched
+// when a DUT forwards it back on another bus. The next ping goes out as soon as the previous one returned.
+
+#define CAN_LATENCY_PROBE_HIST_BINS 16U // bin N counts latencies in [2^N, 2^(N+1)) us, bin 0 also counts 0 us
+
+typedef struct __attribute__((packed)) {
+  uint8_t src_bus;
+  uint8_t dst_bus;
+  uint32_t addr; // IDs above 0x7FF are extended
+  uint16_t timeout_ms; // ping counted as lost after this
+} can_latency_probe_config_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t enabled;
+  uint32_t sent_cnt;
+  uint32_t recv_cnt;
+  uint32_t lost_cnt;
+  uint32_t latency_min; // us
+  uint32_t latency_max; // us
+  uint64_t latency_sum; // us
+} can_latency_probe_stats_t;
+
+typedef struct {
+  can_latency_probe_config_t config;
+  can_latency_probe_stats_t stats;
+  uint32_t hist[CAN_LATENCY_PROBE_HIST_BINS];
+  bool outstanding;
+  uint32_t seq;
+  uint32_t sent_ts;
+} can_latency_probe_t;
+
+can_latency_probe_t can_latency_probe = {
+  .config = { .src_bus = 0U, .dst_bus = 1U, .addr = 0x7FFU, .timeout_ms = 100U },
+};
+
+void can_latency_probe_ping(void) {
+  can_latency_probe_t *probe = &can_latency_probe;
+  CANPacket_t pkt;
+
+  probe->seq += 1U;
+  probe->sent_ts = microsecond_timer_get();
+  probe->outstanding = true;
+  probe->stats.sent_cnt += 1U;
+
+  pkt.returned = 0U;
+  pkt.rejected = 0U;
+  pkt.extended = (probe->config.addr > 0x7FFU) ? 1U : 0U;
+  pkt.addr = probe->config.addr;
+  pkt.bus = probe->config.src_bus;
+  pkt.data_len_code = 8U;
+  WORD_TO_BYTE_ARRAY(&pkt.data[0], probe->sent_ts);
+  WORD_TO_BYTE_ARRAY(&pkt.data[4], probe->seq);
+  can_set_checksum(&pkt);
+  can_send(&pkt, probe->config.src_bus);
+}
+
+// rx_age_us: time since the start of the received frame (RX timestamp at SOF), 0 if the controller doesn't timestamp frames.
+// It's an upper bound on BRS buses (see fdcan_rx_age_us), which makes the latency a lower bound there.
+void can_latency_probe_rx(const CANPacket_t *msg, uint8_t bus_number, uint32_t rx_age_us) {
+  can_latency_probe_t *probe = &can_latency_probe;
+  if ((probe->stats.enabled != 0U) && probe->outstanding && (bus_number == probe->config.dst_bus) &&
+      (msg->addr == probe->config.addr) && (msg->extended == ((probe->config.addr > 0x7FFU) ? 1U : 0U)) &&
+      (msg->data_len_code == 8U)) {
+    uint32_t sent_ts;
+    uint32_t seq;
+    BYTE_ARRAY_TO_WORD(sent_ts, &msg->data[0]);
+    BYTE_ARRAY_TO_WORD(seq, &msg->data[4]);
+    if ((sent_ts == probe->sent_ts) && (seq == probe->seq)) {
+      uint32_t latency = get_ts_elapsed(microsecond_timer_get(), sent_ts);
+      latency -= MIN(latency, rx_age_us);
+
+      can_latency_probe_stats_t *stats = &probe->stats;
+      stats->latency_min = (stats->recv_cnt == 0U) ? latency : MIN(stats->latency_min, latency);
+      stats->latency_max = MAX(stats->latency_max, latency);
+      stats->latency_sum += latency;
+      stats->recv_cnt += 1U;
+
+      uint8_t bin = 0U;
+      while (((latency >> (bin + 1U)) != 0U) && (bin < (CAN_LATENCY_PROBE_HIST_BINS - 1U))) {
+        bin += 1U;
+      }
+      probe->hist[bin] += 1U;
+
+      can_latency_probe_ping();
+    }
+  }
+}
+
+// Called at 8Hz, counts timed out pings and sends the next one
+void can_latency_probe_tick(void) {
+  can_latency_probe_t *probe = &can_latency_probe;
+  ENTER_CRITICAL();
+  if ((probe->stats.enabled != 0U) && probe->outstanding &&
+      (get_ts_elapsed(microsecond_timer_get(), probe->sent_ts) > (probe->config.timeout_ms * 1000U))) {
+    probe->stats.lost_cnt += 1U;
+    can_latency_probe_ping();
+  }
+  EXIT_CRITICAL();
+}
+
+bool can_latency_probe_configure(const uint8_t *data, uint32_t len) {
+  bool ret = false;
+  if (len == sizeof(can_latency_probe_config_t)) {
+    can_latency_probe_config_t config;
+    (void)memcpy(&config, data, sizeof(config));
+    if ((config.src_bus < PANDA_BUS_CNT) && (config.dst_bus < PANDA_BUS_CNT) &&
+        (config.addr <= 0x1FFFFFFFU) && (config.timeout_ms > 0U)) {
+      ENTER_CRITICAL();
+      can_latency_probe.stats.enabled = 0U;
+      can_latency_probe.config = config;
+      EXIT_CRITICAL();
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+void can_latency_probe_set_enabled(bool enabled) {
+  can_latency_probe_t *probe = &can_latency_probe;
+  ENTER_CRITICAL();
+  probe->stats.enabled = 0U;
+  if (enabled) {
+    (void)memset(&probe->stats, 0, sizeof(probe->stats));
+    (void)memset(probe->hist, 0, sizeof(probe->hist));
+    probe->stats.enabled = 1U;
+    can_latency_probe_ping();
+  }
+  EXIT_CRITICAL();
+}
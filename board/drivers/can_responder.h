@@ -0,0 +1,73 @@
+// On-device echo responder: answers received frames with a transformed copy, straight from the RX interrupt.
+// Replaces a second panda running echo.py for round-trip benchmarks.
+
+#define CAN_RESPONDER_OFF 0U
+#define CAN_RESPONDER_REVERSE 1U // payload bytes in reverse order, same as panda's echo.py
+#define CAN_RESPONDER_INVERT 2U // payload bits inverted
+
+typedef struct {
+  uint8_t mode;
+  uint8_t target_bus;
+  uint16_t addr_offset; // response ID = ID + offset. With a non-zero offset only IDs below it are answered, so responses aren't answered again. 0 needs another target bus.
+} can_responder_config_t;
+
+typedef struct __attribute__((packed)) {
+  uint32_t response_cnt;
+  uint32_t drop_cnt; // Responses that didn't fit in the TX queue
+  uint16_t latency_min; // us from the start of the request frame (FDCAN RX timestamp, includes the frame duration) to the response being queued
+  uint16_t latency_max;
+  uint32_t latency_sum;
+} can_responder_stats_t;
+
+can_responder_config_t can_responder[3] = {
+  { .mode = CAN_RESPONDER_OFF, .target_bus = 0U, .addr_offset = 0U },
+  { .mode = CAN_RESPONDER_OFF, .target_bus = 1U, .addr_offset = 0U },
+  { .mode = CAN_RESPONDER_OFF, .target_bus = 2U, .addr_offset = 0U },
+};
+can_responder_stats_t can_responder_stats[3];
+
+// rx_age_us: time since the start of the received frame (RX timestamp at SOF), 0 if the controller doesn't timestamp frames.
+// An upper bound on BRS buses, see fdcan_rx_age_us.
+void can_responder_rx(const CANPacket_t *to_respond, uint8_t bus_number, uint32_t rx_age_us) {
+  can_responder_config_t *cfg = &can_responder[bus_number];
+  uint32_t addr = to_respond->addr + cfg->addr_offset;
+  uint32_t addr_max = (to_respond->extended != 0U) ? 0x1FFFFFFFU : 0x7FFU;
+
+  if ((cfg->mode != CAN_RESPONDER_OFF) && ((cfg->addr_offset == 0U) || (to_respond->addr < cfg->addr_offset)) && (addr <= addr_max)) {
+    CANPacket_t to_send;
+    to_send.returned = 0U;
+    to_send.rejected = 0U;
+    to_send.extended = to_respond->extended;
+    to_send.addr = addr;
+    to_send.bus = cfg->target_bus;
+    to_send.data_len_code = to_respond->data_len_code;
+
+    uint8_t len = dlc_to_len[to_respond->data_len_code];
+    for (uint8_t i = 0U; i < len; i++) {
+      to_send.data[i] = (cfg->mode == CAN_RESPONDER_REVERSE) ? to_respond->data[len - 1U - i] : (uint8_t)(~to_respond->data[i]);
+    }
+    can_set_checksum(&to_send);
+
+    can_responder_stats_t *stats = &can_responder_stats[bus_number];
+    if (can_slots_empty(can_queues[cfg->target_bus]) > 0U) {
+      can_send(&to_send, cfg->target_bus);
+
+      uint16_t latency = (uint16_t)MIN(rx_age_us, 0xFFFFU);
+      stats->latency_min = (stats->response_cnt == 0U) ? latency : MIN(stats->latency_min, latency);
+      stats->latency_max = MAX(stats->latency_max, latency);
+      stats->latency_sum += latency;
+      stats->response_cnt += 1U;
+    } else {
+      stats->drop_cnt += 1U;
+    }
+  }
+}
+
+void can_responder_set(uint8_t bus, uint8_t mode, uint8_t target_bus, uint16_t addr_offset) {
+  ENTER_CRITICAL();
+  can_responder[bus].mode = mode;
+  can_responder[bus].target_bus = target_bus;
+  can_responder[bus].addr_offset = addr_offset;
+  (void)memset(&can_responder_stats[bus], 0, sizeof(can_responder_stats_t));
+  EXIT_CRITICAL();
+}
@@ -0,0 +1,124 @@
+// Canned ECU responses for diagnostic emulation (OBD/UDS requests on HIL benches).
+// A received frame that matches an entry on bus, ID and the masked payload prefix is answered with the
+// entry's response frame straight from the RX interrupt. The first matching entry wins.
+
+#define CAN_RESPONSE_TABLE_SIZE 64U
+#define CAN_RESPONSE_HITS_PAGE 14U // hit counters per control read, with the 5 byte trailer in a 64 byte response
+
+typedef struct __attribute__((packed)) {
+  uint8_t bus; // request and response bus
+  uint32_t addr; // request ID, IDs above 0x7FF are extended
+  uint8_t match[8];
+  uint8_t mask[8]; // payload bits compared with match, 0 for wildcard. Frames shorter than the last non-zero mask byte don't match.
+  uint32_t resp_addr;
+  uint8_t resp_len; // bytes, up to 8
+  uint8_t resp_data[8];
+} can_response_entry_t;
+
+typedef struct {
+  can_response_entry_t entry;
+  uint8_t match_len; // bytes the request payload needs
+  bool valid;
+} can_response_slot_t;
+
+typedef struct {
+  bool enabled;
+  uint8_t cnt; // slots in use are below cnt
+  can_response_slot_t slots[CAN_RESPONSE_TABLE_SIZE];
+  uint32_t hits[CAN_RESPONSE_TABLE_SIZE];
+  uint32_t drop_cnt; // matched, but no room in the TX queue
+} can_response_table_t;
+
+can_response_table_t can_response_table;
+
+void can_response_table_rx(const CANPacket_t *msg, uint8_t bus_number) {
+  can_response_table_t *table = &can_response_table;
+  if (table->enabled) {
+    uint8_t len = dlc_to_len[msg->data_len_code];
+    for (uint8_t i = 0U; i < table->cnt; i++) {
+      const can_response_slot_t *slot = &table->slots[i];
+      const can_response_entry_t *entry = &slot->entry;
+      if (slot->valid && (entry->bus == bus_number) && (entry->addr == msg->addr) &&
+          (msg->extended == ((entry->addr > 0x7FFU) ? 1U : 0U)) && (len >= slot->match_len)) {
+        bool match = true;
+        for (uint8_t j = 0U; j < slot->match_len; j++) {
+          match = match && (((msg->data[j] ^ entry->match[j]) & entry->mask[j]) == 0U);
+        }
+
+        if (match) {
+          table->hits[i] += 1U;
+          if (can_slots_empty(can_queues[bus_number]) > 0U) {
+            CANPacket_t resp;
+            resp.returned = 0U;
+            resp.rejected = 0U;
+            resp.extended = (entry->resp_addr > 0x7FFU) ? 1U : 0U;
+            resp.addr = entry->resp_addr;
+            resp.bus = bus_number;
+            resp.data_len_code = entry->resp_len;
+            (void)memcpy(resp.data, entry->resp_data, entry->resp_len);
+            can_set_checksum(&resp);
+            can_send(&resp, bus_number);
+          } else {
+            table->drop_cnt += 1U;
+          }
+          break;
+        }
+      }
+    }
+  }
+}
+
+// Entry upload in endpoint 2 packets: index, entry. Packets may be padded to 64 bytes so a whole table goes in one transfer.
+bool can_response_table_write(const uint8_t *data, uint32_t len) {
+  bool ret = false;
+  if (len >= (1U + sizeof(can_response_entry_t))) {
+    uint8_t idx = data[0];
+    can_response_entry_t entry;
+    (void)memcpy(&entry, &data[1], sizeof(entry));
+    if ((idx < CAN_RESPONSE_TABLE_SIZE) && (entry.bus < PANDA_BUS_CNT) && (entry.addr <= 0x1FFFFFFFU) &&
+        (entry.resp_addr <= 0x1FFFFFFFU) && (entry.resp_len <= 8U)) {
+      uint8_t match_len = 0U;
+      for (uint8_t j = 0U; j < 8U; j++) {
+        match_len = (entry.mask[j] != 0U) ? (j + 1U) : match_len;
+      }
+
+      ENTER_CRITICAL();
+      can_response_slot_t *slot = &can_response_table.slots[idx];
+      slot->entry = entry;
+      slot->match_len = match_len;
+      slot->valid = true;
+      can_response_table.hits[idx] = 0U;
+      can_response_table.cnt = MAX(can_response_table.cnt, idx + 1U);
+      EXIT_CRITICAL();
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+void can_response_table_clear(bool entries) {
+  ENTER_CRITICAL();
+  if (entries) {
+    (void)memset(can_response_table.slots, 0, sizeof(can_response_table.slots));
+    can_response_table.cnt = 0U;
+  }
+  (void)memset(can_response_table.hits, 0, sizeof(can_response_table.hits));
+  can_response_table.drop_cnt = 0U;
+  EXIT_CRITICAL();
+}
+
+// Hit counters of CAN_RESPONSE_HITS_PAGE entries from first, followed by the number of entries in use and the drop count
+uint32_t can_response_table_hits(uint8_t first, uint8_t *data) {
+  uint32_t ret = 0U;
+  if (first < CAN_RESPONSE_TABLE_SIZE) {
+    uint32_t cnt = MIN(CAN_RESPONSE_HITS_PAGE, CAN_RESPONSE_TABLE_SIZE - first);
+    ENTER_CRITICAL();
+    (void)memcpy(data, &can_response_table.hits[first], cnt * sizeof(uint32_t));
+    ret = cnt * sizeof(uint32_t);
+    data[ret] = can_response_table.cnt;
+    WORD_TO_BYTE_ARRAY(&data[ret + 1U], can_response_table.drop_cnt);
+    ret += 5U;
+    EXIT_CRITICAL();
+  }
+  return ret;
+}
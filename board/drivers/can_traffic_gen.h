@@ -0,0 +1,222 @@
+// On-device CAN traffic generator, for loading a bus beyond what the host can push over USB.
+// Generated frames are queued from the process_can refill path whenever the TX queue of the bus is empty.
+// Below 100% load, TRAFFIC_GEN_TIMER restarts the chain when the budget covers the next frame, the 8Hz tick is a fallback.
+
+#define CAN_TRAFFIC_GEN_PAYLOAD_INCREMENTING 0U
+#define CAN_TRAFFIC_GEN_PAYLOAD_RANDOM 1U
+
+// Budget carried over while the bus is busy, in 10ns units. Anything above is counted as dropped.
+#define CAN_TRAFFIC_GEN_CREDIT_MAX (10U * 1000U * 100U)
+
+typedef struct __attribute__((packed)) {
+  uint8_t bus;
+  uint8_t payload; // CAN_TRAFFIC_GEN_PAYLOAD_*
+  uint8_t load; // % of the bus bandwidth, 100 for back-to-back frames
+  uint16_t dlc_mask; // bit N set: DLC N is generated, picked uniformly
+  uint32_t addr_start; // inclusive, IDs above 0x7FF are extended
+  uint32_t addr_end; // inclusive
+} can_traffic_gen_config_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t enabled;
+  uint32_t sent_cnt; // Generated frames queued since start
+  uint32_t drop_cnt; // Frames the target load asked for, but the bus couldn't take
+  uint32_t sent_rate; // Generated frames during the last second
+  uint16_t load; // Bus time used by generated frames during the last second, in 0.1 %
+} can_traffic_gen_stats_t;
+
+typedef struct {
+  can_traffic_gen_config_t config;
+  can_traffic_gen_stats_t stats;
+  uint32_t next_addr;
+  uint32_t seq;
+  uint32_t rand_state;
+  uint32_t credit; // 10ns units
+  uint32_t last_ts;
+  uint32_t last_frame_time; // 10ns units
+  uint32_t window_cnt;
+  uint32_t window_time; // 10ns units
+} can_traffic_gen_t;
+
+can_traffic_gen_t can_traffic_gen[3];
+
+uint32_t can_traffic_gen_rand(can_traffic_gen_t *gen) {
+  // xorshift32
+  gen->rand_state ^= gen->rand_state << 13;
+  gen->rand_state ^= gen->rand_state >> 17;
+  gen->rand_state ^= gen->rand_state << 5;
+  return gen->rand_state;
+}
+
+void can_traffic_gen_build(can_traffic_gen_t *gen, uint8_t bus_number, CANPacket_t *pkt) {
+  // DLC picked uniformly from the mask, classic CAN buses only send up to 8 bytes
+  uint16_t dlc_mask = bus_config[bus_number].canfd_enabled ? gen->config.dlc_mask : (gen->config.dlc_mask & 0x1FFU);
+  dlc_mask = (dlc_mask != 0U) ? dlc_mask : (1U << 8);
+  uint8_t dlc_cnt = 0U;
+  for (uint8_t i = 0U; i < 16U; i++) {
+    dlc_cnt += (dlc_mask >> i) & 1U;
+  }
+  uint8_t pick = can_traffic_gen_rand(gen) % dlc_cnt;
+  uint8_t dlc = 0U;
+  for (uint8_t i = 0U; i < 16U; i++) {
+    if (((dlc_mask >> i) & 1U) != 0U) {
+      if (pick == 0U) {
+        dlc = i;
+        break;
+      }
+      pick -= 1U;
+    }
+  }
+
+  pkt->returned = 0U;
+  pkt->rejected = 0U;
+  pkt->extended = (gen->next_addr > 0x7FFU) ? 1U : 0U;
+  pkt->addr = gen->next_addr;
+  pkt->bus = bus_number;
+  pkt->data_len_code = dlc;
+
+  uint8_t len = dlc_to_len[dlc];
+  if (gen->config.payload == CAN_TRAFFIC_GEN_PAYLOAD_RANDOM) {
+    for (uint8_t i = 0U; i < len; i += 4U) {
+      uint32_t r = can_traffic_gen_rand(gen);
+      WORD_TO_BYTE_ARRAY(&pkt->data[i], r);
+    }
+  } else {
+    // sequence number in the first 4 bytes, byte index in the rest
+    for (uint8_t i = 0U; i < len; i++) {
+      pkt->data[i] = (i < 4U) ? ((gen->seq >> (8U * i)) & 0xFFU) : i;
+    }
+  }
+  can_set_checksum(pkt);
+
+  gen->seq += 1U;
+  gen->next_addr = (gen->next_addr >= gen->config.addr_end) ? gen->config.addr_start : (gen->next_addr + 1U);
+}
+
+// One-shot wakeup after delay_us, an earlier pending wakeup is kept
+void can_traffic_gen_timer_arm(uint32_t delay_us) {
+  uint32_t ticks = MIN(delay_us + 1U, 0xFFFFU);
+  if (((TRAFFIC_GEN_TIMER->CR1 & TIM_CR1_CEN) == 0U) || (ticks < (TRAFFIC_GEN_TIMER->ARR - TRAFFIC_GEN_TIMER->CNT))) {
+    TRAFFIC_GEN_TIMER->CR1 &= ~TIM_CR1_CEN;
+    TRAFFIC_GEN_TIMER->ARR = ticks;
+    TRAFFIC_GEN_TIMER->CNT = 0U;
+    TRAFFIC_GEN_TIMER->CR1 |= TIM_CR1_CEN;
+  }
+}
+
+void can_traffic_gen_timer_handler(void) {
+  if (TRAFFIC_GEN_TIMER->SR != 0U) {
+    TRAFFIC_GEN_TIMER->SR = 0U;
+    for (uint8_t bus = 0U; bus < PANDA_CAN_CNT; bus++) {
+      if (can_traffic_gen[bus].stats.enabled != 0U) {
+        process_can(CAN_NUM_FROM_BUS_NUM(bus));
+      }
+    }
+  }
+}
+
+void can_traffic_gen_init(void) {
+  REGISTER_INTERRUPT(TRAFFIC_GEN_TIMER_IRQ, can_traffic_gen_timer_handler, 50000U, FAULT_INTERRUPT_RATE_TRAFFIC_GEN)
+  register_set(&(TRAFFIC_GEN_TIMER->PSC), (APB1_TIMER_FREQ - 1U), 0xFFFFU); // 1us ticks
+  register_set(&(TRAFFIC_GEN_TIMER->CR1), TIM_CR1_OPM | TIM_CR1_URS, 0x3FU);
+  TRAFFIC_GEN_TIMER->EGR = TIM_EGR_UG; // load the prescaler
+  TRAFFIC_GEN_TIMER->SR = 0U;
+  register_set(&(TRAFFIC_GEN_TIMER->DIER), TIM_DIER_UIE, 0x5F5FU);
+  NVIC_EnableIRQ(TRAFFIC_GEN_TIMER_IRQ);
+}
+
+// Called from process_can before popping the TX queue of the bus
+void can_traffic_gen_refill(uint8_t bus_number) {
+  can_traffic_gen_t *gen = &can_traffic_gen[bus_number];
+  can_ring *q = can_queues[bus_number];
+  // host frames go first, only refill an empty queue
+  if ((gen->stats.enabled != 0U) && (q->w_ptr == q->r_ptr)) {
+    bool send = true;
+    if (gen->config.load < 100U) {
+      uint32_t ts = microsecond_timer_get();
+      gen->credit += MIN(get_ts_elapsed(ts, gen->last_ts), CAN_TRAFFIC_GEN_CREDIT_MAX / 100U) * gen->config.load;
+      gen->last_ts = ts;
+      if (gen->credit > CAN_TRAFFIC_GEN_CREDIT_MAX) {
+        gen->stats.drop_cnt += (gen->credit - CAN_TRAFFIC_GEN_CREDIT_MAX) / MAX(gen->last_frame_time, 1U);
+        gen->credit = CAN_TRAFFIC_GEN_CREDIT_MAX;
+      }
+      send = (gen->credit >= gen->last_frame_time);
+      if (!send) {
+        // credit grows by load per us, wake up when it covers a frame like the last one
+        can_traffic_gen_timer_arm((gen->last_frame_time - gen->credit) / gen->config.load);
+      }
+    }
+
+    if (send) {
+      CANPacket_t pkt;
+      can_traffic_gen_build(gen, bus_number, &pkt);
+      uint32_t frame_time = can_frame_time(&pkt, bus_number);
+      gen->last_frame_time = frame_time;
+      gen->credit -= MIN(gen->credit, frame_time);
+      gen->window_cnt += 1U;
+      gen->window_time += frame_time;
+      gen->stats.sent_cnt += 1U;
+      gen->stats.drop_cnt += can_push(q, &pkt) ? 0U : 1U;
+    }
+  }
+}
+
+// Called at 8Hz, restarts TX on buses the timer missed. Every 8th call closes the stats window.
+void can_traffic_gen_tick(bool window_end) {
+  for (uint8_t bus = 0U; bus < PANDA_CAN_CNT; bus++) {
+    can_traffic_gen_t *gen = &can_traffic_gen[bus];
+    if (gen->stats.enabled != 0U) {
+      process_can(CAN_NUM_FROM_BUS_NUM(bus));
+    }
+    if (window_end) {
+      ENTER_CRITICAL();
+      gen->stats.sent_rate = gen->window_cnt;
+      gen->stats.load = MIN(gen->window_time / 100000U, 0xFFFFU);
+      gen->window_cnt = 0U;
+      gen->window_time = 0U;
+      EXIT_CRITICAL();
+    }
+  }
+}
+
+bool can_traffic_gen_configure(const uint8_t *data, uint32_t len) {
+  bool ret = false;
+  if (len == sizeof(can_traffic_gen_config_t)) {
+    can_traffic_gen_config_t config;
+    (void)memcpy(&config, data, sizeof(config));
+    if ((config.bus < PANDA_CAN_CNT) && (config.payload <= CAN_TRAFFIC_GEN_PAYLOAD_RANDOM) &&
+        (config.load > 0U) && (config.load <= 100U) && (config.dlc_mask != 0U) &&
+        (config.addr_start <= config.addr_end) && (config.addr_end <= 0x1FFFFFFFU)) {
+      ENTER_CRITICAL();
+      can_traffic_gen[config.bus].stats.enabled = 0U;
+      can_traffic_gen[config.bus].config = config;
+      EXIT_CRITICAL();
+      ret = true;
+    }
+  }
+  return ret;
+}
+
+void can_traffic_gen_set_enabled(uint8_t bus, bool enabled) {
+  can_traffic_gen_t *gen = &can_traffic_gen[bus];
+  ENTER_CRITICAL();
+  if (enabled && (gen->config.dlc_mask != 0U)) {
+    (void)memset(&gen->stats, 0, sizeof(gen->stats));
+    gen->next_addr = gen->config.addr_start;
+    gen->seq = 0U;
+    gen->rand_state = 0x2545F491U + bus;
+    gen->credit = 0U;
+    gen->last_ts = microsecond_timer_get();
+    gen->last_frame_time = 0U;
+    gen->window_cnt = 0U;
+    gen->window_time = 0U;
+    gen->stats.enabled = 1U;
+  } else {
+    gen->stats.enabled = 0U;
+  }
+  EXIT_CRITICAL();
+
+  if (gen->stats.enabled != 0U) {
+    process_can(CAN_NUM_FROM_BUS_NUM(bus));
+  }
+}
@@ -11,6 +11,19 @@ typedef struct {
 
 FDCAN_GlobalTypeDef *cans[] = {FDCAN1, FDCAN2, FDCAN3};
 
+// Copies of the frames in the TX FIFO, echoed when their Tx Event FIFO entry arrives
+CANPacket_t can_tx_shadow[3][FDCAN_TX_FIFO_MAX_EL_CNT];
+
+// Set when a module with the classic CAN layout received CAN FD frames, see fdcan_relayout_tick
+bool fdcan_relayout_pending[3] = {false, false, false};
+
+// RX (IT0) and TX (IT1) interrupt lines of each FDCAN module
+const IRQn_Type can_irq_number[3][2] = {
+  {FDCAN1_IT0_IRQn, FDCAN1_IT1_IRQn},
+  {FDCAN2_IT0_IRQn, FDCAN2_IT1_IRQn},
+  {FDCAN3_IT0_IRQn, FDCAN3_IT1_IRQn},
+};
+
 bool can_set_speed(uint8_t can_number) {
   bool ret = true;
   FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
@@ -20,13 +33,29 @@ bool can_set_speed(uint8_t can_number) {
     CANx,
     bus_config[bus_number].can_speed,
     bus_config[bus_number].can_data_speed,
+    bus_config[bus_number].sample_point,
+    bus_config[bus_number].data_sample_point,
     bus_config[bus_number].canfd_non_iso,
-    can_loopback,
-    (unsigned int)(can_silent) & (1U << can_number)
+    (unsigned int)(can_loopback) & (1U << can_number),
+    (unsigned int)(can_silent) & (1U << can_number),
+    (unsigned int)(can_restricted) & (1U << can_number)
   );
   return ret;
 }
 
+// RX coalescing latency bound converted to nominal bit times, as counted by the FDCAN timeout counter.
+// With BRS the counter also ticks on every data phase bit, which are shorter: it runs fast while FD frames are on the
+// bus, so the interrupt comes early but never later than the bound.
+uint16_t can_rx_coalesce_timeout(uint8_t can_number) {
+  uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
+  uint32_t timeout = 0U;
+  if (bus_config[bus_number].rx_coalesce_latency != 0U) {
+    timeout = (bus_config[bus_number].rx_coalesce_latency * bus_config[bus_number].can_speed) / 10000U;
+    timeout = CLAMP(timeout, 1U, 0xFFFFU);
+  }
+  return (uint16_t)timeout;
+}
+
 void can_set_gmlan(uint8_t bus) {
   UNUSED(bus);
   print("GMLAN not available on red panda\n");
@@ -74,6 +103,23 @@ void update_can_health_pkt(uint8_t can_number, bool error_irq) {
   EXIT_CRITICAL();
 }
 
+// Echo frames on actual transmit completion. Must run before a TX FIFO element is reused, so its copy is still valid
+void can_tx_events(uint8_t can_number) {
+  FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
+  fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+
+  CANx->IR |= FDCAN_IR_TEFN;
+  while ((CANx->TXEFS & FDCAN_TXEFS_EFFL) != 0) {
+    uint8_t tx_event_idx = (uint8_t)((CANx->TXEFS >> FDCAN_TXEFS_EFGI_Pos) & 0x1F);
+    // message marker holds the TX FIFO index of the frame
+    uint32_t event_header = *(uint32_t *)(layout->tx_event_sa + (tx_event_idx * FDCAN_TX_EVENT_SIZE) + 4U);
+    uint8_t tx_index = (uint8_t)((event_header >> 24) & 0x1FU);
+    CANx->TXEFA = tx_event_idx;
+
+    can_echo(&can_tx_shadow[can_number][tx_index], can_number);
+  }
+}
+
 void process_can(uint8_t can_number) {
   if (can_number != 0xffU) {
     ENTER_CRITICAL();
@@ -81,46 +127,45 @@ void process_can(uint8_t can_number) {
     FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
     uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
 
+    can_tx_events(can_number);
+
     CANx->IR |= FDCAN_IR_TFE; // Clear Tx FIFO Empty flag
 
-    if ((CANx->TXFQS & FDCAN_TXFQS_TFQF) == 0) {
+    // no new frames while a relayout waits for the TX FIFO to drain
+    if (((CANx->TXFQS & FDCAN_TXFQS_TFQF) == 0) && !fdcan_relayout_pending[can_number]) {
+      can_isotp_refill(bus_number);
+      can_traffic_gen_refill(bus_number);
+
       CANPacket_t to_send;
       if (can_pop(can_queues[bus_number], &to_send)) {
         if (can_check_checksum(&to_send)) {
           can_health[can_number].total_tx_cnt += 1U;
 
-          uint32_t TxFIFOSA = FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET) + (FDCAN_RX_FIFO_0_EL_CNT * FDCAN_RX_FIFO_0_EL_SIZE);
-          // get the index of the next TX FIFO element (0 to FDCAN_TX_FIFO_EL_CNT - 1)
+          fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+          // get the index of the next TX FIFO element (0 to tx_fifo_el_cnt - 1)
           uint8_t tx_index = (CANx->TXFQS >> FDCAN_TXFQS_TFQPI_Pos) & 0x1F;
           // only send if we have received a packet
           canfd_fifo *fifo;
-          fifo = (canfd_fifo *)(TxFIFOSA + (tx_index * FDCAN_TX_FIFO_EL_SIZE));
+          fifo = (canfd_fifo *)(layout->tx_fifo_sa + (tx_index * layout->el_size));
 
           fifo->header[0] = (to_send.extended << 30) | ((to_send.extended != 0U) ? (to_send.addr) : (to_send.addr << 18));
           fifo->header[1] = (to_send.data_len_code << 16) | (bus_config[can_number].canfd_enabled << 21) | (bus_config[can_number].brs_enabled << 20);
 
           uint8_t data_len_w = (dlc_to_len[to_send.data_len_code] / 4U);
           data_len_w += ((dlc_to_len[to_send.data_len_code] % 4U) > 0U) ? 1U : 0U;
+          // classic CAN elements only hold 8 bytes, a classic frame never sends more
+          data_len_w = MIN(data_len_w, layout->el_data_size / 4U);
           for (unsigned int i = 0; i < data_len_w; i++) {
             BYTE_ARRAY_TO_WORD(fifo->data_word[i], &to_send.data[i*4U]);
           }
 
-          CANx->TXBAR = (1UL << tx_index);
-
-          // Send back to USB
-          CANPacket_t to_push;
-
-          to_push.returned = 1U;
-          to_push.rejected = 0U;
-          to_push.extended = to_send.extended;
-          to_push.addr = to_send.addr;
-          to_push.bus = to_send.bus;
-          to_push.data_len_code = to_send.data_len_code;
-          (void)memcpy(to_push.data, to_send.data, dlc_to_len[to_push.data_len_code]);
-          can_set_checksum(&to_push);
+          // Request a Tx Event FIFO entry, with the TX FIFO index as message marker, to echo the frame once sent
+          if (bus_config[bus_number].echo_mode != CAN_ECHO_OFF) {
+            fifo->header[1] |= (1UL << 23) | ((uint32_t)tx_index << 24);
+            can_tx_shadow[can_number][tx_index] = to_send;
+          }
 
-          current_board->set_led(LED_BLUE, true);
-          rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+          CANx->TXBAR = (1UL << tx_index);
         } else {
           can_health[can_number].total_tx_checksum_error_cnt += 1U;
         }
@@ -134,71 +179,167 @@ void process_can(uint8_t can_number) {
   }
 }
 
+// Time since the start of a received frame, from its RX timestamp (taken at SOF) in nominal bit times.
+// The internal timestamp counter also ticks on the shorter data phase bits of BRS frames, so on CAN FD buses with
+// BRS this is an upper bound, off by up to the data phase time of the frames in between. The FDCAN's external
+// timestamp needs the TTCAN time base of FDCAN1, which isn't set up.
+uint32_t fdcan_rx_age_us(const FDCAN_GlobalTypeDef *CANx, const canfd_fifo *fifo, uint8_t bus_number) {
+  uint16_t waited_bits = (uint16_t)(CANx->TSCV - (fifo->header[1] & 0xFFFFU));
+  return ((uint32_t)waited_bits * 10000U) / bus_config[bus_number].can_speed;
+}
+
+// Copy a received message RAM element into a packet
+void fdcan_read_rx_element(const canfd_fifo *fifo, uint8_t bus_number, CANPacket_t *to_push) {
+  to_push->returned = 0U;
+  to_push->rejected = 0U;
+  to_push->extended = (fifo->header[0] >> 30) & 0x1U;
+  to_push->addr = ((to_push->extended != 0U) ? (fifo->header[0] & 0x1FFFFFFFU) : ((fifo->header[0] >> 18) & 0x7FFU));
+  to_push->bus = bus_number;
+  to_push->data_len_code = ((fifo->header[1] >> 16) & 0xFU);
+
+  uint8_t data_len_w = (dlc_to_len[to_push->data_len_code] / 4U);
+  data_len_w += ((dlc_to_len[to_push->data_len_code] % 4U) > 0U) ? 1U : 0U;
+  for (unsigned int i = 0; i < data_len_w; i++) {
+    WORD_TO_BYTE_ARRAY(&to_push->data[i*4U], fifo->data_word[i]);
+  }
+  can_set_checksum(to_push);
+}
+
+void can_forward(CANPacket_t *to_push, uint8_t can_number) {
+  if (bus_config[can_number].forwarding_bus >= 0) {
+    CANPacket_t to_send;
+
+    to_send.returned = 0U;
+    to_send.rejected = 0U;
+    to_send.extended = to_push->extended;
+    to_send.addr = to_push->addr;
+    to_send.bus = bus_config[can_number].forwarding_bus;
+    to_send.data_len_code = to_push->data_len_code;
+    (void)memcpy(to_send.data, to_push->data, dlc_to_len[to_send.data_len_code]);
+    can_set_checksum(&to_send);
+
+    can_send(&to_send, bus_config[can_number].forwarding_bus);
+    can_health[can_number].total_fwd_cnt += 1U;
+  }
+}
+
+// Priority frames from Rx FIFO 1, queued separately so RX FIFO 0 floods can't overwrite them.
+// Every interrupt runs at the same priority, nothing preempts can_rx, so can_rx polls Rx FIFO 1 between
+// Rx FIFO 0 elements to keep priority frames from waiting behind a full FIFO 0.
+void can_rx_prio(uint8_t can_number) {
+  FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
+  uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
+  fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+
+  if ((CANx->IR & FDCAN_IR_RF1L) != 0) {
+    can_rx_prio_lost_cnt[can_number] += 1U;
+  }
+  CANx->IR |= (FDCAN_IR_RF1N | FDCAN_IR_RF1L);
+
+  while ((CANx->RXF1S & FDCAN_RXF1S_F1FL) != 0) {
+    can_health[can_number].total_rx_prio_cnt += 1U;
+    pending_can_live = 1;
+
+    uint8_t rx_fifo_idx = (uint8_t)((CANx->RXF1S >> FDCAN_RXF1S_F1GI_Pos) & 0x3F);
+    canfd_fifo *fifo = (canfd_fifo *)(layout->rx_fifo_1_sa + (rx_fifo_idx * layout->el_size));
+
+    // Same as Rx FIFO 0: CAN FD frame cut off by the classic CAN layout, drop it and switch layouts from the tick
+    if (dlc_to_len[(fifo->header[1] >> 16) & 0xFU] > layout->el_data_size) {
+      CANx->RXF1A = rx_fifo_idx;
+      can_health[can_number].total_rx_lost_cnt += 1U;
+      bus_config[can_number].canfd_enabled = true;
+      fdcan_relayout_pending[can_number] = true;
+      continue;
+    }
+
+    CANPacket_t to_push;
+    fdcan_read_rx_element(fifo, bus_number, &to_push);
+    uint32_t rx_age_us = fdcan_rx_age_us(CANx, fifo, bus_number);
+    CANx->RXF1A = rx_fifo_idx;
+
+    can_forward(&to_push, can_number);
+    can_responder_rx(&to_push, bus_number, rx_age_us);
+    can_latency_probe_rx(&to_push, bus_number, rx_age_us);
+    can_isotp_rx(&to_push, bus_number);
+    can_response_table_rx(&to_push, bus_number);
+    // priority frames always reach the host
+    (void)can_id_stats_rx(&to_push, bus_number, microsecond_timer_get() - rx_age_us);
+
+    current_board->set_led(LED_BLUE, true);
+    can_rx_prio_lost_cnt[can_number] += can_push(&can_rx_prio_q, &to_push) ? 0U : 1U;
+  }
+}
+
 // CAN receive handlers
 // blink blue when we are receiving CAN messages
 void can_rx(uint8_t can_number) {
   FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
   uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
+  fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+
+  // Measure how long ago the oldest message in Rx FIFO 0 started, timestamps are taken at SOF in nominal bit times
+  if ((CANx->RXF0S & FDCAN_RXF0S_F0FL) != 0) {
+    uint8_t oldest_idx = (uint8_t)((CANx->RXF0S >> FDCAN_RXF0S_F0GI_Pos) & 0x3F);
+    canfd_fifo *oldest = (canfd_fifo *)(layout->rx_fifo_0_sa + (oldest_idx * layout->el_size));
+    uint32_t waited_us = fdcan_rx_age_us(CANx, oldest, bus_number);
+    can_health[can_number].rx_latency_max = MAX(can_health[can_number].rx_latency_max, (uint16_t)MIN(waited_us, 0xFFFFU));
+  }
 
   // Clear all new messages from Rx FIFO 0
-  CANx->IR |= FDCAN_IR_RF0N;
+  CANx->IR |= (FDCAN_IR_RF0N | FDCAN_IR_RF0W | FDCAN_IR_TOO);
   while((CANx->RXF0S & FDCAN_RXF0S_F0FL) != 0) {
+    if ((CANx->RXF1S & FDCAN_RXF1S_F1FL) != 0) {
+      can_rx_prio(can_number);
+    }
     can_health[can_number].total_rx_cnt += 1U;
 
     // can is live
     pending_can_live = 1;
 
-    // get the index of the next RX FIFO element (0 to FDCAN_RX_FIFO_0_EL_CNT - 1)
+    // get the index of the next RX FIFO element (0 to rx_fifo_0_el_cnt - 1)
     uint8_t rx_fifo_idx = (uint8_t)((CANx->RXF0S >> FDCAN_RXF0S_F0GI_Pos) & 0x3F);
 
     // Recommended to offset get index by at least +1 if RX FIFO is in overwrite mode and full (datasheet)
     if((CANx->RXF0S & FDCAN_RXF0S_F0F) == FDCAN_RXF0S_F0F) {
-      rx_fifo_idx = ((rx_fifo_idx + 1U) >= FDCAN_RX_FIFO_0_EL_CNT) ? 0U : (rx_fifo_idx + 1U);
+      rx_fifo_idx = ((rx_fifo_idx + 1U) >= layout->rx_fifo_0_el_cnt) ? 0U : (rx_fifo_idx + 1U);
       can_health[can_number].total_rx_lost_cnt += 1U; // At least one message was lost
     }
 
-    uint32_t RxFIFO0SA = FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET);
     CANPacket_t to_push;
     canfd_fifo *fifo;
 
     // getting address
-    fifo = (canfd_fifo *)(RxFIFO0SA + (rx_fifo_idx * FDCAN_RX_FIFO_0_EL_SIZE));
+    fifo = (canfd_fifo *)(layout->rx_fifo_0_sa + (rx_fifo_idx * layout->el_size));
 
-    to_push.returned = 0U;
-    to_push.rejected = 0U;
-    to_push.extended = (fifo->header[0] >> 30) & 0x1U;
-    to_push.addr = ((to_push.extended != 0U) ? (fifo->header[0] & 0x1FFFFFFFU) : ((fifo->header[0] >> 18) & 0x7FFU));
-    to_push.bus = bus_number;
     to_push.data_len_code = ((fifo->header[1] >> 16) & 0xFU);
-
     bool canfd_frame = ((fifo->header[1] >> 21) & 0x1U);
     bool brs_frame = ((fifo->header[1] >> 20) & 0x1U);
 
-    uint8_t data_len_w = (dlc_to_len[to_push.data_len_code] / 4U);
-    data_len_w += ((dlc_to_len[to_push.data_len_code] % 4U) > 0U) ? 1U : 0U;
-    for (unsigned int i = 0; i < data_len_w; i++) {
-      WORD_TO_BYTE_ARRAY(&to_push.data[i*4U], fifo->data_word[i]);
+    // CAN FD frame received with the classic CAN layout: switch to the CAN FD layout from the tick, once the FIFOs
+    // are drained. Drop the frame if its data didn't fit in the element and was cut off.
+    if (canfd_frame && (layout->el_data_size != FDCAN_EL_DATA_SIZE_FD)) {
+      fdcan_relayout_pending[can_number] = true;
     }
-    can_set_checksum(&to_push);
-
-    if (bus_config[can_number].forwarding_bus >= 0) {
-      CANPacket_t to_send;
-
-      to_send.returned = 0U;
-      to_send.rejected = 0U;
-      to_send.extended = to_push.extended;
-      to_send.addr = to_push.addr;
-      to_send.bus = bus_config[can_number].forwarding_bus;
-      to_send.data_len_code = to_push.data_len_code;
-      (void)memcpy(to_send.data, to_push.data, dlc_to_len[to_send.data_len_code]);
-      can_set_checksum(&to_send);
-
-      can_send(&to_send, bus_config[can_number].forwarding_bus);
-      can_health[can_number].total_fwd_cnt += 1U;
+    if (dlc_to_len[to_push.data_len_code] > layout->el_data_size) {
+      can_health[can_number].total_rx_lost_cnt += 1U;
+      bus_config[can_number].canfd_enabled = true;
+      CANx->RXF0A = rx_fifo_idx;
+      continue;
     }
 
+    fdcan_read_rx_element(fifo, bus_number, &to_push);
+    uint32_t rx_age_us = fdcan_rx_age_us(CANx, fifo, bus_number);
+    can_forward(&to_push, can_number);
+    can_responder_rx(&to_push, bus_number, rx_age_us);
+    can_latency_probe_rx(&to_push, bus_number, rx_age_us);
+    can_isotp_rx(&to_push, bus_number);
+    can_response_table_rx(&to_push, bus_number);
+    bool queue = can_id_stats_rx(&to_push, bus_number, microsecond_timer_get() - rx_age_us);
+
     current_board->set_led(LED_BLUE, true);
-    rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    if (queue) {
+      rx_buffer_overflow += can_push(&can_rx_q, &to_push) ? 0U : 1U;
+    }
 
     // Enable CAN FD and BRS if CAN FD message was received
     if (!(bus_config[can_number].canfd_enabled) && (canfd_frame)) {
@@ -217,14 +358,50 @@ void can_rx(uint8_t can_number) {
   update_can_health_pkt(can_number, error_irq);
 }
 
+// Switch a module to the CAN FD layout after it received CAN FD frames. llcan_init clears the message RAM, so this
+// waits for the TX FIFO to drain, with process_can holding new frames back, and empties the RX FIFOs right before.
+// Frames still in the TX FIFO after FDCAN_RELAYOUT_TX_WAIT ticks (no ACK on the bus) are counted as lost.
+#define FDCAN_RELAYOUT_TX_WAIT 8U
+uint8_t fdcan_relayout_wait[3] = {0U, 0U, 0U};
+void fdcan_relayout_tick(void) {
+  for (uint8_t can_number = 0U; can_number < 3U; can_number++) {
+    ENTER_CRITICAL();
+    if (fdcan_relayout_pending[can_number]) {
+      FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
+      uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
+      fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+
+      uint8_t tx_pending = layout->tx_fifo_el_cnt - (uint8_t)((CANx->TXFQS & FDCAN_TXFQS_TFFL) >> FDCAN_TXFQS_TFFL_Pos);
+      if ((tx_pending == 0U) || (fdcan_relayout_wait[can_number] >= FDCAN_RELAYOUT_TX_WAIT)) {
+        can_health[can_number].total_tx_lost_cnt += tx_pending;
+        can_rx_prio(can_number);
+        can_rx(can_number);
+        // whatever arrived since can't be read anymore
+        can_health[can_number].total_rx_lost_cnt += ((CANx->RXF0S & FDCAN_RXF0S_F0FL) >> FDCAN_RXF0S_F0FL_Pos) +
+                                                    ((CANx->RXF1S & FDCAN_RXF1S_F1FL) >> FDCAN_RXF1S_F1FL_Pos);
+
+        llcan_set_ram_layout(CANx, true, bus_config[bus_number].rx_ram_share, can_prio_ids[bus_number], can_prio_id_cnt[bus_number]);
+        bool ret = llcan_init(CANx, can_rx_coalesce_timeout(can_number));
+        UNUSED(ret);
+        fdcan_relayout_pending[can_number] = false;
+        fdcan_relayout_wait[can_number] = 0U;
+        process_can(can_number);
+      } else {
+        fdcan_relayout_wait[can_number] += 1U;
+      }
+    }
+    EXIT_CRITICAL();
+  }
+}
+
 void FDCAN1_IT0_IRQ_Handler(void) { can_rx(0); }
-void FDCAN1_IT1_IRQ_Handler(void) { process_can(0); }
+void FDCAN1_IT1_IRQ_Handler(void) { can_rx_prio(0); process_can(0); }
 
 void FDCAN2_IT0_IRQ_Handler(void) { can_rx(1); }
-void FDCAN2_IT1_IRQ_Handler(void) { process_can(1); }
+void FDCAN2_IT1_IRQ_Handler(void) { can_rx_prio(1); process_can(1); }
 
 void FDCAN3_IT0_IRQ_Handler(void) { can_rx(2);  }
-void FDCAN3_IT1_IRQ_Handler(void) { process_can(2); }
+void FDCAN3_IT1_IRQ_Handler(void) { can_rx_prio(2); process_can(2); }
 
 bool can_init(uint8_t can_number) {
   bool ret = false;
@@ -238,8 +415,11 @@ bool can_init(uint8_t can_number) {
 
   if (can_number != 0xffU) {
     FDCAN_GlobalTypeDef *CANx = CANIF_FROM_CAN_NUM(can_number);
+    uint8_t bus_number = BUS_NUM_FROM_CAN_NUM(can_number);
     ret &= can_set_speed(can_number);
-    ret &= llcan_init(CANx);
+    fdcan_relayout_pending[can_number] = false;
+    llcan_set_ram_layout(CANx, bus_config[bus_number].canfd_enabled, bus_config[bus_number].rx_ram_share, can_prio_ids[bus_number], can_prio_id_cnt[bus_number]);
+    ret &= llcan_init(CANx, can_rx_coalesce_timeout(can_number));
     // in case there are queued up messages
     process_can(can_number);
   }
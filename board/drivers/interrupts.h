@@ -2,6 +2,7 @@ typedef struct interrupt {
   IRQn_Type irq_type;
   void (*handler)(void);
   uint32_t call_counter;
+  uint32_t call_rate;       // Calls during the last full second
   uint32_t max_call_rate;   // Call rate is defined as the amount of calls each second
   uint32_t call_rate_fault;
 } interrupt;
@@ -17,11 +18,12 @@ void unused_interrupt_handler(void) {
 
 interrupt interrupts[NUM_INTERRUPTS];
 
-#define REGISTER_INTERRUPT(irq_num, func_ptr, call_rate, rate_fault) \
+#define REGISTER_INTERRUPT(irq_num, func_ptr, max_rate, rate_fault) \
   interrupts[irq_num].irq_type = (irq_num); \
   interrupts[irq_num].handler = (func_ptr);  \
   interrupts[irq_num].call_counter = 0U;   \
-  interrupts[irq_num].max_call_rate = (call_rate); \
+  interrupts[irq_num].call_rate = 0U;   \
+  interrupts[irq_num].max_call_rate = (max_rate); \
   interrupts[irq_num].call_rate_fault = (rate_fault);
 
 bool check_interrupt_rate = false;
@@ -70,6 +72,7 @@ void interrupt_timer_handler(void) {
       }
 
       // Reset interrupt counters
+      interrupts[i].call_rate = interrupts[i].call_counter;
       interrupts[i].call_counter = 0U;
     }
 
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+import os
+import argparse
+import threading
+import subprocess
+
+from panda_jungle.fleet_flasher import FleetFlasher, FlashJob
+from panda_jungle.flash_sim import SimBackend, SimDevice, sim_image
+
+board_path = os.path.dirname(os.path.realpath(__file__))
+
+def print_jobs(jobs):
+  for job in jobs.values():
+    pct = f"{100 * job.written // job.total:3d}%" if job.total else "    "
+    retry = f" attempt {job.attempts}" if job.attempts > 1 else ""
+    print(f"  {job.serial} {job.state:>10} {pct}{retry}")
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description="flash many panda jungles at once")
+  parser.add_argument("serials", nargs="*", help="jungles to flash, all of them by default")
+  parser.add_argument("--force", action="store_true", help="also flash jungles that are up to date")
+  parser.add_argument("--full", action="store_true", help="write every sector, not just the changed ones")
+  parser.add_argument("--retries", type=int, default=2)
+  parser.add_argument("--parallel", type=int, default=16, help="jungles flashed at once")
+  parser.add_argument("--sim", type=int, default=0, help="flash this many simulated jungles instead")
+  args = parser.parse_args()
+
+  if args.sim:
+    code = sim_image(300 * 1024, b'sim')
+    backend = SimBackend([SimDevice(f"{i:024x}", image=code if i % 3 == 0 else None) for i in range(args.sim)])
+  else:
+    subprocess.check_call(f"scons -C {board_path}/.. -j$(nproc) {board_path}", shell=True)
+    code, backend = None, None
+
+  flasher = FleetFlasher(code, args.serials or None, backend, retries=args.retries, max_parallel=args.parallel,
+                         delta=not args.full, force=args.force)
+  thread = threading.Thread(target=flasher.run)
+  thread.start()
+  while thread.is_alive():
+    thread.join(1.0)
+    print_jobs(flasher.jobs)
+    print()
+
+  failed = [j for j in flasher.jobs.values() if j.state == FlashJob.FAILED]
+  print(f"{len(flasher.jobs)} jungle(s), {len(failed)} failed")
+  for job in failed:
+    print(f"  {job.serial}: {job.error}")
+  exit(1 if failed else 0)
@@ -1,11 +1,36 @@
 // flasher state variables
 uint32_t *prog_ptr = NULL;
 bool unlocked = false;
+bool erase_ahead = false;
+
+// EP2 data is programmed in whole flash words
+uint8_t flash_word_buf[FLASH_WORD_SIZE] __attribute__((aligned(4)));
+uint32_t flash_word_len = 0U;
 
 #ifdef uart_ring
 void debug_ring_callback(uart_ring *ring) {}
 #endif
 
+void program_flash_word(const uint32_t *data) {
+  if (erase_ahead) {
+    int sec = flash_sector_at((uint32_t)prog_ptr);
+    if (sec > 0) {
+      (void)flash_erase_sector(sec, unlocked);
+    }
+  }
+  flash_write_flash_word(prog_ptr, data);
+  prog_ptr += FLASH_WORD_SIZE / 4U;
+}
+
+void flush_flash_word(void) {
+  // pad the last partial flash word as erased
+  if (flash_word_len > 0U) {
+    (void)memset(&flash_word_buf[flash_word_len], 0xff, FLASH_WORD_SIZE - flash_word_len);
+    program_flash_word((uint32_t *)flash_word_buf);
+    flash_word_len = 0U;
+  }
+}
+
 int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
   int resp_len = 0;
 
@@ -32,7 +57,9 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       }
       current_board->set_led(LED_GREEN, 1);
       unlocked = true;
+      erase_ahead = false;
       prog_ptr = (uint32_t *)APP_START_ADDRESS;
+      flash_word_len = 0U;
       break;
     // **** 0xb2: erase sector
     case 0xb2:
@@ -41,6 +68,30 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         resp[1] = 0xff;
       }
       break;
+    // **** 0xb3: erase each sector when the write pointer reaches it, instead of 0xb2
+    case 0xb3:
+      if (unlocked) {
+        erase_ahead = true;
+        resp[1] = 0xff;
+      }
+      break;
+    // **** 0xb4: SHA-1 of a whole sector, the host skips the sectors that already match
+    case 0xb4:
+      sec = req->param1;
+      if ((sec > 0) && (flash_sector_size(sec) != 0U)) {
+        (void)SHA_hash((void *)flash_sector_address(sec), (int)flash_sector_size(sec), resp);
+        resp_len = SHA_DIGEST_SIZE;
+      }
+      break;
+    // **** 0xb5: continue writing at the start of a sector
+    case 0xb5:
+      sec = req->param1;
+      if (unlocked && (sec > 0) && (flash_sector_size(sec) != 0U)) {
+        flush_flash_word();
+        prog_ptr = (uint32_t *)flash_sector_address(sec);
+        resp[1] = 0xff;
+      }
+      break;
     // **** 0xc1: get hardware type
     case 0xc1:
       resp[0] = hw_type;
@@ -90,6 +141,7 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       break;
     // **** 0xd8: reset ST
     case 0xd8:
+      flush_flash_word();
       flush_write_buffer();
       NVIC_SystemReset();
       break;
@@ -112,11 +164,22 @@ void refresh_can_tx_slots_available(void) {}
 
 void comms_endpoint2_write(uint8_t *data, uint32_t len) {
   current_board->set_led(LED_RED, 0);
-  for (uint32_t i = 0; i < len/4; i++) {
-    flash_write_word(prog_ptr, *(uint32_t*)(data+(i*4)));
-
-    //*(uint64_t*)(&spi_tx_buf[0x30+(i*4)]) = *prog_ptr;
-    prog_ptr++;
+  uint32_t pos = 0U;
+  while (pos < len) {
+    if ((flash_word_len == 0U) && ((len - pos) >= FLASH_WORD_SIZE) && ((((uint32_t)&data[pos]) & 3U) == 0U)) {
+      // straight from the packet buffer
+      program_flash_word((uint32_t *)&data[pos]);
+      pos += FLASH_WORD_SIZE;
+    } else {
+      uint32_t n = MIN(FLASH_WORD_SIZE - flash_word_len, len - pos);
+      (void)memcpy(&flash_word_buf[flash_word_len], &data[pos], n);
+      flash_word_len += n;
+      pos += n;
+      if (flash_word_len == FLASH_WORD_SIZE) {
+        program_flash_word((uint32_t *)flash_word_buf);
+        flash_word_len = 0U;
+      }
+    }
   }
   current_board->set_led(LED_RED, 1);
 }
@@ -23,7 +23,7 @@ struct __attribute__((packed)) health_t {
   uint16_t ch6_sbu2_mV;
 };
 
-#define CAN_HEALTH_PACKET_VERSION 4
+#define CAN_HEALTH_PACKET_VERSION 7
 typedef struct __attribute__((packed)) {
   uint8_t bus_off;
   uint32_t bus_off_cnt;
@@ -37,7 +37,7 @@ typedef struct __attribute__((packed)) {
   uint8_t transmit_error_cnt; // Actual state of the transmit error counter, values between 0 and 255. FDCAN_ECR.TEC
   uint32_t total_error_cnt; // How many times any error interrupt was invoked
   uint32_t total_tx_lost_cnt; // Tx event FIFO element lost
-  uint32_t total_rx_lost_cnt; // Rx FIFO 0 message lost due to FIFO full condition
+  uint32_t total_rx_lost_cnt; // Rx FIFO 0 message lost due to FIFO full condition, priority frames are counted separately (0xda)
   uint32_t total_tx_cnt;
   uint32_t total_rx_cnt;
   uint32_t total_fwd_cnt; // Messages forwarded from one bus to another
@@ -47,4 +47,10 @@ typedef struct __attribute__((packed)) {
   uint8_t canfd_enabled;
   uint8_t brs_enabled;
   uint8_t canfd_non_iso;
+  uint16_t irq0_call_rate; // RX interrupt calls during the last second, saturated
+  uint16_t irq1_call_rate; // TX interrupt calls during the last second, saturated
+  uint16_t rx_coalesce_latency; // Configured RX interrupt coalescing latency bound in us, 0 if disabled
+  uint16_t rx_latency_max; // Max measured RX latency (start of frame to interrupt service, includes the frame duration) in us since last read, an upper bound with BRS
+  uint32_t total_rx_prio_cnt; // Priority ID messages received on Rx FIFO 1
+  uint32_t total_tx_echo_cnt; // Transmitted messages confirmed for echo, in any echo mode except off
 } can_health_t;
@@ -13,12 +13,19 @@
 #include "health.h"
 
 #include "drivers/can_common.h"
+#include "drivers/can_traffic_gen.h"
+#include "drivers/can_responder.h"
+#include "drivers/can_latency_probe.h"
+#include "drivers/can_isotp.h"
+#include "drivers/can_response_table.h"
+#include "drivers/can_id_stats.h"
 
 #ifdef STM32H7
   #include "drivers/fdcan.h"
 #else
   #include "drivers/bxcan.h"
 #endif
+#include "drivers/can_autobaud.h"
 
 #include "obj/gitversion.h"
 
@@ -69,6 +76,13 @@ void tick_handler(void) {
     // tick drivers at 8Hz
     usb_tick();
     simple_watchdog_kick();
+    can_traffic_gen_tick((loop_counter % 8) == 0U);
+    can_latency_probe_tick();
+    can_autobaud_tick();
+    can_isotp_tick();
+    #ifdef STM32H7
+      fdcan_relayout_tick();
+    #endif
 
     // decimated to 1Hz
     if ((loop_counter % 8) == 0U) {
@@ -182,6 +196,12 @@ int main(void) {
   REGISTER_INTERRUPT(TICK_TIMER_IRQ, tick_handler, 10U, FAULT_INTERRUPT_RATE_TICK)
   tick_timer_init();
 
+  // ISO-TP consecutive frame pacing
+  can_isotp_init();
+
+  // CAN traffic generator pacing
+  can_traffic_gen_init();
+
 #ifdef DEBUG
   print("DEBUG ENABLED\n");
 #endif
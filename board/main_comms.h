@@ -28,10 +28,46 @@ int get_health_pkt(void *dat) {
   return sizeof(*health);
 }
 
-// send on serial, first byte to select the ring
+// bulk configuration records, first byte to select the target
+#define ENDPOINT2_TARGET_TRAFFIC_GEN 0x01U
+#define ENDPOINT2_TARGET_LATENCY_PROBE 0x02U
+#define ENDPOINT2_TARGET_ISOTP_CONFIG 0x03U
+#define ENDPOINT2_TARGET_ISOTP_DATA 0x04U
+#define ENDPOINT2_TARGET_RESPONSE_TABLE 0x05U
+
 void comms_endpoint2_write(uint8_t *data, uint32_t len) {
-  UNUSED(data);
-  UNUSED(len);
+  if (len > 0U) {
+    switch (data[0]) {
+      case ENDPOINT2_TARGET_TRAFFIC_GEN:
+        if (!can_traffic_gen_configure(&data[1], len - 1U)) {
+          print("Invalid traffic generator config\n");
+        }
+        break;
+      case ENDPOINT2_TARGET_LATENCY_PROBE:
+        if (!can_latency_probe_configure(&data[1], len - 1U)) {
+          print("Invalid latency probe config\n");
+        }
+        break;
+      case ENDPOINT2_TARGET_ISOTP_CONFIG:
+        if (!can_isotp_configure(&data[1], len - 1U)) {
+          print("Invalid ISO-TP config\n");
+        }
+        break;
+      case ENDPOINT2_TARGET_ISOTP_DATA:
+        if (!can_isotp_write(&data[1], len - 1U)) {
+          print("Invalid ISO-TP data\n");
+        }
+        break;
+      case ENDPOINT2_TARGET_RESPONSE_TABLE:
+        if (!can_response_table_write(&data[1], len - 1U)) {
+          print("Invalid response table entry\n");
+        }
+        break;
+      default:
+        print("Unknown endpoint 2 target\n");
+        break;
+    }
+  }
 }
 
 int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
@@ -85,8 +121,13 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         can_health[req->param1].canfd_enabled = bus_config[req->param1].canfd_enabled;
         can_health[req->param1].brs_enabled = bus_config[req->param1].brs_enabled;
         can_health[req->param1].canfd_non_iso = bus_config[req->param1].canfd_non_iso;
+        can_health[req->param1].irq0_call_rate = MIN(interrupts[can_irq_number[req->param1][0]].call_rate, 0xFFFFU);
+        can_health[req->param1].irq1_call_rate = MIN(interrupts[can_irq_number[req->param1][1]].call_rate, 0xFFFFU);
+        can_health[req->param1].rx_coalesce_latency = bus_config[req->param1].rx_coalesce_latency;
         resp_len = sizeof(can_health[req->param1]);
         (void)memcpy(resp, &can_health[req->param1], resp_len);
+        // max latency is reported since the last read
+        can_health[req->param1].rx_latency_max = 0U;
       }
       break;
     // **** 0xc3: fetch MCU UID
@@ -149,16 +190,52 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         (void)memcpy(resp, &code[code_len + 64], resp_len);
       }
       break;
+    // **** 0xd5: per CAN ID statistics. param1 = 0: disable, 1: enable, 2: clear
+    case 0xd5:
+      if (req->param1 <= 1U) {
+        can_id_stats.enabled = (req->param1 == 1U);
+      } else if (req->param1 == 2U) {
+        can_id_stats_clear();
+      } else {
+        print("Invalid CAN ID stats command\n");
+      }
+      break;
     // **** 0xd6: get version
     case 0xd6:
       COMPILE_TIME_ASSERT(sizeof(gitversion) <= USBPACKET_MAX_SIZE);
       (void)memcpy(resp, gitversion, sizeof(gitversion));
       resp_len = sizeof(gitversion) - 1U;
       break;
+    // **** 0xd7: per CAN ID statistics snapshot, param1 = first slot, param2 = 0: statistics, 1: change-only suppressed counts,
+    // 2: statistics of all IDs streamed on the bulk IN endpoint, see can_id_stats_stream_header_t
+    case 0xd7:
+      COMPILE_TIME_ASSERT(sizeof(can_id_stats_page_t) <= USBPACKET_MAX_SIZE);
+      COMPILE_TIME_ASSERT(sizeof(can_id_suppressed_page_t) <= USBPACKET_MAX_SIZE);
+      if (req->param2 == 1U) {
+        resp_len = can_id_suppressed_page(req->param1, resp);
+      } else if (req->param2 == 2U) {
+        resp_len = can_id_stats_stream_start((uint16_t)can_read_buffer.ptr, resp);
+      } else {
+        resp_len = can_id_stats_page(req->param1, resp);
+      }
+      break;
     // **** 0xd8: reset ST
     case 0xd8:
       NVIC_SystemReset();
       break;
+    // **** 0xd9: set change-only mode, param1 = bus, param2 = heartbeat in ms, 0 to send all frames
+    case 0xd9:
+      if (req->param1 < PANDA_BUS_CNT) {
+        bus_config[req->param1].change_heartbeat_ms = req->param2;
+      }
+      break;
+    // **** 0xda: CAN priority frames lost, param1 = CAN module
+    case 0xda:
+      if (req->param1 < 3U) {
+        resp_len = sizeof(can_rx_prio_lost_cnt[0]);
+        (void)memcpy(resp, &can_rx_prio_lost_cnt[req->param1], resp_len);
+      }
+      break;
     // **** 0xdb: set OBD CAN multiplexing mode
     case 0xdb:
       if (req->param1 == 1U) {
@@ -169,6 +246,11 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         current_board->set_can_mode(CAN_MODE_NORMAL);
       }
       break;
+    // **** 0xdc: set RX stream format for this connection, param1 = 0: CANPacket_t, 1: compressed (see can_comms.h)
+    case 0xdc:
+      comms_can_reset();
+      can_rx_compressed = (req->param1 == 1U);
+      break;
     // **** 0xdd: get healthpacket and CANPacket versions
     case 0xdd:
       resp[0] = HEALTH_PACKET_VERSION;
@@ -178,7 +260,7 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       break;
     // **** 0xde: set can bitrate
     case 0xde:
-      if ((req->param1 < PANDA_BUS_CNT) && is_speed_valid(req->param2, speeds, sizeof(speeds)/sizeof(speeds[0]))) {
+      if ((req->param1 < PANDA_BUS_CNT) && is_speed_valid(req->param2, nominal_timings, CAN_BIT_TIMING_CNT(nominal_timings))) {
         bus_config[req->param1].can_speed = req->param2;
         bool ret = can_init(CAN_NUM_FROM_BUS_NUM(req->param1));
         UNUSED(ret);
@@ -191,16 +273,159 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         ++resp_len;
       }
       break;
+    // **** 0xe1: ISO-TP send the uploaded PDU, param1 = channel, param2 = length
+    case 0xe1:
+      if (!can_isotp_send(req->param1, req->param2)) {
+        print("ISO-TP channel busy\n");
+      }
+      break;
+    // **** 0xe2: ISO-TP channel status
+    case 0xe2:
+      if (req->param1 < CAN_ISOTP_CHANNEL_CNT) {
+        resp_len = sizeof(can_isotp_status_t);
+        ENTER_CRITICAL();
+        (void)memcpy(resp, &can_isotp[req->param1].status, resp_len);
+        EXIT_CRITICAL();
+      }
+      break;
+    // **** 0xe3: ISO-TP read the received PDU, param1 = channel, param2 = offset
+    case 0xe3:
+      resp_len = can_isotp_read(req->param1, req->param2, resp, MIN(req->length, USBPACKET_MAX_SIZE));
+      break;
+    // **** 0xe4: set CAN loopback on a single bus
+    case 0xe4:
+      if (req->param1 < PANDA_BUS_CNT) {
+        can_set_loopback(req->param1, req->param2 > 0U);
+      }
+      break;
     // **** 0xe5: set CAN loopback (for testing)
     case 0xe5:
-      can_loopback = (req->param1 > 0U);
-      can_init_all();
+      for (uint8_t i = 0U; i < PANDA_BUS_CNT; i++) {
+        can_set_loopback(i, req->param1 > 0U);
+      }
+      break;
+    // **** 0xe6: set CAN RX interrupt coalescing latency bound in us, 0 disables coalescing
+    case 0xe6:
+      if ((req->param1 < PANDA_BUS_CNT) && current_board->has_canfd) {
+        bus_config[req->param1].rx_coalesce_latency = req->param2;
+        bool ret = can_init(CAN_NUM_FROM_BUS_NUM(req->param1));
+        UNUSED(ret);
+      }
+      break;
+    // **** 0xe7: set share of the CAN controller message RAM used for RX, in %
+    case 0xe7:
+      if ((req->param1 < PANDA_BUS_CNT) && current_board->has_canfd && (req->param2 <= 100U)) {
+        bus_config[req->param1].rx_ram_share = req->param2;
+        bool ret = can_init(CAN_NUM_FROM_BUS_NUM(req->param1));
+        UNUSED(ret);
+      }
+      break;
+    // **** 0xe8: Add CAN priority ID, received on RX FIFO 1.
+    //      param1 = (extended << 15) | (bus << 13) | (ID >> 16), param2 = ID & 0xFFFF. IDs already added are ignored.
+    case 0xe8:
+      {
+        uint8_t bus = ((req->param1 >> 13) & 0x3U);
+        bool extended = ((req->param1 >> 15) != 0U);
+        uint32_t addr = (((uint32_t)req->param1 & 0x1FFFU) << 16) | req->param2;
+        bool valid = (bus < PANDA_CAN_CNT) && current_board->has_canfd && (extended || (addr <= 0x7FFU));
+        if (valid) {
+          addr |= extended ? CAN_PRIO_ID_EXTENDED : 0U;
+          for (uint8_t i = 0U; i < can_prio_id_cnt[bus]; i++) {
+            valid = valid && (can_prio_ids[bus][i] != addr);
+          }
+        }
+        if (valid && (can_prio_id_cnt[bus] < CAN_PRIO_ID_MAX_CNT)) {
+          can_prio_ids[bus][can_prio_id_cnt[bus]] = addr;
+          can_prio_id_cnt[bus] += 1U;
+          bool ret = can_init(CAN_NUM_FROM_BUS_NUM(bus));
+          UNUSED(ret);
+        }
+      }
+      break;
+    // **** 0xe9: Clear CAN priority IDs
+    case 0xe9:
+      if ((req->param1 < PANDA_CAN_CNT) && current_board->has_canfd) {
+        can_prio_id_cnt[req->param1] = 0U;
+        bool ret = can_init(CAN_NUM_FROM_BUS_NUM(req->param1));
+        UNUSED(ret);
+      }
+      break;
+    // **** 0xea: Set CAN echo mode. param1 = (mode << 8) | bus, param2 = N for the sampled mode
+    case 0xea:
+      {
+        uint8_t bus = (req->param1 & 0xFFU);
+        uint8_t mode = (req->param1 >> 8);
+        if ((bus < PANDA_CAN_CNT) && (mode <= CAN_ECHO_SAMPLED) && ((mode != CAN_ECHO_SAMPLED) || (req->param2 > 0U))) {
+          bus_config[bus].echo_mode = mode;
+          bus_config[bus].echo_sample_rate = (mode == CAN_ECHO_SAMPLED) ? req->param2 : 1U;
+          can_echo_sample_cnt[bus] = 0U;
+        }
+      }
+      break;
+    // **** 0xeb: Start/stop CAN traffic generator, configured through endpoint 2
+    case 0xeb:
+      if (req->param1 < PANDA_CAN_CNT) {
+        can_traffic_gen_set_enabled(req->param1, req->param2 != 0U);
+      }
+      break;
+    // **** 0xec: CAN traffic generator stats
+    case 0xec:
+      COMPILE_TIME_ASSERT(sizeof(can_traffic_gen_stats_t) <= USBPACKET_MAX_SIZE);
+      if (req->param1 < PANDA_CAN_CNT) {
+        ENTER_CRITICAL();
+        resp_len = sizeof(can_traffic_gen_stats_t);
+        (void)memcpy(resp, &can_traffic_gen[req->param1].stats, resp_len);
+        EXIT_CRITICAL();
+      }
+      break;
+    // **** 0xed: Set CAN echo responder. param1 = (mode << 8) | (target bus << 4) | bus, param2 = ID offset.
+    //      Offset 0 is only accepted with another target bus, the responses would be answered again.
+    case 0xed:
+      {
+        uint8_t bus = (req->param1 & 0xFU);
+        uint8_t target_bus = ((req->param1 >> 4) & 0xFU);
+        uint8_t mode = (req->param1 >> 8);
+        bool loop = (mode != CAN_RESPONDER_OFF) && (req->param2 == 0U) && (target_bus == bus);
+        if ((bus < PANDA_CAN_CNT) && (target_bus < PANDA_BUS_CNT) && (mode <= CAN_RESPONDER_INVERT) && !loop) {
+          can_responder_set(bus, mode, target_bus, req->param2);
+        }
+      }
+      break;
+    // **** 0xee: CAN echo responder stats
+    case 0xee:
+      if (req->param1 < PANDA_CAN_CNT) {
+        ENTER_CRITICAL();
+        resp_len = sizeof(can_responder_stats_t);
+        (void)memcpy(resp, &can_responder_stats[req->param1], resp_len);
+        EXIT_CRITICAL();
+      }
+      break;
+    // **** 0xef: Start/stop CAN latency probe, configured through endpoint 2
+    case 0xef:
+      can_latency_probe_set_enabled(req->param1 != 0U);
+      break;
+    // **** 0xf0: CAN latency probe stats. param1 = 0: summary, 1: histogram
+    case 0xf0:
+      COMPILE_TIME_ASSERT(sizeof(can_latency_probe_stats_t) <= USBPACKET_MAX_SIZE);
+      COMPILE_TIME_ASSERT(sizeof(can_latency_probe.hist) <= USBPACKET_MAX_SIZE);
+      ENTER_CRITICAL();
+      if (req->param1 == 0U) {
+        resp_len = sizeof(can_latency_probe_stats_t);
+        (void)memcpy(resp, &can_latency_probe.stats, resp_len);
+      } else if (req->param1 == 1U) {
+        resp_len = sizeof(can_latency_probe.hist);
+        (void)memcpy(resp, can_latency_probe.hist, resp_len);
+      } else {
+        print("Invalid latency probe stats page\n");
+      }
+      EXIT_CRITICAL();
       break;
     // **** 0xf1: Clear CAN ring buffer.
     case 0xf1:
       if (req->param1 == 0xFFFFU) {
         print("Clearing CAN Rx queue\n");
         can_clear(&can_rx_q);
+        can_clear(&can_rx_prio_q);
       } else if (req->param1 < PANDA_BUS_CNT) {
         print("Clearing CAN Tx queue\n");
         can_clear(can_queues[req->param1]);
@@ -213,29 +438,83 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
       print("Clearing debug queue.\n");
       clear_debug_buff();
       break;
+    // **** 0xf3: Start/abort CAN automatic bitrate detection
+    case 0xf3:
+      if (req->param1 < PANDA_CAN_CNT) {
+        if (req->param2 != 0U) {
+          can_autobaud_start(req->param1);
+        } else {
+          can_autobaud_abort(req->param1);
+        }
+      }
+      break;
     // **** 0xf4: Set CAN transceiver enable pin
     case 0xf4:
       current_board->enable_can_transciever(req->param1, req->param2 > 0U);
       break;
     // **** 0xf5: Set CAN silent mode
     case 0xf5:
-      can_silent = (req->param1 > 0U) ? ALL_CAN_SILENT : ALL_CAN_LIVE;
-      can_init_all();
+      for (uint8_t i = 0U; i < PANDA_BUS_CNT; i++) {
+        can_set_silent(i, req->param1 > 0U);
+      }
+      break;
+    // **** 0xf6: CAN automatic bitrate detection result
+    case 0xf6:
+      if (req->param1 < PANDA_CAN_CNT) {
+        resp_len = sizeof(can_autobaud_result_t);
+        (void)memcpy(resp, &can_autobaud[req->param1].result, resp_len);
+      }
       break;
     // **** 0xf7: set green led enabled
     case 0xf7:
       green_led_enabled = (req->param1 != 0U);
       break;
+    // **** 0xf8: Set CAN silent mode on a single bus
+    case 0xf8:
+      if (req->param1 < PANDA_BUS_CNT) {
+        can_set_silent(req->param1, req->param2 > 0U);
+      }
+      break;
     // **** 0xf9: set CAN FD data bitrate
+    // param2 in kbps multiplied by 10, or in kbps with bit 8 of param1 set for rates above 6.5 Mbps
     case 0xf9:
-      if ((req->param1 < PANDA_CAN_CNT) &&
-           current_board->has_canfd &&
-           is_speed_valid(req->param2, data_speeds, sizeof(data_speeds)/sizeof(data_speeds[0]))) {
-        bus_config[req->param1].can_data_speed = req->param2;
-        bus_config[req->param1].canfd_enabled = (req->param2 >= bus_config[req->param1].can_speed);
-        bus_config[req->param1].brs_enabled = (req->param2 > bus_config[req->param1].can_speed);
-        bool ret = can_init(CAN_NUM_FROM_BUS_NUM(req->param1));
-        UNUSED(ret);
+      {
+        uint8_t bus = req->param1 & 0xFFU;
+        uint32_t data_speed = ((req->param1 & 0x100U) != 0U) ? (req->param2 * 10U) : req->param2;
+        if ((bus < PANDA_CAN_CNT) &&
+             current_board->has_canfd &&
+             is_speed_valid(data_speed, data_timings, CAN_BIT_TIMING_CNT(data_timings))) {
+          bus_config[bus].can_data_speed = data_speed;
+          bus_config[bus].canfd_enabled = (data_speed >= bus_config[bus].can_speed);
+          bus_config[bus].brs_enabled = (data_speed > bus_config[bus].can_speed);
+          bool ret = can_init(CAN_NUM_FROM_BUS_NUM(bus));
+          UNUSED(ret);
+        }
+      }
+      break;
+    // **** 0xfa: set CAN sample points, param2 low byte nominal, high byte data phase, in %. 0 for the default.
+    case 0xfa:
+      {
+        uint8_t sp = req->param2 & 0xFFU;
+        uint8_t data_sp = (req->param2 >> 8) & 0xFFU;
+        if ((req->param1 < PANDA_CAN_CNT) && current_board->has_canfd &&
+            ((sp == 0U) || ((sp >= CAN_SP_MIN) && (sp <= CAN_SP_MAX))) &&
+            ((data_sp == 0U) || ((data_sp >= CAN_SP_MIN) && (data_sp <= CAN_SP_MAX)))) {
+          bus_config[req->param1].sample_point = sp;
+          bus_config[req->param1].data_sample_point = data_sp;
+          bool ret = can_init(CAN_NUM_FROM_BUS_NUM(req->param1));
+          UNUSED(ret);
+        }
+      }
+      break;
+    // **** 0xfb: CAN response table. param1 = 0: disable, 1: enable, 2: clear hit counters, 3: clear entries
+    case 0xfb:
+      if (req->param1 <= 1U) {
+        can_response_table.enabled = (req->param1 == 1U);
+      } else if (req->param1 <= 3U) {
+        can_response_table_clear(req->param1 == 3U);
+      } else {
+        print("Invalid response table command\n");
       }
       break;
     // **** 0xfc: set CAN FD non-ISO mode
@@ -246,6 +525,11 @@ int comms_control_handler(ControlPacket_t *req, uint8_t *resp) {
         UNUSED(ret);
       }
       break;
+    // **** 0xfd: CAN response table hit counters, param1 = first entry
+    case 0xfd:
+      COMPILE_TIME_ASSERT(((CAN_RESPONSE_HITS_PAGE * sizeof(uint32_t)) + 5U) <= USBPACKET_MAX_SIZE);
+      resp_len = can_response_table_hits(req->param1, resp);
+      break;
     default:
       print("NO HANDLER ");
       puth(req->request);
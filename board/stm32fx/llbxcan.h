@@ -3,37 +3,50 @@
 #define GET_MAILBOX_BYTES_04(msg) ((msg)->RDLR)
 #define GET_MAILBOX_BYTES_48(msg) ((msg)->RDHR)
 
-// SAE 2284-3 : minimum 16 tq, SJW 3, sample point at 81.3%
-#define CAN_QUANTA 16U
-#define CAN_SEQ1 12U
-#define CAN_SEQ2 3U
-#define CAN_SJW  3U
-
 #define CAN_PCLK 48000U
-// 333 = 33.3 kbps
-// 5000 = 500 kbps
-#define can_speed_to_prescaler(x) (CAN_PCLK / CAN_QUANTA * 10U / (x))
+// SAE 2284-3 : minimum 16 tq, SJW 3, sample point at 81.3%
+#define CAN_SP_NOMINAL 81U
+#define CAN_SJW_MAX 3U
+// Fixed sample point, configurable ones are CAN FD only
+#define CAN_SP_MIN 50U
+#define CAN_SP_MAX 90U
+
+// X(speed (kbps multiplied by 10), prescaler, time quanta per bit, sample point)
+#define BXCAN_TIMINGS(X) \
+  X(100U, 300U, 16U, CAN_SP_NOMINAL) \
+  X(200U, 150U, 16U, CAN_SP_NOMINAL) \
+  X(500U, 60U, 16U, CAN_SP_NOMINAL) \
+  X(1000U, 30U, 16U, CAN_SP_NOMINAL) \
+  X(1250U, 24U, 16U, CAN_SP_NOMINAL) \
+  X(2500U, 12U, 16U, CAN_SP_NOMINAL) \
+  X(5000U, 6U, 16U, CAN_SP_NOMINAL) \
+  X(10000U, 3U, 16U, CAN_SP_NOMINAL)
+
+// BTR field limits: BRP 10 bits, TS1 4 bits, TS2 3 bits
+#define BXCAN_TIMING_VALID(speed, prescaler, tq, sp) \
+  CAN_BIT_TIMING_VALID((speed), (prescaler), (tq), (sp), CAN_PCLK, 1024U, 16U, 8U)
+#define BXCAN_TIMING_ENTRY(speed, prescaler, tq, sp) CAN_BIT_TIMING_ENTRY((speed), (prescaler), (tq), (sp), CAN_SJW_MAX)
 
 #define CAN_NAME_FROM_CANIF(CAN_DEV) (((CAN_DEV)==CAN1) ? "CAN1" : (((CAN_DEV) == CAN2) ? "CAN2" : "CAN3"))
 
 void print(const char *a);
 
-// kbps multiplied by 10
-const uint32_t speeds[] = {100U, 200U, 500U, 1000U, 1250U, 2500U, 5000U, 10000U};
-const uint32_t data_speeds[] = {0U}; // No separate data speed, dummy
+const can_bit_timing_t nominal_timings[] = { BXCAN_TIMINGS(BXCAN_TIMING_ENTRY) };
+const can_bit_timing_t data_timings[] = { CAN_BIT_TIMING_ENTRY(0U, 1U, 16U, CAN_SP_NOMINAL, CAN_SJW_MAX) }; // No separate data speed, dummy
 
 bool llcan_set_speed(CAN_TypeDef *CAN_obj, uint32_t speed, bool loopback, bool silent) {
+  BXCAN_TIMINGS(BXCAN_TIMING_VALID)
+
   bool ret = true;
+  const can_bit_timing_t *timing = can_bit_timing_lookup(nominal_timings, CAN_BIT_TIMING_CNT(nominal_timings), speed);
+  // fall back to 500 kbps, setters only accept table speeds
+  timing = (timing != NULL) ? timing : can_bit_timing_lookup(nominal_timings, CAN_BIT_TIMING_CNT(nominal_timings), 5000U);
 
   // initialization mode
   register_set(&(CAN_obj->MCR), CAN_MCR_TTCM | CAN_MCR_INRQ, 0x180FFU);
-  uint32_t timeout_counter = 0U;
+  uint32_t start_time = microsecond_timer_get();
   while((CAN_obj->MSR & CAN_MSR_INAK) != CAN_MSR_INAK){
-    // Delay for about 1ms
-    delay(10000);
-    timeout_counter++;
-
-    if(timeout_counter >= CAN_INIT_TIMEOUT_MS){
+    if (get_ts_elapsed(microsecond_timer_get(), start_time) >= (CAN_INIT_TIMEOUT_MS * 1000U)) {
       print(CAN_NAME_FROM_CANIF(CAN_obj)); print(" set_speed timed out (1)!\n");
       ret = false;
       break;
@@ -41,11 +54,11 @@ bool llcan_set_speed(CAN_TypeDef *CAN_obj, uint32_t speed, bool loopback, bool s
   }
 
   if(ret){
-    // set time quanta from defines
-    register_set(&(CAN_obj->BTR), ((CAN_BTR_TS1_0 * (CAN_SEQ1-1U)) |
-                                   (CAN_BTR_TS2_0 * (CAN_SEQ2-1U)) |
-                                   (CAN_BTR_SJW_0 * (CAN_SJW-1U)) |
-                                   (can_speed_to_prescaler(speed) - 1U)), 0xC37F03FFU);
+    // set time quanta from the timing table
+    register_set(&(CAN_obj->BTR), ((CAN_BTR_TS1_0 * (timing->seg1 - 1U)) |
+                                   (CAN_BTR_TS2_0 * (timing->seg2 - 1U)) |
+                                   (CAN_BTR_SJW_0 * (timing->sjw - 1U)) |
+                                   (timing->prescaler - 1U)), 0xC37F03FFU);
 
     // silent loopback mode for debugging
     if (loopback) {
@@ -58,13 +71,9 @@ bool llcan_set_speed(CAN_TypeDef *CAN_obj, uint32_t speed, bool loopback, bool s
     // reset
     register_set(&(CAN_obj->MCR), CAN_MCR_TTCM | CAN_MCR_ABOM, 0x180FFU);
 
-    timeout_counter = 0U;
+    start_time = microsecond_timer_get();
     while(((CAN_obj->MSR & CAN_MSR_INAK) == CAN_MSR_INAK)) {
-      // Delay for about 1ms
-      delay(10000);
-      timeout_counter++;
-
-      if(timeout_counter >= CAN_INIT_TIMEOUT_MS){
+      if (get_ts_elapsed(microsecond_timer_get(), start_time) >= (CAN_INIT_TIMEOUT_MS * 1000U)) {
         print(CAN_NAME_FROM_CANIF(CAN_obj)); print(" set_speed timed out (2)!\n");
         ret = false;
         break;
@@ -82,13 +91,9 @@ bool llcan_init(CAN_TypeDef *CAN_obj) {
   register_set_bits(&(CAN_obj->FMR), CAN_FMR_FINIT);
 
   // Wait for INAK bit to be set
-  uint32_t timeout_counter = 0U;
+  uint32_t start_time = microsecond_timer_get();
   while(((CAN_obj->MSR & CAN_MSR_INAK) == CAN_MSR_INAK)) {
-    // Delay for about 1ms
-    delay(10000);
-    timeout_counter++;
-
-    if(timeout_counter >= CAN_INIT_TIMEOUT_MS){
+    if (get_ts_elapsed(microsecond_timer_get(), start_time) >= (CAN_INIT_TIMEOUT_MS * 1000U)) {
       print(CAN_NAME_FROM_CANIF(CAN_obj)); print(" initialization timed out!\n");
       ret = false;
       break;
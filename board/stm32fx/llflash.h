@@ -1,3 +1,5 @@
+#define FLASH_WORD_SIZE 4U
+
 bool flash_is_locked(void) {
   return (FLASH->CR & FLASH_CR_LOCK);
 }
@@ -25,4 +27,53 @@ void flash_write_word(void *prog_ptr, uint32_t data) {
   while (FLASH->SR & FLASH_SR_BSY);
 }
 
+void flash_write_flash_word(void *prog_ptr, const uint32_t *data) {
+  flash_write_word(prog_ptr, data[0]);
+}
+
+// sector starting at addr, -1 if it isn't the start of one. 4 x 16K, 64K, then 128K sectors
+int flash_sector_at(uint32_t addr) {
+  int sector = -1;
+  if (addr >= FLASH_BASE) {
+    uint32_t offset = addr - FLASH_BASE;
+    if (offset < 0x10000U) {
+      sector = ((offset % 0x4000U) == 0U) ? (int)(offset / 0x4000U) : -1;
+    } else if (offset == 0x10000U) {
+      sector = 4;
+    } else if ((offset % 0x20000U) == 0U) {
+      sector = 4 + (int)(offset / 0x20000U);
+    } else {
+      // not a sector start
+    }
+  }
+  return sector;
+}
+
+uint32_t flash_sector_address(uint8_t sector) {
+  uint32_t offset;
+  if (sector < 4U) {
+    offset = (uint32_t)sector * 0x4000U;
+  } else if (sector == 4U) {
+    offset = 0x10000U;
+  } else {
+    offset = ((uint32_t)sector - 4U) * 0x20000U;
+  }
+  return FLASH_BASE + offset;
+}
+
+// 0 for sectors that don't exist
+uint32_t flash_sector_size(uint8_t sector) {
+  uint32_t size = 0U;
+  if (sector < 4U) {
+    size = 0x4000U;
+  } else if (sector == 4U) {
+    size = 0x10000U;
+  } else if (sector < 12U) {
+    size = 0x20000U;
+  } else {
+    // no such sector
+  }
+  return size;
+}
+
 void flush_write_buffer(void) { }
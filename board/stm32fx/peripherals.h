@@ -81,6 +81,8 @@ void peripherals_init(void) {
   RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;  // k-line init
   RCC->APB1ENR |= RCC_APB1ENR_TIM6EN;  // interrupt timer
   RCC->APB1ENR |= RCC_APB1ENR_TIM12EN; // gmlan_alt
+  RCC->APB1ENR |= RCC_APB1ENR_TIM13EN; // CAN traffic generator pacing timer
+  RCC->APB1ENR |= RCC_APB1ENR_TIM14EN; // ISO-TP STmin timer
   RCC->APB1ENR |= RCC_APB1ENR_PWREN;   // for RTC config
   RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
   RCC->AHB2ENR |= RCC_AHB2ENR_OTGFSEN;
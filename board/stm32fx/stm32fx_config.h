@@ -33,6 +33,12 @@
 #define INTERRUPT_TIMER_IRQ TIM6_DAC_IRQn
 #define INTERRUPT_TIMER TIM6
 
+#define ISOTP_TIMER_IRQ TIM8_TRG_COM_TIM14_IRQn
+#define ISOTP_TIMER TIM14
+
+#define TRAFFIC_GEN_TIMER_IRQ TIM8_UP_TIM13_IRQn
+#define TRAFFIC_GEN_TIMER TIM13
+
 #define IND_WDG IWDG
 
 #define PROVISION_CHUNK_ADDRESS 0x1FFF79E0U
@@ -65,6 +71,7 @@
 #ifdef BOOTSTUB
   #include "stm32fx/llflash.h"
 #else
+  #include "drivers/can_bit_timing.h"
   #include "stm32fx/llbxcan.h"
 #endif
 
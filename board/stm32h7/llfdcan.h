@@ -2,13 +2,50 @@
 // SAE J2284-5 document specifies a point-to-point communication running at 5 Mbit/s
 
 #define CAN_PCLK 80000U // KHz, sourced from PLL1Q
-#define BITRATE_PRESCALER 2U // Valid from 250Kbps to 5Mbps with 80Mhz clock
 #define CAN_SP_NOMINAL 80U // 80% for both SAE J2284-4 and SAE J2284-5
 #define CAN_SP_DATA_2M 80U // 80% for SAE J2284-4
 #define CAN_SP_DATA_5M 75U // 75% for SAE J2284-5
-#define CAN_QUANTA(speed, prescaler) (CAN_PCLK / ((speed) / 10U * (prescaler)))
-#define CAN_SEG1(tq, sp) (((tq) * (sp) / 100U)- 1U)
-#define CAN_SEG2(tq, sp) ((tq) * (100U - (sp)) / 100U)
+#define CAN_SP_DATA_8M 70U // 7 of 10 time quanta
+#define CAN_SP_MIN 50U // configurable sample point range, every table entry fits the segment limits across it
+#define CAN_SP_MAX 90U
+#define CAN_TDC_MIN_SPEED 20000U // transmitter delay compensation from 2 Mbps
+#define CAN_NOMINAL_SJW_MAX 128U
+#define CAN_DATA_SJW_MAX 16U
+
+// X(speed (kbps multiplied by 10), prescaler, time quanta per bit, default sample point)
+#define FDCAN_NOMINAL_TIMINGS(X) \
+  X(100U, 40U, 200U, CAN_SP_NOMINAL) \
+  X(200U, 20U, 200U, CAN_SP_NOMINAL) \
+  X(500U, 8U, 200U, CAN_SP_NOMINAL) \
+  X(1000U, 4U, 200U, CAN_SP_NOMINAL) \
+  X(1250U, 4U, 160U, CAN_SP_NOMINAL) \
+  X(2500U, 2U, 160U, CAN_SP_NOMINAL) \
+  X(5000U, 2U, 80U, CAN_SP_NOMINAL) \
+  X(10000U, 2U, 40U, CAN_SP_NOMINAL)
+
+// Data phase below 100 kbps can't be reached with DBRP <= 32, 8 Mbps needs a prescaler of 1
+#define FDCAN_DATA_TIMINGS(X) \
+  X(1000U, 32U, 25U, CAN_SP_DATA_2M) \
+  X(1250U, 32U, 20U, CAN_SP_DATA_2M) \
+  X(2500U, 16U, 20U, CAN_SP_DATA_2M) \
+  X(5000U, 8U, 20U, CAN_SP_DATA_2M) \
+  X(10000U, 4U, 20U, CAN_SP_DATA_2M) \
+  X(20000U, 2U, 20U, CAN_SP_DATA_2M) \
+  X(50000U, 1U, 16U, CAN_SP_DATA_5M) \
+  X(80000U, 1U, 10U, CAN_SP_DATA_8M)
+
+// NBTP/DBTP field limits, checked across the whole configurable sample point range
+#define FDCAN_NOMINAL_TIMING_VALID(speed, prescaler, tq, sp) \
+  CAN_BIT_TIMING_VALID((speed), (prescaler), (tq), CAN_SP_MIN, CAN_PCLK, 512U, 256U, 128U) \
+  CAN_BIT_TIMING_VALID((speed), (prescaler), (tq), CAN_SP_MAX, CAN_PCLK, 512U, 256U, 128U)
+
+#define FDCAN_DATA_TIMING_VALID(speed, prescaler, tq, sp) \
+  CAN_BIT_TIMING_VALID((speed), (prescaler), (tq), CAN_SP_MIN, CAN_PCLK, 32U, 32U, 16U) \
+  CAN_BIT_TIMING_VALID((speed), (prescaler), (tq), CAN_SP_MAX, CAN_PCLK, 32U, 32U, 16U) \
+  COMPILE_TIME_ASSERT(((speed) < CAN_TDC_MIN_SPEED) || (((prescaler) * (1U + CAN_SEG1((tq), CAN_SP_MAX))) <= 127U));
+
+#define FDCAN_NOMINAL_TIMING_ENTRY(speed, prescaler, tq, sp) CAN_BIT_TIMING_ENTRY((speed), (prescaler), (tq), (sp), CAN_NOMINAL_SJW_MAX)
+#define FDCAN_DATA_TIMING_ENTRY(speed, prescaler, tq, sp) CAN_BIT_TIMING_ENTRY((speed), (prescaler), (tq), (sp), CAN_DATA_SJW_MAX)
 
 // FDCAN core settings
 #define FDCAN_MESSAGE_RAM_SIZE 0x2800UL
@@ -17,23 +54,43 @@
 #define FDCAN_OFFSET_W 846UL // words for each FDCAN module, equally
 #define FDCAN_END_ADDRESS 0x4000D3FCUL // Message RAM has a width of 4 bytes
 
-// FDCAN_RX_FIFO_0_EL_CNT + FDCAN_TX_FIFO_EL_CNT can't exceed 47 elements (47 * 72 bytes = 3,384 bytes) per FDCAN module
-
-// RX FIFO 0
-#define FDCAN_RX_FIFO_0_EL_CNT 30UL
-#define FDCAN_RX_FIFO_0_HEAD_SIZE 8UL // bytes
-#define FDCAN_RX_FIFO_0_DATA_SIZE 64UL // bytes
-#define FDCAN_RX_FIFO_0_EL_SIZE (FDCAN_RX_FIFO_0_HEAD_SIZE + FDCAN_RX_FIFO_0_DATA_SIZE)
-#define FDCAN_RX_FIFO_0_EL_W_SIZE (FDCAN_RX_FIFO_0_EL_SIZE / 4UL)
-#define FDCAN_RX_FIFO_0_OFFSET 0UL
-
-// TX FIFO
-#define FDCAN_TX_FIFO_EL_CNT 17UL
-#define FDCAN_TX_FIFO_HEAD_SIZE 8UL // bytes
-#define FDCAN_TX_FIFO_DATA_SIZE 64UL // bytes
-#define FDCAN_TX_FIFO_EL_SIZE (FDCAN_TX_FIFO_HEAD_SIZE + FDCAN_TX_FIFO_DATA_SIZE)
-#define FDCAN_TX_FIFO_EL_W_SIZE (FDCAN_TX_FIFO_EL_SIZE / 4UL)
-#define FDCAN_TX_FIFO_OFFSET (FDCAN_RX_FIFO_0_OFFSET + (FDCAN_RX_FIFO_0_EL_CNT * FDCAN_RX_FIFO_0_EL_W_SIZE))
+// Message RAM is partitioned per FDCAN module at init time:
+// - element data size is 64 bytes for CAN FD buses and 8 bytes for classic CAN buses
+// - elements are split between RX FIFO 0 and the TX FIFO according to the expected share of received traffic
+// The Tx Event FIFO used to echo transmitted frames takes the last 256 bytes (32 * 8 bytes).
+// With 64 byte data 43 elements fit in the rest (43 * 72 bytes = 3,096 bytes), with 8 byte data up to 195 elements fit,
+// but the FIFO sizes are limited by hardware to 64 RX and 32 TX elements.
+// When priority IDs are configured, their filter elements and RX FIFO 1 are placed in front of RX FIFO 0.
+#define FDCAN_EL_HEAD_SIZE 8UL // bytes
+#define FDCAN_EL_DATA_SIZE_CLASSIC 8UL // bytes
+#define FDCAN_EL_DATA_SIZE_FD 64UL // bytes
+#define FDCAN_RX_FIFO_0_MAX_EL_CNT 64UL
+#define FDCAN_TX_FIFO_MAX_EL_CNT 32UL
+#define FDCAN_RX_FIFO_1_EL_CNT 8UL // priority IDs only
+#define FDCAN_PRIO_ID_MAX_CNT 8U
+#define FDCAN_PRIO_ID_EXTENDED 0x80000000U // flag of extended IDs passed to llcan_set_ram_layout
+#define FDCAN_STD_FILTER_SIZE 4UL // bytes
+#define FDCAN_EXT_FILTER_SIZE 8UL // bytes
+#define FDCAN_TX_EVENT_SIZE 8UL // bytes
+
+typedef struct {
+  uint32_t std_filter_sa; // absolute start address of the standard ID filter list
+  uint32_t ext_filter_sa; // absolute start address of the extended ID filter list
+  uint32_t rx_fifo_1_sa; // absolute start address of RX FIFO 1
+  uint32_t rx_fifo_0_sa; // absolute start address of RX FIFO 0
+  uint32_t tx_fifo_sa; // absolute start address of the TX FIFO
+  uint32_t tx_event_sa; // absolute start address of the Tx Event FIFO, same number of elements as the TX FIFO
+  uint8_t rx_fifo_1_el_cnt;
+  uint8_t rx_fifo_0_el_cnt;
+  uint8_t tx_fifo_el_cnt;
+  uint8_t el_size; // bytes, same for RX and TX elements
+  uint8_t el_data_size; // bytes
+  uint8_t std_filter_cnt;
+  uint8_t ext_filter_cnt;
+  uint32_t prio_ids[FDCAN_PRIO_ID_MAX_CNT]; // routed to RX FIFO 1, standard IDs from the front, extended ones from the back
+} fdcan_ram_layout_t;
+
+fdcan_ram_layout_t fdcan_ram_layout[3];
 
 #define CAN_NAME_FROM_CANIF(CAN_DEV) (((CAN_DEV)==FDCAN1) ? "FDCAN1" : (((CAN_DEV) == FDCAN2) ? "FDCAN2" : "FDCAN3"))
 #define CAN_NUM_FROM_CANIF(CAN_DEV) (((CAN_DEV)==FDCAN1) ? 0UL : (((CAN_DEV) == FDCAN2) ? 1UL : 2UL))
@@ -41,26 +98,66 @@
 
 void print(const char *a);
 
-// kbps multiplied by 10
-const uint32_t speeds[] = {100U, 200U, 500U, 1000U, 1250U, 2500U, 5000U, 10000U};
-const uint32_t data_speeds[] = {100U, 200U, 500U, 1000U, 1250U, 2500U, 5000U, 10000U, 20000U, 50000U};
+const can_bit_timing_t nominal_timings[] = { FDCAN_NOMINAL_TIMINGS(FDCAN_NOMINAL_TIMING_ENTRY) };
+const can_bit_timing_t data_timings[] = { FDCAN_DATA_TIMINGS(FDCAN_DATA_TIMING_ENTRY) };
+
+
+// Compute the message RAM partition of a module, applied on the next llcan_init
+void llcan_set_ram_layout(FDCAN_GlobalTypeDef *CANx, bool canfd, uint8_t rx_share, const uint32_t *prio_ids, uint8_t prio_id_cnt) {
+  uint32_t can_number = CAN_NUM_FROM_CANIF(CANx);
+  fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+
+  layout->std_filter_cnt = 0U;
+  layout->ext_filter_cnt = 0U;
+  for (uint8_t i = 0U; i < MIN(prio_id_cnt, FDCAN_PRIO_ID_MAX_CNT); i++) {
+    if ((prio_ids[i] & FDCAN_PRIO_ID_EXTENDED) != 0U) {
+      layout->prio_ids[FDCAN_PRIO_ID_MAX_CNT - 1U - layout->ext_filter_cnt] = prio_ids[i] & 0x1FFFFFFFU;
+      layout->ext_filter_cnt += 1U;
+    } else {
+      layout->prio_ids[layout->std_filter_cnt] = prio_ids[i] & 0x7FFU;
+      layout->std_filter_cnt += 1U;
+    }
+  }
 
+  uint32_t el_data_size = canfd ? FDCAN_EL_DATA_SIZE_FD : FDCAN_EL_DATA_SIZE_CLASSIC;
+  uint32_t el_size = FDCAN_EL_HEAD_SIZE + el_data_size;
+  uint32_t rx_fifo_1_cnt = (prio_id_cnt > 0U) ? FDCAN_RX_FIFO_1_EL_CNT : 0U;
+
+  layout->std_filter_sa = FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET);
+  layout->ext_filter_sa = layout->std_filter_sa + (layout->std_filter_cnt * FDCAN_STD_FILTER_SIZE);
+  layout->rx_fifo_1_sa = layout->ext_filter_sa + (layout->ext_filter_cnt * FDCAN_EXT_FILTER_SIZE);
+  layout->rx_fifo_0_sa = layout->rx_fifo_1_sa + (rx_fifo_1_cnt * el_size);
+
+  uint32_t el_total = (FDCAN_OFFSET - (FDCAN_TX_FIFO_MAX_EL_CNT * FDCAN_TX_EVENT_SIZE) - (layout->rx_fifo_0_sa - layout->std_filter_sa)) / el_size;
+  uint32_t rx_cnt = CLAMP((el_total * MIN(rx_share, 100U)) / 100U, 1U, MIN(FDCAN_RX_FIFO_0_MAX_EL_CNT, el_total - 1U));
+  uint32_t tx_cnt = MIN(el_total - rx_cnt, FDCAN_TX_FIFO_MAX_EL_CNT);
+
+  layout->tx_fifo_sa = layout->rx_fifo_0_sa + (rx_cnt * el_size);
+  layout->tx_event_sa = layout->tx_fifo_sa + (tx_cnt * el_size);
+  layout->rx_fifo_1_el_cnt = (uint8_t)rx_fifo_1_cnt;
+  layout->rx_fifo_0_el_cnt = (uint8_t)rx_cnt;
+  layout->tx_fifo_el_cnt = (uint8_t)tx_cnt;
+  layout->el_size = (uint8_t)el_size;
+  layout->el_data_size = (uint8_t)el_data_size;
+}
 
 bool fdcan_request_init(FDCAN_GlobalTypeDef *CANx) {
   bool ret = true;
   // Exit from sleep mode
+  uint32_t start_time = microsecond_timer_get();
   CANx->CCCR &= ~(FDCAN_CCCR_CSR);
-  while ((CANx->CCCR & FDCAN_CCCR_CSA) == FDCAN_CCCR_CSA);
+  while ((CANx->CCCR & FDCAN_CCCR_CSA) == FDCAN_CCCR_CSA) {
+    if (get_ts_elapsed(microsecond_timer_get(), start_time) >= (CAN_INIT_TIMEOUT_MS * 1000U)) {
+      ret = false;
+      break;
+    }
+  }
 
   // Request init
-  uint32_t timeout_counter = 0U;
+  start_time = microsecond_timer_get();
   CANx->CCCR |= FDCAN_CCCR_INIT;
-  while ((CANx->CCCR & FDCAN_CCCR_INIT) == 0) {
-    // Delay for about 1ms
-    delay(10000);
-    timeout_counter++;
-
-    if (timeout_counter >= CAN_INIT_TIMEOUT_MS){
+  while (ret && ((CANx->CCCR & FDCAN_CCCR_INIT) == 0)) {
+    if (get_ts_elapsed(microsecond_timer_get(), start_time) >= (CAN_INIT_TIMEOUT_MS * 1000U)) {
       ret = false;
       break;
     }
@@ -72,13 +169,9 @@ bool fdcan_exit_init(FDCAN_GlobalTypeDef *CANx) {
   bool ret = true;
 
   CANx->CCCR &= ~(FDCAN_CCCR_INIT);
-  uint32_t timeout_counter = 0U;
+  uint32_t start_time = microsecond_timer_get();
   while ((CANx->CCCR & FDCAN_CCCR_INIT) != 0) {
-    // Delay for about 1ms
-    delay(10000);
-    timeout_counter++;
-
-    if (timeout_counter >= CAN_INIT_TIMEOUT_MS) {
+    if (get_ts_elapsed(microsecond_timer_get(), start_time) >= (CAN_INIT_TIMEOUT_MS * 1000U)) {
       ret = false;
       break;
     }
@@ -86,7 +179,11 @@ bool fdcan_exit_init(FDCAN_GlobalTypeDef *CANx) {
   return ret;
 }
 
-bool llcan_set_speed(FDCAN_GlobalTypeDef *CANx, uint32_t speed, uint32_t data_speed, bool non_iso, bool loopback, bool silent) {
+// sample_point, data_sample_point: % in CAN_SP_MIN..CAN_SP_MAX, 0 for the default
+bool llcan_set_speed(FDCAN_GlobalTypeDef *CANx, uint32_t speed, uint32_t data_speed, uint8_t sample_point, uint8_t data_sample_point, bool non_iso, bool loopback, bool silent, bool restricted) {
+  FDCAN_NOMINAL_TIMINGS(FDCAN_NOMINAL_TIMING_VALID)
+  FDCAN_DATA_TIMINGS(FDCAN_DATA_TIMING_VALID)
+
   UNUSED(speed);
   bool ret = fdcan_request_init(CANx);
 
@@ -101,37 +198,48 @@ bool llcan_set_speed(FDCAN_GlobalTypeDef *CANx, uint32_t speed, uint32_t data_sp
     CANx->CCCR &= ~(FDCAN_CCCR_ASM);
     CANx->CCCR &= ~(FDCAN_CCCR_NISO);
 
-    // TODO: add as a separate safety mode
-    // Enable ASM restricted operation(for debug or automatic bitrate switching)
-    //CANx->CCCR |= FDCAN_CCCR_ASM;
-
-    uint8_t prescaler = BITRATE_PRESCALER;
-    if (speed < 2500U) {
-      // The only way to support speeds lower than 250Kbit/s (down to 10Kbit/s)
-      prescaler = BITRATE_PRESCALER * 16U;
+    // Restricted operation: receive and acknowledge valid frames, never send frames or error flags (automatic bitrate detection)
+    if (restricted) {
+      CANx->CCCR |= FDCAN_CCCR_ASM;
     }
 
-    // Set the nominal bit timing values
-    uint16_t tq = CAN_QUANTA(speed, prescaler);
-    uint8_t sp = CAN_SP_NOMINAL;
-    uint8_t seg1 = CAN_SEG1(tq, sp);
-    uint8_t seg2 = CAN_SEG2(tq, sp);
-    uint8_t sjw = MIN(127U, seg2);
+    const can_bit_timing_t *nominal = can_bit_timing_lookup(nominal_timings, CAN_BIT_TIMING_CNT(nominal_timings), speed);
+    const can_bit_timing_t *data = can_bit_timing_lookup(data_timings, CAN_BIT_TIMING_CNT(data_timings), data_speed);
+    // fall back to 500 kbps / 2 Mbps, setters only accept table speeds
+    nominal = (nominal != NULL) ? nominal : can_bit_timing_lookup(nominal_timings, CAN_BIT_TIMING_CNT(nominal_timings), 5000U);
+    data = (data != NULL) ? data : can_bit_timing_lookup(data_timings, CAN_BIT_TIMING_CNT(data_timings), 20000U);
+
+    // Set the nominal bit timing values, segments are only recomputed for a configured sample point
+    uint16_t seg1 = nominal->seg1;
+    uint16_t seg2 = nominal->seg2;
+    uint16_t sjw = nominal->sjw;
+    if ((sample_point >= CAN_SP_MIN) && (sample_point <= CAN_SP_MAX)) {
+      seg1 = CAN_SEG1(nominal->tq, sample_point);
+      seg2 = CAN_SEG2(nominal->tq, sample_point);
+      sjw = CAN_SJW(nominal->tq, sample_point, CAN_NOMINAL_SJW_MAX);
+    }
 
-    CANx->NBTP = (((sjw & 0x7FU)-1U)<<FDCAN_NBTP_NSJW_Pos) | (((seg1 & 0xFFU)-1U)<<FDCAN_NBTP_NTSEG1_Pos) | (((seg2 & 0x7FU)-1U)<<FDCAN_NBTP_NTSEG2_Pos) | (((prescaler & 0x1FFU)-1U)<<FDCAN_NBTP_NBRP_Pos);
+    CANx->NBTP = (((sjw-1U) & 0x7FU)<<FDCAN_NBTP_NSJW_Pos) | (((seg1-1U) & 0xFFU)<<FDCAN_NBTP_NTSEG1_Pos) | (((seg2-1U) & 0x7FU)<<FDCAN_NBTP_NTSEG2_Pos) | (((nominal->prescaler-1U) & 0x1FFU)<<FDCAN_NBTP_NBRP_Pos);
 
     // Set the data bit timing values
-    if (data_speed == 50000U) {
-      sp = CAN_SP_DATA_5M;
-    } else {
-      sp = CAN_SP_DATA_2M;
+    seg1 = data->seg1;
+    seg2 = data->seg2;
+    sjw = data->sjw;
+    if ((data_sample_point >= CAN_SP_MIN) && (data_sample_point <= CAN_SP_MAX)) {
+      seg1 = CAN_SEG1(data->tq, data_sample_point);
+      seg2 = CAN_SEG2(data->tq, data_sample_point);
+      sjw = CAN_SJW(data->tq, data_sample_point, CAN_DATA_SJW_MAX);
     }
-    tq = CAN_QUANTA(data_speed, prescaler);
-    seg1 = CAN_SEG1(tq, sp);
-    seg2 = CAN_SEG2(tq, sp);
-    sjw = MIN(15U, seg2);
 
-    CANx->DBTP = (((sjw & 0xFU)-1U)<<FDCAN_DBTP_DSJW_Pos) | (((seg1 & 0x1FU)-1U)<<FDCAN_DBTP_DTSEG1_Pos) | (((seg2 & 0xFU)-1U)<<FDCAN_DBTP_DTSEG2_Pos) | (((prescaler & 0x1FU)-1U)<<FDCAN_DBTP_DBRP_Pos);
+    CANx->DBTP = (((sjw-1U) & 0xFU)<<FDCAN_DBTP_DSJW_Pos) | (((seg1-1U) & 0x1FU)<<FDCAN_DBTP_DTSEG1_Pos) | (((seg2-1U) & 0xFU)<<FDCAN_DBTP_DTSEG2_Pos) | (((data->prescaler-1U) & 0x1FU)<<FDCAN_DBTP_DBRP_Pos);
+
+    // Transmitter delay compensation: at high data rates the transceiver loop delay exceeds the sample point,
+    // so the received bit is checked at a secondary sample point, measured delay + offset to the sample point
+    CANx->TDCR = 0U;
+    if (data->speed >= CAN_TDC_MIN_SPEED) {
+      CANx->DBTP |= FDCAN_DBTP_TDC;
+      CANx->TDCR = ((data->prescaler * (1U + seg1)) << FDCAN_TDCR_TDCO_Pos) & FDCAN_TDCR_TDCO;
+    }
 
     if (non_iso) {
       // FD non-ISO mode
@@ -158,7 +266,8 @@ bool llcan_set_speed(FDCAN_GlobalTypeDef *CANx, uint32_t speed, uint32_t data_sp
   return ret;
 }
 
-bool llcan_init(FDCAN_GlobalTypeDef *CANx) {
+// rx_timeout: RX interrupt coalescing timeout in bit times, 0 to interrupt on every new message
+bool llcan_init(FDCAN_GlobalTypeDef *CANx, uint16_t rx_timeout) {
   uint32_t can_number = CAN_NUM_FROM_CANIF(CANx);
   bool ret = fdcan_request_init(CANx);
 
@@ -174,50 +283,87 @@ bool llcan_init(FDCAN_GlobalTypeDef *CANx) {
     // FD with BRS
     CANx->CCCR |= (FDCAN_CCCR_FDOE | FDCAN_CCCR_BRSE);
 
-    // Set TX mode to FIFO
-    CANx->TXBC &= ~(FDCAN_TXBC_TFQM);
+    fdcan_ram_layout_t *layout = &fdcan_ram_layout[can_number];
+    // element data size field: 0 = 8 bytes, 7 = 64 bytes
+    uint32_t el_data_size_code = (layout->el_data_size == FDCAN_EL_DATA_SIZE_FD) ? 0x7U : 0x0U;
+
     // Configure TX element data size
-    CANx->TXESC |= 0x7U << FDCAN_TXESC_TBDS_Pos; // 64 bytes
-    //Configure RX FIFO0 element data size
-    CANx->RXESC |= 0x7U << FDCAN_RXESC_F0DS_Pos;
-    // Disable filtering, accept all valid frames received
-    CANx->XIDFC &= ~(FDCAN_XIDFC_LSE); // No extended filters
-    CANx->SIDFC &= ~(FDCAN_SIDFC_LSS); // No standard filters
+    CANx->TXESC = el_data_size_code << FDCAN_TXESC_TBDS_Pos;
+    //Configure RX FIFO0 and FIFO1 element data size
+    CANx->RXESC = (el_data_size_code << FDCAN_RXESC_F0DS_Pos) | (el_data_size_code << FDCAN_RXESC_F1DS_Pos);
+    // Priority ID filters route to FIFO 1, everything else is accepted to FIFO 0
+    CANx->SIDFC = (((layout->std_filter_sa - FDCAN_START_ADDRESS) / 4U) << FDCAN_SIDFC_FLSSA_Pos) | ((uint32_t)layout->std_filter_cnt << FDCAN_SIDFC_LSS_Pos);
+    CANx->XIDFC = (((layout->ext_filter_sa - FDCAN_START_ADDRESS) / 4U) << FDCAN_XIDFC_FLESA_Pos) | ((uint32_t)layout->ext_filter_cnt << FDCAN_XIDFC_LSE_Pos);
     CANx->GFC &= ~(FDCAN_GFC_RRFE); // Accept extended remote frames
     CANx->GFC &= ~(FDCAN_GFC_RRFS); // Accept standard remote frames
-    CANx->GFC &= ~(FDCAN_GFC_ANFE); // Accept extended frames to FIFO 0
-    CANx->GFC &= ~(FDCAN_GFC_ANFS); // Accept standard frames to FIFO 0
+    CANx->GFC &= ~(FDCAN_GFC_ANFE); // Accept non-matching extended frames to FIFO 0
+    CANx->GFC &= ~(FDCAN_GFC_ANFS); // Accept non-matching standard frames to FIFO 0
+
+    // RX FIFO 0 in non-blocking (overwrite) mode
+    CANx->RXF0C = (((layout->rx_fifo_0_sa - FDCAN_START_ADDRESS) / 4U) << FDCAN_RXF0C_F0SA_Pos) |
+                  ((uint32_t)layout->rx_fifo_0_el_cnt << FDCAN_RXF0C_F0S_Pos) |
+                  FDCAN_RXF0C_F0OM;
+    // RX FIFO 0 watermark at half the FIFO, only used for interrupt coalescing
+    if (rx_timeout != 0U) {
+      CANx->RXF0C |= ((uint32_t)layout->rx_fifo_0_el_cnt / 2U) << FDCAN_RXF0C_F0WM_Pos;
+    }
 
-    uint32_t RxFIFO0SA = FDCAN_START_ADDRESS + (can_number * FDCAN_OFFSET);
-    uint32_t TxFIFOSA = RxFIFO0SA + (FDCAN_RX_FIFO_0_EL_CNT * FDCAN_RX_FIFO_0_EL_SIZE);
+    // Timestamp counter in bit times, used to measure RX latency
+    CANx->TSCC = (0x1UL << FDCAN_TSCC_TSS_Pos);
+    // Timeout counter controlled by RX FIFO 0: preset when the FIFO is empty, counts down once the first element is stored
+    CANx->TOCC = ((uint32_t)rx_timeout << FDCAN_TOCC_TOP_Pos) | (0x2UL << FDCAN_TOCC_TOS_Pos);
+    if (rx_timeout != 0U) {
+      CANx->TOCC |= FDCAN_TOCC_ETOC;
+    }
 
-    // RX FIFO 0
-    CANx->RXF0C |= (FDCAN_RX_FIFO_0_OFFSET + (can_number * FDCAN_OFFSET_W)) << FDCAN_RXF0C_F0SA_Pos;
-    CANx->RXF0C |= FDCAN_RX_FIFO_0_EL_CNT << FDCAN_RXF0C_F0S_Pos;
-    // RX FIFO 0 switch to non-blocking (overwrite) mode
-    CANx->RXF0C |= FDCAN_RXF0C_F0OM;
+    // RX FIFO 1 in blocking mode, priority frames are never overwritten
+    CANx->RXF1C = (((layout->rx_fifo_1_sa - FDCAN_START_ADDRESS) / 4U) << FDCAN_RXF1C_F1SA_Pos) |
+                  ((uint32_t)layout->rx_fifo_1_el_cnt << FDCAN_RXF1C_F1S_Pos);
 
-    // TX FIFO (mode set earlier)
-    CANx->TXBC |= (FDCAN_TX_FIFO_OFFSET + (can_number * FDCAN_OFFSET_W)) << FDCAN_TXBC_TBSA_Pos;
-    CANx->TXBC |= FDCAN_TX_FIFO_EL_CNT << FDCAN_TXBC_TFQS_Pos;
+    // TX FIFO mode
+    CANx->TXBC = (((layout->tx_fifo_sa - FDCAN_START_ADDRESS) / 4U) << FDCAN_TXBC_TBSA_Pos) |
+                 ((uint32_t)layout->tx_fifo_el_cnt << FDCAN_TXBC_TFQS_Pos);
+    // Tx Event FIFO, an event is stored for each transmitted frame that requests one
+    CANx->TXEFC = (((layout->tx_event_sa - FDCAN_START_ADDRESS) / 4U) << FDCAN_TXEFC_EFSA_Pos) |
+                  ((uint32_t)layout->tx_fifo_el_cnt << FDCAN_TXEFC_EFS_Pos);
 
     // Flush allocated RAM
-    uint32_t EndAddress = TxFIFOSA + (FDCAN_TX_FIFO_EL_CNT * FDCAN_TX_FIFO_EL_SIZE);
-    for (uint32_t RAMcounter = RxFIFO0SA; RAMcounter < EndAddress; RAMcounter += 4U) {
+    uint32_t EndAddress = layout->std_filter_sa + FDCAN_OFFSET;
+    for (uint32_t RAMcounter = layout->std_filter_sa; RAMcounter < EndAddress; RAMcounter += 4U) {
         *(uint32_t *)(RAMcounter) = 0x00000000;
     }
 
+    // Dual ID filter elements with both IDs set to the priority ID, stored in FIFO 1
+    for (uint8_t i = 0U; i < layout->std_filter_cnt; i++) {
+      uint32_t id = layout->prio_ids[i];
+      *(uint32_t *)(layout->std_filter_sa + (i * FDCAN_STD_FILTER_SIZE)) = (0x1UL << 30) | (0x2UL << 27) | (id << 16) | id;
+    }
+    for (uint8_t i = 0U; i < layout->ext_filter_cnt; i++) {
+      uint32_t id = layout->prio_ids[FDCAN_PRIO_ID_MAX_CNT - 1U - i];
+      *(uint32_t *)(layout->ext_filter_sa + (i * FDCAN_EXT_FILTER_SIZE)) = (0x2UL << 29) | id;
+      *(uint32_t *)(layout->ext_filter_sa + (i * FDCAN_EXT_FILTER_SIZE) + 4U) = (0x1UL << 30) | id;
+    }
+
     // Enable both interrupts for each module
     CANx->ILE = (FDCAN_ILE_EINT0 | FDCAN_ILE_EINT1);
 
     CANx->IE &= 0x0U; // Reset all interrupts
     // Messages for INT0
-    CANx->IE |= FDCAN_IE_RF0NE; // Rx FIFO 0 new message
+    if (rx_timeout != 0U) {
+      CANx->IE |= FDCAN_IE_RF0WE | FDCAN_IE_TOOE; // Rx FIFO 0 watermark reached or oldest message waited too long
+    } else {
+      CANx->IE |= FDCAN_IE_RF0NE; // Rx FIFO 0 new message
+    }
     CANx->IE |= FDCAN_IE_PEDE | FDCAN_IE_PEAE | FDCAN_IE_BOE | FDCAN_IE_EPE | FDCAN_IE_RF0LE;
 
     // Messages for INT1 (Only TFE works??)
-    CANx->ILS |= FDCAN_ILS_TFEL;
-    CANx->IE |= FDCAN_IE_TFEE; // Tx FIFO empty
+    CANx->ILS |= FDCAN_ILS_TFEL | FDCAN_ILS_TEFNL;
+    CANx->IE |= FDCAN_IE_TFEE | FDCAN_IE_TEFNE; // Tx FIFO empty, Tx Event FIFO new entry
+    // Priority frames in Rx FIFO 1 are serviced by INT1, and polled from INT0 while it drains Rx FIFO 0
+    if (layout->rx_fifo_1_el_cnt > 0U) {
+      CANx->ILS |= FDCAN_ILS_RF1NL | FDCAN_ILS_RF1LL;
+      CANx->IE |= FDCAN_IE_RF1NE | FDCAN_IE_RF1LE;
+    }
 
     ret = fdcan_exit_init(CANx);
     if(!ret) {
@@ -246,6 +392,11 @@ bool llcan_init(FDCAN_GlobalTypeDef *CANx) {
 void llcan_clear_send(FDCAN_GlobalTypeDef *CANx) {
   // from datasheet: "Transmit cancellation is not intended for Tx FIFO operation."
   // so we need to clear pending transmission manually by resetting FDCAN core
-  bool ret = llcan_init(CANx);
+  // keep the currently configured RX coalescing timeout across the reset
+  uint16_t rx_timeout = 0U;
+  if ((CANx->TOCC & FDCAN_TOCC_ETOC) != 0U) {
+    rx_timeout = (uint16_t)((CANx->TOCC & FDCAN_TOCC_TOP) >> FDCAN_TOCC_TOP_Pos);
+  }
+  bool ret = llcan_init(CANx, rx_timeout);
   UNUSED(ret);
 }
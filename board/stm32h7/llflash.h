@@ -1,3 +1,6 @@
+// the H7 programs 256-bit flash words
+#define FLASH_WORD_SIZE (FLASH_NB_32BITWORD_IN_FLASHWORD * 4U)
+
 bool flash_is_locked(void) {
   return (FLASH->CR1 & FLASH_CR_LOCK);
 }
@@ -10,6 +13,7 @@ void flash_unlock(void) {
 bool flash_erase_sector(uint8_t sector, bool unlocked) {
   // don't erase the bootloader(sector 0)
   if (sector != 0 && sector < 8 && unlocked) {
+    while (FLASH->SR1 & FLASH_SR_QW);
     FLASH->CR1 = (sector << 8) | FLASH_CR_SER;
     FLASH->CR1 |= FLASH_CR_START;
     while (FLASH->SR1 & FLASH_SR_QW);
@@ -25,9 +29,38 @@ void flash_write_word(void *prog_ptr, uint32_t data) {
   while (FLASH->SR1 & FLASH_SR_QW);
 }
 
+void flash_write_flash_word(void *prog_ptr, const uint32_t *data) {
+  // wait for the previous flash word only now, it programs while the next USB packet comes in
+  while (FLASH->SR1 & FLASH_SR_QW);
+  volatile uint32_t *pp = prog_ptr;
+  FLASH->CR1 |= FLASH_CR_PG;
+  for (uint32_t i = 0U; i < FLASH_NB_32BITWORD_IN_FLASHWORD; i++) {
+    pp[i] = data[i];
+  }
+}
+
+// sector starting at addr, -1 if it isn't the start of one
+int flash_sector_at(uint32_t addr) {
+  int sector = -1;
+  if ((addr >= FLASH_BANK1_BASE) && (((addr - FLASH_BANK1_BASE) % FLASH_SECTOR_SIZE) == 0U)) {
+    sector = (int)((addr - FLASH_BANK1_BASE) / FLASH_SECTOR_SIZE);
+  }
+  return sector;
+}
+
+uint32_t flash_sector_address(uint8_t sector) {
+  return FLASH_BANK1_BASE + ((uint32_t)sector * FLASH_SECTOR_SIZE);
+}
+
+// 0 for sectors that don't exist
+uint32_t flash_sector_size(uint8_t sector) {
+  return (sector < 8U) ? FLASH_SECTOR_SIZE : 0U;
+}
+
 void flush_write_buffer(void) {
   if (FLASH->SR1 & FLASH_SR_WBNE) {
     FLASH->CR1 |= FLASH_CR_FW;
     while (FLASH->SR1 & FLASH_CR_FW);
   }
+  while (FLASH->SR1 & FLASH_SR_QW);
 }
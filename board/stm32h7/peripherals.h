@@ -84,6 +84,8 @@ void peripherals_init(void) {
   RCC->APB1LENR |= RCC_APB1LENR_DAC12EN; // DAC
   RCC->APB2ENR |= RCC_APB2ENR_TIM8EN;  // tick timer
   RCC->APB1LENR |= RCC_APB1LENR_TIM12EN;  // slow loop
+  RCC->APB1LENR |= RCC_APB1LENR_TIM13EN;  // CAN traffic generator pacing timer
+  RCC->APB1LENR |= RCC_APB1LENR_TIM14EN;  // ISO-TP STmin timer
   RCC->APB1LENR |= RCC_APB1LENR_I2C5EN;  // codec I2C
   RCC->APB2ENR |= RCC_APB2ENR_TIM1EN;  // clock source timer
   RCC->AHB3ENR |= RCC_AHB3ENR_SDMMC1EN; // SDMMC
@@ -41,6 +41,12 @@ separate IRQs for RX and TX.
 #define INTERRUPT_TIMER_IRQ TIM6_DAC_IRQn
 #define INTERRUPT_TIMER TIM6
 
+#define ISOTP_TIMER_IRQ TIM8_TRG_COM_TIM14_IRQn
+#define ISOTP_TIMER TIM14
+
+#define TRAFFIC_GEN_TIMER_IRQ TIM8_UP_TIM13_IRQn
+#define TRAFFIC_GEN_TIMER TIM13
+
 #define IND_WDG IWDG1
 
 #define PROVISION_CHUNK_ADDRESS 0x080FFFE0U
@@ -74,6 +80,7 @@ separate IRQs for RX and TX.
 #ifdef BOOTSTUB
   #include "stm32h7/llflash.h"
 #else
+  #include "drivers/can_bit_timing.h"
   #include "stm32h7/llfdcan.h"
 #endif
 
@@ -9,13 +9,18 @@ import binascii
 import warnings
 import logging
 from functools import wraps
-from typing import Optional
+from collections import deque
+from typing import List, Optional
 from itertools import accumulate
 
 from .base import BaseHandle
-from .constants import FW_PATH, McuType
+from .can_batch import CanFrameBatch
+from .can_reader import CanRxReader
+from .can_sender import CanTxSender
+from .constants import FW_PATH, McuType, CANPACKET_HEAD_SIZE, DLC_TO_LEN
 from .dfu import PandaJungleDFU
 from .usb import PandaJungleUsbHandle
+from .usb_monitor import UsbMonitor, JUNGLE_IDS, DFU_IDS
 
 __version__ = '0.0.10'
 
@@ -24,11 +29,17 @@ LOGLEVEL = os.environ.get('LOGLEVEL', 'INFO').upper()
 logging.basicConfig(level=LOGLEVEL, format='%(message)s')
 
 USBPACKET_MAX_SIZE = 0x40
-CANPACKET_HEAD_SIZE = 0x6
-DLC_TO_LEN = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64]
+FLASH_STEP = 0x1000  # bytes per EP2 bulk write when flashing
+FLASH_TIMEOUT_MS = 15000  # long enough for the bootstub to erase a sector in the middle of a write
 LEN_TO_DLC = {length: dlc for (dlc, length) in enumerate(DLC_TO_LEN)}
 
 
+class CanSendTimeout(usb1.USBErrorTimeout):
+  # the jungle's TX queues stayed full, the first sent frames of the batch were accepted and the rest weren't
+  def __init__(self, sent):
+    super().__init__()
+    self.sent = sent
+
 def calculate_checksum(data):
   res = 0
   for b in data:
@@ -89,6 +100,162 @@ def unpack_can_buffer(dat):
 
   return (ret, dat)
 
+# compiled versions built by scons, with the pure Python ones as fallback
+pack_can_buffer_py, unpack_can_buffer_py = pack_can_buffer, unpack_can_buffer
+try:
+  from ._can_buffer import pack_can_buffer, unpack_can_buffer  # noqa: F811
+except ImportError:
+  pass
+
+# set bit positions of every byte, for the bitmaps of XORed payloads
+BIT_POSITIONS = [tuple(i for i in range(8) if (b >> i) & 1) for b in range(256)]
+
+class CanRxDecompressor:
+  # Decoder of the compressed RX stream, see board/can_comms.h for the record layout.
+  # Keeps the dictionary of the connection, so it must be reset along with the firmware. A record that fails its
+  # check byte or refers to an unknown index means part of the stream was lost: everything up to the next sync
+  # record is dropped, counted in error_cnt.
+  DICT_SIZE = 256
+  REC_XOR = 0x1
+  REC_NEW = 0x2
+  REC_NO_INDEX = 0x4
+  REC_SYNC = 0x8
+  SYNC = bytes([REC_SYNC, 0xA5, 0x5A, 0xC3, 0x3C, 0x96, 0x69])
+  SYNC_INTERVAL = 4096
+
+  def __init__(self):
+    self.error_cnt = 0
+    self.reset()
+
+  def reset(self):
+    self.keys = [None] * self.DICT_SIZE  # (address, bus, XOR of the header bytes, base bus, CAN_FLAG_*)
+    self.payloads = [b''] * self.DICT_SIZE
+    self.synced = True
+
+  def _lost(self):
+    self.error_cnt += 1
+    self.synced = False
+
+  def decode(self, dat):
+    frames, _, datas, tail = self._decode(dat)
+    return ([(key[0], 0, data, key[1]) for key, data in zip(frames, datas)], tail)
+
+  def decode_batch(self, dat):
+    """Like decode, but the frames as a CanFrameBatch"""
+    frames, dlcs, datas, tail = self._decode(dat)
+    batch = CanFrameBatch.from_columns([key[0] for key in frames], bytes(key[3] for key in frames),
+                                       bytes(key[4] for key in frames), dlcs, b''.join(datas))
+    return (batch, tail)
+
+  def _decode(self, dat):
+    # keys, DLCs and payloads of the decoded frames, and the incomplete tail
+    frames = []
+    dlcs = bytearray()
+    datas = []
+    keys = self.keys
+    payloads = self.payloads
+    pos = 0
+    end = len(dat)
+    # a record is only consumed when it's complete, the rest goes to the next transfer
+    while pos < end:
+      if not self.synced:
+        found = dat.find(self.SYNC, pos)
+        if found < 0:
+          # keep what could be the start of a sync record
+          pos = max(pos, end - len(self.SYNC) + 1)
+          break
+        pos = found
+        self.synced = True
+
+      flags = dat[pos]
+      if flags & self.REC_SYNC:
+        if pos + len(self.SYNC) > end:
+          break
+        if dat[pos:pos + len(self.SYNC)] != self.SYNC:
+          self._lost()
+          pos += 1
+          continue
+        self.reset()
+        keys = self.keys
+        payloads = self.payloads
+        pos += len(self.SYNC)
+        continue
+
+      data_len = DLC_TO_LEN[flags >> 4]
+      p = pos + 1
+      idx = None
+      if not flags & self.REC_NO_INDEX:
+        if p >= end:
+          break
+        idx = dat[p]
+        p += 1
+
+      if flags & (self.REC_NEW | self.REC_NO_INDEX):
+        if p + 5 > end:
+          break
+        base_bus = (dat[p] >> 1) & 0x7
+        bus = base_bus
+        if (dat[p + 1] >> 1) & 0x1:
+          # returned
+          bus += 128
+        if dat[p + 1] & 0x1:
+          # rejected
+          bus += 192
+        key = ((dat[p + 4] << 24 | dat[p + 3] << 16 | dat[p + 2] << 8 | dat[p + 1]) >> 3, bus,
+               dat[p] ^ dat[p + 1] ^ dat[p + 2] ^ dat[p + 3] ^ dat[p + 4], base_bus, dat[p + 1] & 0x7)
+        p += 5
+      else:
+        key = keys[idx]
+        if key is None:
+          self._lost()
+          pos += 1
+          continue
+
+      if flags & self.REC_XOR:
+        bitmap_len = (data_len + 7) >> 3
+        if p + bitmap_len > end:
+          break
+        changed = [(i << 3) + b for i in range(bitmap_len) for b in BIT_POSITIONS[dat[p + i]]]
+        p += bitmap_len
+        if p + len(changed) > end:
+          break
+        data = bytearray(payloads[idx])
+        if len(data) != data_len:
+          self._lost()
+          pos += 1
+          continue
+        for i in changed:
+          data[i] ^= dat[p]
+          p += 1
+        data = bytes(data)
+      else:
+        if p + data_len > end:
+          break
+        data = bytes(dat[p:p + data_len])
+        p += data_len
+
+      # check byte: the CANPacket_t checksum of the rebuilt frame
+      if p >= end:
+        break
+      check = (flags & 0xF0) ^ key[2] ^ dat[p]
+      for b in data:
+        check ^= b
+      if check != 0:
+        self._lost()
+        pos += 1
+        continue
+      p += 1
+
+      if idx is not None:
+        keys[idx] = key
+        payloads[idx] = data
+      frames.append(key)
+      dlcs.append(flags >> 4)
+      datas.append(data)
+      pos = p
+
+    return (frames, dlcs, datas, dat[pos:])
+
 def ensure_health_packet_version(fn):
   @wraps(fn)
   def wrapper(self, *args, **kwargs):
@@ -131,22 +298,81 @@ class PandaJungle:
   F4_DEVICES = (HW_TYPE_V1, )
   H7_DEVICES = (HW_TYPE_V2, )
 
-  CAN_PACKET_VERSION = 4
+  CAN_PACKET_VERSION = 5
   HEALTH_PACKET_VERSION = 1
-  CAN_HEALTH_PACKET_VERSION = 4
+  CAN_HEALTH_PACKET_VERSION = 7
   HEALTH_STRUCT = struct.Struct("<IffffffHHHHHHHHHHHH")
-  CAN_HEALTH_STRUCT = struct.Struct("<BIBBBBBBBBIIIIIIIHHBBB")
+  CAN_HEALTH_STRUCT = struct.Struct("<BIBBBBBBBBIIIIIIIHHBBBHHHHII")
 
   HARNESS_ORIENTATION_NONE = 0
   HARNESS_ORIENTATION_1 = 1
   HARNESS_ORIENTATION_2 = 2
 
-  def __init__(self, serial: Optional[str] = None, claim: bool = True):
+  CAN_ECHO_FULL = 0
+  CAN_ECHO_OFF = 1
+  CAN_ECHO_COUNT = 2
+  CAN_ECHO_SAMPLED = 3
+
+  TRAFFIC_GEN_PAYLOAD_INCREMENTING = 0
+  TRAFFIC_GEN_PAYLOAD_RANDOM = 1
+  TRAFFIC_GEN_CONFIG_STRUCT = struct.Struct("<BBBBHII")
+  TRAFFIC_GEN_STATS_STRUCT = struct.Struct("<BIIIH")
+
+  RESPONDER_OFF = 0
+  RESPONDER_REVERSE = 1
+  RESPONDER_INVERT = 2
+  RESPONDER_ADDR_OFFSET = 0x400
+  RESPONDER_STATS_STRUCT = struct.Struct("<IIHHI")
+
+  LATENCY_PROBE_CONFIG_STRUCT = struct.Struct("<BBBIH")
+  LATENCY_PROBE_STATS_STRUCT = struct.Struct("<BIIIIIQ")
+  LATENCY_PROBE_HIST_STRUCT = struct.Struct("<16I")
+
+  AUTOBAUD_IDLE = 0
+  AUTOBAUD_NOMINAL = 1
+  AUTOBAUD_DATA = 2
+  AUTOBAUD_LOCKED = 3
+  AUTOBAUD_FAILED = 4
+  AUTOBAUD_RESULT_STRUCT = struct.Struct("<BIIII")
+
+  ISOTP_CHANNEL_CNT = 2
+  ISOTP_MAX_LEN = 4095
+  ISOTP_TX_IDLE = 0
+  ISOTP_TX_WAIT_FC = 1
+  ISOTP_TX_SENDING = 2
+  ISOTP_RX_IDLE = 0
+  ISOTP_RX_RECEIVING = 1
+  ISOTP_RX_DONE = 2
+  ISOTP_ERR_NONE = 0
+  ISOTP_ERR_TIMEOUT_FC = 1
+  ISOTP_ERR_TIMEOUT_CF = 2
+  ISOTP_ERR_OVERFLOW = 3
+  ISOTP_ERR_WRONG_SN = 4
+  ISOTP_ERR_RX_BUSY = 5
+  ISOTP_ERR_TIMEOUT_TX = 6
+  ISOTP_CONFIG_STRUCT = struct.Struct("<BBBIIBBBH")
+  ISOTP_STATUS_STRUCT = struct.Struct("<BBBBHHHHIII")
+  ISOTP_DATA_CHUNK = 60  # endpoint 2 packet minus target, channel and offset
+
+  RESPONSE_TABLE_SIZE = 64
+  RESPONSE_TABLE_HITS_PAGE = 14
+  RESPONSE_ENTRY_STRUCT = struct.Struct("<BBBI8s8sIB8s")  # target, index, can_response_entry_t
+
+  CAN_ID_STATS_SIZE = 256
+  CAN_ID_STATS_PAGE_HEADER_STRUCT = struct.Struct("<HHI")
+  CAN_ID_STATS_STREAM_HEADER_STRUCT = struct.Struct("<HHHI")
+  CAN_ID_STATS_RECORD_STRUCT = struct.Struct("<IIB8sIHHH")
+  CAN_ID_SUPPRESSED_RECORD_STRUCT = struct.Struct("<II")
+
+  def __init__(self, serial: Optional[str] = None, claim: bool = True, usb_context=None):
     self._connect_serial = serial
+    self._usb_context = usb_context  # shared libusb context, e.g. of a JungleFleet. Each connection opens its own otherwise.
 
     self._handle: BaseHandle
     self._handle_open = False
     self.can_rx_overflow_buffer = b''
+    self.can_rx_decompressor = None
+    self._can_reader: Optional[CanRxReader] = None
 
     # connect and set mcu type
     self.connect(claim)
@@ -161,6 +387,7 @@ class PandaJungle:
     self.close()
 
   def close(self):
+    self.can_recv_stop()
     if self._handle_open:
       self._handle.close()
       self._handle_open = False
@@ -170,7 +397,7 @@ class PandaJungle:
 
     self._handle = None
     while self._handle is None:
-      self._handle, serial, self.bootstub, bcd = self.usb_connect(self._connect_serial, claim=claim)
+      self._handle, serial, self.bootstub, bcd = self.usb_connect(self._connect_serial, claim=claim, context=self._usb_context)
       if not wait:
         break
 
@@ -191,15 +418,18 @@ class PandaJungle:
     self._serial = serial
     self._connect_serial = serial
     self._handle_open = True
+    self._can_sender = CanTxSender(self._handle)
     self._mcu_type = self.get_mcu_type()
     self.health_version, self.can_version, self.can_health_version = self.get_packets_versions()
     logging.debug("connected")
 
   @staticmethod
-  def usb_connect(serial, claim=True):
+  def usb_connect(serial, claim=True, context=None):
     handle, usb_serial, bootstub, bcd = None, None, None, None
-    context = usb1.USBContext()
-    context.open()
+    own_context = context is None
+    if own_context:
+      context = usb1.USBContext()
+      context.open()
     try:
       for device in context.getDeviceList(skip_on_error=True):
         if device.getVendorID() == 0xbbaa and device.getProductID() in (0xddcf, 0xddef):
@@ -231,8 +461,8 @@ class PandaJungle:
 
     usb_handle = None
     if handle is not None:
-      usb_handle = PandaJungleUsbHandle(handle)
-    else:
+      usb_handle = PandaJungleUsbHandle(handle, context)
+    elif own_context:
       context.close()
 
     return usb_handle, usb_serial, bootstub, bcd
@@ -281,28 +511,29 @@ class PandaJungle:
   def connected(self) -> bool:
     return self._handle_open
 
-  def reconnect(self):
+  def reconnect(self, timeout: float = 15.0):
+    # driven by hotplug events, so this returns as soon as the jungle enumerates again
+    monitor = UsbMonitor.shared()
     if self._handle_open:
       self.close()
-      time.sleep(1.0)
+      # don't catch the jungle before the reset has taken it off the bus
+      monitor.wait_for_gone(self._serial, timeout=1.0)
 
-    success = False
-    # wait up to 15 seconds
-    for i in range(0, 15):
-      try:
-        self.connect()
-        success = True
-        break
-      except Exception:
-        logging.debug("reconnecting is taking %d seconds...", i + 1)
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+      if monitor.wait_for(JUNGLE_IDS, self._connect_serial, timeout=min(1.0, end - time.monotonic())) is not None:
+        try:
+          self.connect()
+          return
+        except Exception:
+          logging.debug("reconnect: connect failed, retrying")
+          time.sleep(0.1)
+      elif self._serial is not None and self.get_dfu_serial() in monitor.serials(DFU_IDS):
         try:
-          dfu = PandaJungleDFU(self.get_dfu_serial())
-          dfu.recover()
+          PandaJungleDFU(self.get_dfu_serial()).recover()
         except Exception:
           pass
-        time.sleep(1.0)
-    if not success:
-      raise Exception("reconnect failed")
+    raise Exception("reconnect failed")
 
   @staticmethod
   def flasher_present(handle: BaseHandle) -> bool:
@@ -310,7 +541,66 @@ class PandaJungle:
     return fr[4:8] == b"\xde\xad\xd0\x0d"
 
   @staticmethod
-  def flash_static(handle, code, mcu_type):
+  def flash_write(handle, data, progress=None, num_transfers=4):
+    # keeps num_transfers bulk writes queued, so the bootstub doesn't wait on the host between them
+    in_flight: deque = deque()
+    pos = 0
+    done = 0
+    try:
+      while done < len(data):
+        while pos < len(data) and len(in_flight) < num_transfers:
+          chunk = data[pos:pos + FLASH_STEP]
+          result: list = []
+          in_flight.append((len(chunk), result, handle.bulkWriteAsync(2, chunk, lambda actual, error, result=result: result.append((actual, error)))))
+          pos += len(chunk)
+
+        length, result, _ = in_flight[0]
+        deadline = time.monotonic() + FLASH_TIMEOUT_MS / 1000
+        while len(result) == 0 and time.monotonic() < deadline:
+          handle.handleEvents(0.01)
+        if len(result) == 0 or result[0][1] or result[0][0] != length:
+          raise Exception(f"flash: bulk write failed after {done + (result[0][0] if result else 0)} bytes")
+        in_flight.popleft()
+        done += length
+        if progress is not None:
+          progress(done)
+    finally:
+      # newest first, nothing queued behind a cancelled transfer may get out ahead of it
+      for _, result, transfer in reversed(in_flight):
+        if len(result) == 0:
+          try:
+            transfer.cancel()
+          except Exception:
+            pass
+      end = time.monotonic() + 1.0
+      while any(len(result) == 0 for _, result, _ in in_flight) and time.monotonic() < end:
+        handle.handleEvents(0.01)
+
+  @staticmethod
+  def sector_ranges(code, mcu_type, last_sector):
+    # (sector, start, end) offsets into code of app sectors 1 - last_sector
+    ret = []
+    start = 0
+    for sector in range(1, last_sector + 1):
+      end = start + mcu_type.config.sector_sizes[sector]
+      ret.append((sector, start, end))
+      start = end
+    return ret
+
+  @staticmethod
+  def changed_sectors(handle, code, mcu_type, last_sector) -> Optional[List[int]]:
+    # sectors whose contents differ from code, None if the bootstub can't hash them
+    ret = []
+    for sector, start, end in PandaJungle.sector_ranges(code, mcu_type, last_sector):
+      digest = handle.controlRead(PandaJungle.REQUEST_IN, 0xb4, sector, 0, hashlib.sha1().digest_size)
+      if len(digest) != hashlib.sha1().digest_size:
+        return None
+      if digest != hashlib.sha1(code[start:end].ljust(end - start, b'\xff')).digest():
+        ret.append(sector)
+    return ret
+
+  @staticmethod
+  def flash_static(handle, code, mcu_type, delta=True, progress=None):
     assert mcu_type is not None, "must set valid mcu_type to flash"
 
     # confirm flasher is present
@@ -322,20 +612,34 @@ class PandaJungle:
     assert last_sector >= 1, "Binary too small? No sector to erase."
     assert last_sector < 7, "Binary too large! Risk of overwriting provisioning chunk."
 
+    # only the sectors that differ, if the bootstub can tell. It still checks the signature of the whole image.
+    changed = PandaJungle.changed_sectors(handle, code, mcu_type, last_sector) if delta else None
+
     # unlock flash
     logging.warning("flash: unlocking")
     handle.controlWrite(PandaJungle.REQUEST_IN, 0xb1, 0, 0, b'')
 
-    # erase sectors
-    logging.warning(f"flash: erasing sectors 1 - {last_sector}")
-    for i in range(1, last_sector + 1):
-      handle.controlWrite(PandaJungle.REQUEST_IN, 0xb2, i, 0, b'')
-
-    # flash over EP2
-    STEP = 0x10
-    logging.warning("flash: flashing")
-    for i in range(0, len(code), STEP):
-      handle.bulkWrite(2, code[i:i + STEP])
+    # erase sectors, as the write pointer reaches them if the bootstub supports it
+    if handle.controlRead(PandaJungle.REQUEST_IN, 0xb3, 0, 0, 0xc)[1] != 0xff:
+      changed = None
+      logging.warning(f"flash: erasing sectors 1 - {last_sector}")
+      for i in range(1, last_sector + 1):
+        handle.controlWrite(PandaJungle.REQUEST_IN, 0xb2, i, 0, b'')
+
+    # flash over EP2, the bootstub NAKs while it erases or programs
+    if changed is None:
+      logging.warning("flash: flashing")
+      writes = [(None, 0, len(code))]
+    else:
+      logging.warning(f"flash: flashing {len(changed)} changed of {last_sector} sectors")
+      writes = [(sector, start, min(end, len(code))) for sector, start, end in PandaJungle.sector_ranges(code, mcu_type, last_sector) if sector in changed]
+    total = sum(end - start for _, start, end in writes)
+    written = 0
+    for sector, start, end in writes:
+      if sector is not None:
+        handle.controlWrite(PandaJungle.REQUEST_IN, 0xb5, sector, 0, b'')
+      PandaJungle.flash_write(handle, code[start:end], None if progress is None else lambda n: progress(written + n, total))
+      written += end - start
 
     # reset
     logging.warning("flash: resetting")
@@ -344,24 +648,24 @@ class PandaJungle:
     except Exception:
       pass
 
-  def flash(self, fn=None, code=None, reconnect=True):
-    if not fn:
-      fn = os.path.join(FW_PATH, self._mcu_type.config.app_fn)
-    assert os.path.isfile(fn)
+  def flash(self, fn=None, code=None, reconnect=True, delta=True, progress=None):
+    if code is None:
+      if not fn:
+        fn = os.path.join(FW_PATH, self._mcu_type.config.app_fn)
+      assert os.path.isfile(fn)
+      with open(fn, "rb") as f:
+        code = f.read()
+
     logging.debug("flash: main version is %s", self.get_version())
     if not self.bootstub:
       self.reset(enter_bootstub=True)
     assert(self.bootstub)
 
-    if code is None:
-      with open(fn, "rb") as f:
-        code = f.read()
-
     # get version
     logging.debug("flash: bootstub version is %s", self.get_version())
 
     # do flash
-    PandaJungle.flash_static(self._handle, code, mcu_type=self._mcu_type)
+    PandaJungle.flash_static(self._handle, code, mcu_type=self._mcu_type, delta=delta, progress=progress)
 
     # reconnect
     if reconnect:
@@ -387,27 +691,11 @@ class PandaJungle:
 
   @staticmethod
   def wait_for_dfu(dfu_serial: Optional[str], timeout: Optional[int] = None) -> bool:
-    t_start = time.monotonic()
-    dfu_list = PandaJungleDFU.list()
-    while (dfu_serial is None and len(dfu_list) == 0) or (dfu_serial is not None and dfu_serial not in dfu_list):
-      logging.debug("waiting for DFU...")
-      time.sleep(0.1)
-      if timeout is not None and (time.monotonic() - t_start) > timeout:
-        return False
-      dfu_list = PandaJungleDFU.list()
-    return True
+    return UsbMonitor.shared().wait_for(DFU_IDS, dfu_serial, timeout) is not None
 
   @staticmethod
   def wait_for_panda_jungle(serial: Optional[str], timeout: int) -> bool:
-    t_start = time.monotonic()
-    serials = PandaJungle.list()
-    while (serial is None and len(serials) == 0) or (serial is not None and serial not in serials):
-      logging.debug("waiting for PandaJungle...")
-      time.sleep(0.1)
-      if timeout is not None and (time.monotonic() - t_start) > timeout:
-        return False
-      serials = PandaJungle.list()
-    return True
+    return UsbMonitor.shared().wait_for(JUNGLE_IDS, serial, timeout) is not None
 
   def up_to_date(self) -> bool:
     current = self.get_signature()
@@ -422,8 +710,11 @@ class PandaJungle:
 
   @ensure_health_packet_version
   def health(self):
-    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xd2, 0, 0, self.HEALTH_STRUCT.size)
-    a = self.HEALTH_STRUCT.unpack(dat)
+    return self.parse_health(self._handle.controlRead(PandaJungle.REQUEST_IN, 0xd2, 0, 0, self.HEALTH_STRUCT.size))
+
+  @classmethod
+  def parse_health(cls, dat):
+    a = cls.HEALTH_STRUCT.unpack(dat)
     return {
       "uptime": a[0],
       "ch1_power": a[1],
@@ -448,6 +739,10 @@ class PandaJungle:
 
   @ensure_can_health_packet_version
   def can_health(self, can_number):
+    return self.parse_can_health(self._handle.controlRead(PandaJungle.REQUEST_IN, 0xc2, int(can_number), 0, self.CAN_HEALTH_STRUCT.size))
+
+  @classmethod
+  def parse_can_health(cls, dat):
     LEC_ERROR_CODE = {
       0: "No error",
       1: "Stuff error",
@@ -458,8 +753,7 @@ class PandaJungle:
       6: "CRCError",
       7: "NoChange",
     }
-    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xc2, int(can_number), 0, self.CAN_HEALTH_STRUCT.size)
-    a = self.CAN_HEALTH_STRUCT.unpack(dat)
+    a = cls.CAN_HEALTH_STRUCT.unpack(dat)
     return {
       "bus_off": a[0],
       "bus_off_cnt": a[1],
@@ -483,6 +777,12 @@ class PandaJungle:
       "canfd_enabled": a[19],
       "brs_enabled": a[20],
       "canfd_non_iso": a[21],
+      "irq0_call_rate": a[22],
+      "irq1_call_rate": a[23],
+      "rx_coalesce_latency": a[24],
+      "rx_latency_max": a[25],
+      "total_rx_prio_cnt": a[26],
+      "total_tx_echo_cnt": a[27],
     }
 
   # ******************* control *******************
@@ -573,9 +873,12 @@ class PandaJungle:
     # TODO: check panda type
     self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xdb, int(obd), 0, b'')
 
-  def set_can_loopback(self, enable):
-    # set can loopback mode for all buses
-    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe5, int(enable), 0, b'')
+  def set_can_loopback(self, enable, bus=None):
+    # set can loopback mode for one bus, or all buses
+    if bus is None:
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe5, int(enable), 0, b'')
+    else:
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe4, bus, int(enable), b'')
 
   def set_can_enable(self, bus_num, enable):
     # sets the can transceiver enable pin
@@ -585,13 +888,323 @@ class PandaJungle:
     self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xde, bus, int(speed * 10), b'')
 
   def set_can_data_speed_kbps(self, bus, speed):
-    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf9, bus, int(speed * 10), b'')
+    if speed * 10 > 0xFFFF:
+      # rates above 6.5 Mbps don't fit in kbps * 10, sent in kbps instead
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf9, bus | 0x100, int(speed), b'')
+    else:
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf9, bus, int(speed * 10), b'')
+
+  def set_can_sample_point(self, bus, sample_point=0, data_sample_point=0):
+    # in %, 50 to 90. 0 restores the default of the configured speed.
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xfa, bus, int(sample_point) | (int(data_sample_point) << 8), b'')
 
   def set_canfd_non_iso(self, bus, non_iso):
     self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xfc, bus, int(non_iso), b'')
 
-  def set_can_silent(self, silent):
-    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf5, int(silent), 0, b'')
+  def set_can_rx_coalescing(self, bus, latency_us):
+    # batch RX interrupts until the FIFO watermark is reached or the oldest frame waited latency_us, 0 disables.
+    # The jungle times this in bit times: on CAN FD buses with BRS interrupts come early, and the measured latencies
+    # (rx_latency_max, echo responder and latency probe) are approximate.
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe6, bus, int(latency_us), b'')
+
+  def set_can_rx_ram_share(self, bus, percent):
+    # share of the CAN controller message RAM elements used for RX FIFO, the rest is used for the TX FIFO
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe7, bus, int(percent), b'')
+
+  def set_can_priority_ids(self, bus, ids):
+    # frames with these IDs skip the main RX FIFO and are returned ahead of other frames by can_recv.
+    # ids are (address, extended) pairs, or addresses with IDs above 0x7FF taken as extended
+    ids = [(i, i > 0x7FF) if isinstance(i, int) else (i[0], bool(i[1])) for i in ids]
+    assert len(ids) <= 8, "at most 8 priority IDs per bus"
+    assert len(set(ids)) == len(ids), "duplicate priority IDs"
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe9, bus, 0, b'')
+    for addr, extended in ids:
+      assert 0 <= addr <= (0x1FFFFFFF if extended else 0x7FF), "invalid CAN ID"
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe8, (int(extended) << 15) | (bus << 13) | (addr >> 16), addr & 0xFFFF, b'')
+
+  def can_rx_prio_lost_cnt(self, can_number):
+    # priority frames lost since boot, on RX FIFO 1 or the priority queue. Not part of can_health, it's full
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xda, int(can_number), 0, 4)
+    return struct.unpack("<I", dat)[0]
+
+  def set_can_echo(self, bus, mode, sample_rate=1):
+    # mode is one of CAN_ECHO_*, in CAN_ECHO_SAMPLED mode every sample_rate-th sent frame is echoed
+    assert mode != PandaJungle.CAN_ECHO_SAMPLED or 0 < sample_rate <= 0xFFFF, "invalid sample rate"
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xea, (int(mode) << 8) | bus, int(sample_rate), b'')
+
+  def can_traffic_gen_configure(self, bus, addr_start, addr_end, dlcs=(8,), payload=TRAFFIC_GEN_PAYLOAD_INCREMENTING, load=100):
+    # frames cycle through addr_start..addr_end (extended above 0x7FF), DLC is picked uniformly from dlcs,
+    # load is the target bus load in percent, 100 sends back-to-back. Stops a running generator on the bus.
+    assert 0 < load <= 100, "load must be 1-100%"
+    assert 0 <= addr_start <= addr_end <= 0x1FFFFFFF, "invalid CAN ID range"
+    dlc_mask = 0
+    for dlc in dlcs:
+      assert 0 <= dlc <= 15, "invalid DLC"
+      dlc_mask |= 1 << dlc
+    cfg = self.TRAFFIC_GEN_CONFIG_STRUCT.pack(0x01, bus, payload, load, dlc_mask, addr_start, addr_end)
+    self._handle.bulkWrite(2, cfg)
+
+  def can_traffic_gen_start(self, bus):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xeb, bus, 1, b'')
+
+  def can_traffic_gen_stop(self, bus):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xeb, bus, 0, b'')
+
+  def can_traffic_gen_stats(self, bus):
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xec, bus, 0, self.TRAFFIC_GEN_STATS_STRUCT.size)
+    a = self.TRAFFIC_GEN_STATS_STRUCT.unpack(dat)
+    return {
+      "enabled": bool(a[0]),
+      "sent_cnt": a[1],
+      "drop_cnt": a[2],
+      "sent_rate": a[3],
+      "load": a[4] / 10.,
+    }
+
+  def set_can_echo_responder(self, bus, mode=RESPONDER_REVERSE, target_bus=None, addr_offset=RESPONDER_ADDR_OFFSET):
+    # answer frames received on bus with a transformed copy sent on target_bus (default: same bus), ID + addr_offset.
+    # With a non-zero addr_offset only IDs below it are answered. Offset 0 needs another target bus, the responder
+    # would answer its own responses otherwise.
+    target_bus = bus if target_bus is None else target_bus
+    assert mode == self.RESPONDER_OFF or addr_offset != 0 or target_bus != bus, "responder would answer its own responses"
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xed, (int(mode) << 8) | (target_bus << 4) | bus, int(addr_offset), b'')
+
+  def get_can_echo_responder_stats(self, bus):
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xee, bus, 0, self.RESPONDER_STATS_STRUCT.size)
+    a = self.RESPONDER_STATS_STRUCT.unpack(dat)
+    return {
+      "response_cnt": a[0],
+      "drop_cnt": a[1],
+      "latency_min_us": a[2],
+      "latency_max_us": a[3],
+      "latency_mean_us": (a[4] / a[0]) if a[0] > 0 else 0,
+    }
+
+  def can_latency_probe_configure(self, src_bus, dst_bus, addr, timeout_ms=100):
+    # pings are sent with addr on src_bus and expected back on dst_bus, e.g. forwarded by a DUT
+    assert 0 <= addr <= 0x1FFFFFFF, "invalid CAN ID"
+    self._handle.bulkWrite(2, self.LATENCY_PROBE_CONFIG_STRUCT.pack(0x02, src_bus, dst_bus, addr, timeout_ms))
+
+  def can_latency_probe_start(self):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xef, 1, 0, b'')
+
+  def can_latency_probe_stop(self):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xef, 0, 0, b'')
+
+  def can_latency_probe_stats(self):
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xf0, 0, 0, self.LATENCY_PROBE_STATS_STRUCT.size)
+    a = self.LATENCY_PROBE_STATS_STRUCT.unpack(dat)
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xf0, 1, 0, self.LATENCY_PROBE_HIST_STRUCT.size)
+    hist = self.LATENCY_PROBE_HIST_STRUCT.unpack(dat)
+    return {
+      "enabled": bool(a[0]),
+      "sent_cnt": a[1],
+      "recv_cnt": a[2],
+      "lost_cnt": a[3],
+      "latency_min_us": a[4],
+      "latency_max_us": a[5],
+      "latency_mean_us": (a[6] / a[2]) if a[2] > 0 else 0,
+      # bin N counts latencies in [2^N, 2^(N+1)) us
+      "histogram": list(hist),
+    }
+
+  def can_autobaud_start(self, bus):
+    # listens without transmitting and locks onto the bus speeds, see can_autobaud_result
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf3, bus, 1, b'')
+
+  def can_autobaud_abort(self, bus):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf3, bus, 0, b'')
+
+  def can_autobaud_result(self, bus):
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xf6, bus, 0, self.AUTOBAUD_RESULT_STRUCT.size)
+    a = self.AUTOBAUD_RESULT_STRUCT.unpack(dat)
+    return {
+      "state": a[0],
+      "can_speed_kbps": a[1] / 10.,
+      "can_data_speed_kbps": a[2] / 10.,
+      "rx_cnt": a[3],
+      "error_cnt": a[4],
+    }
+
+  def can_autobaud(self, bus, timeout=10):
+    self.can_autobaud_start(bus)
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+      res = self.can_autobaud_result(bus)
+      if res["state"] in (self.AUTOBAUD_LOCKED, self.AUTOBAUD_FAILED):
+        return res
+      time.sleep(0.1)
+    self.can_autobaud_abort(bus)
+    return self.can_autobaud_result(bus)
+
+  def isotp_configure(self, channel, bus, tx_id, rx_id, block_size=0, st_min=0, padding=0xCC, timeout_ms=1000):
+    # block_size and st_min are sent in the jungle's flow control frames. timeout_ms applies to N_As, N_Bs and N_Cr
+    assert 0 <= channel < self.ISOTP_CHANNEL_CNT, "invalid ISO-TP channel"
+    assert 0 <= tx_id <= 0x1FFFFFFF and 0 <= rx_id <= 0x1FFFFFFF, "invalid CAN ID"
+    self._handle.bulkWrite(2, self.ISOTP_CONFIG_STRUCT.pack(0x03, channel, bus, tx_id, rx_id, block_size, st_min, padding, timeout_ms))
+
+  def isotp_send(self, channel, data):
+    # segmentation and flow control are handled by the jungle
+    assert 0 < len(data) <= self.ISOTP_MAX_LEN, "invalid ISO-TP PDU length"
+    for offset in range(0, len(data), self.ISOTP_DATA_CHUNK):
+      self._handle.bulkWrite(2, struct.pack("<BBH", 0x04, channel, offset) + data[offset:offset + self.ISOTP_DATA_CHUNK])
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xe1, channel, len(data), b'')
+
+  def isotp_status(self, channel):
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xe2, channel, 0, self.ISOTP_STATUS_STRUCT.size)
+    a = self.ISOTP_STATUS_STRUCT.unpack(dat)
+    return {
+      "enabled": bool(a[0]),
+      "tx_state": a[1],
+      "rx_state": a[2],
+      "last_error": a[3],
+      "tx_len": a[4],
+      "tx_offset": a[5],
+      "rx_len": a[6],
+      "rx_offset": a[7],
+      "tx_pdu_cnt": a[8],
+      "rx_pdu_cnt": a[9],
+      "error_cnt": a[10],
+    }
+
+  def isotp_recv(self, channel):
+    # returns the received PDU, or None. Reading it frees the channel for the next one.
+    status = self.isotp_status(channel)
+    if status["rx_state"] != self.ISOTP_RX_DONE:
+      return None
+    dat = b''
+    while len(dat) < status["rx_len"]:
+      chunk = bytes(self._handle.controlRead(PandaJungle.REQUEST_IN, 0xe3, channel, len(dat), 0x40))
+      if len(chunk) == 0:
+        return None
+      dat += chunk
+    return dat
+
+  def isotp_request(self, channel, data, timeout=1.0):
+    # sends a PDU and waits for the response PDU, None on timeout
+    self.isotp_send(channel, data)
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+      resp = self.isotp_recv(channel)
+      if resp is not None:
+        return resp
+      time.sleep(0.001)
+    return None
+
+  def set_can_response_table(self, entries):
+    # entries: (bus, addr, match, mask, resp_addr, resp_data). match/mask are payload prefixes, mask defaults to all bits of match.
+    # Replaces the table, uploaded in a single bulk transfer of 64 byte records.
+    assert len(entries) <= self.RESPONSE_TABLE_SIZE, "too many response table entries"
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xfb, 3, 0, b'')
+    records = b''
+    for i, (bus, addr, match, mask, resp_addr, resp_data) in enumerate(entries):
+      match = bytes(match)
+      mask = bytes(mask) if mask is not None else b'\xff' * len(match)
+      assert len(match) <= 8 and len(mask) <= 8 and len(resp_data) <= 8, "entries are classic CAN frames"
+      assert 0 <= addr <= 0x1FFFFFFF and 0 <= resp_addr <= 0x1FFFFFFF, "invalid CAN ID"
+      record = self.RESPONSE_ENTRY_STRUCT.pack(0x05, i, bus, addr, match.ljust(8, b'\x00'), mask.ljust(8, b'\x00'), resp_addr,
+                                               len(resp_data), bytes(resp_data).ljust(8, b'\x00'))
+      # firmware handles endpoint 2 per 64 byte packet, one record each
+      records += record.ljust(64, b'\x00')
+    if len(records) > 0:
+      self._handle.bulkWrite(2, records)
+
+  def set_can_response_table_enabled(self, enabled):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xfb, int(enabled), 0, b'')
+
+  def clear_can_response_table_hits(self):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xfb, 2, 0, b'')
+
+  def get_can_response_table_hits(self):
+    hits = []
+    cnt = 0
+    drop_cnt = 0
+    for first in range(0, self.RESPONSE_TABLE_SIZE, self.RESPONSE_TABLE_HITS_PAGE):
+      dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xfd, first, 0, 0x40)
+      n = (len(dat) - 5) // 4
+      hits += struct.unpack(f"<{n}I", dat[:n * 4])
+      cnt, drop_cnt = struct.unpack("<BI", dat[n * 4:n * 4 + 5])
+      if len(hits) >= cnt:
+        break
+    return {"hits": hits[:cnt], "drop_cnt": drop_cnt}
+
+  def set_can_id_stats(self, enabled):
+    # per CAN ID statistics in firmware, see get_can_id_stats
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xd5, int(enabled), 0, b'')
+
+  def clear_can_id_stats(self):
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xd5, 2, 0, b'')
+
+  def get_can_id_stats(self):
+    # snapshot keyed by (bus, address), periods in seconds. Streamed in one bulk read ahead of the CAN frames,
+    # with the background CAN reader running the bulk endpoint is taken, so it's read in control transfer pages.
+    if self._can_reader is not None:
+      return self._get_can_id_stats_paged()
+
+    dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xd7, 0, 2, self.CAN_ID_STATS_STREAM_HEADER_STRUCT.size)
+    tail_len, record_cnt, _, overflow_cnt = self.CAN_ID_STATS_STREAM_HEADER_STRUCT.unpack(dat)
+    records_end = tail_len + record_cnt * self.CAN_ID_STATS_RECORD_STRUCT.size
+    dat = bytearray()
+    while len(dat) < records_end:
+      dat += self._handle.bulkRead(1, 16384)
+    # the CAN stream around the records is kept for can_recv
+    self.can_rx_overflow_buffer += dat[:tail_len] + dat[records_end:]
+
+    stats = {}
+    for offset in range(tail_len, records_end, self.CAN_ID_STATS_RECORD_STRUCT.size):
+      self._parse_can_id_stats_record(stats, dat, offset)
+    return stats, overflow_cnt
+
+  def _get_can_id_stats_paged(self):
+    stats = {}
+    overflow_cnt = 0
+    slot = 0
+    while slot < self.CAN_ID_STATS_SIZE:
+      dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xd7, slot, 0, 0x40)
+      slot, _, overflow_cnt = self.CAN_ID_STATS_PAGE_HEADER_STRUCT.unpack(dat[:self.CAN_ID_STATS_PAGE_HEADER_STRUCT.size])
+      for offset in range(self.CAN_ID_STATS_PAGE_HEADER_STRUCT.size, len(dat), self.CAN_ID_STATS_RECORD_STRUCT.size):
+        self._parse_can_id_stats_record(stats, dat, offset)
+    return stats, overflow_cnt
+
+  def _parse_can_id_stats_record(self, stats, dat, offset):
+    key, cnt, dlc, data, last_ts, period_min, period_max, period_mean = self.CAN_ID_STATS_RECORD_STRUCT.unpack_from(dat, offset)
+    if cnt == 0:
+      # table cleared while streaming
+      return
+    stats[(key >> 30, key & 0x1FFFFFFF)] = {
+      "extended": bool((key >> 29) & 1),
+      "cnt": cnt,
+      "dlc": dlc,
+      "data": data[:DLC_TO_LEN[dlc]],
+      "last_ts_us": last_ts,
+      "period_min": period_min * 1e-4,
+      "period_max": period_max * 1e-4,
+      "period_mean": period_mean * 1e-4,
+    }
+
+  def set_can_change_only(self, bus, heartbeat_ms):
+    # only send frames whose payload changed, plus one unchanged frame per ID every heartbeat_ms. 0 sends all frames.
+    assert 0 <= heartbeat_ms <= 0xFFFF
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xd9, bus, int(heartbeat_ms), b'')
+
+  def get_can_suppressed_counts(self):
+    # frames dropped by change-only mode, keyed by (bus, address). Cleared with clear_can_id_stats.
+    counts = {}
+    slot = 0
+    while slot < self.CAN_ID_STATS_SIZE:
+      dat = self._handle.controlRead(PandaJungle.REQUEST_IN, 0xd7, slot, 1, 0x40)
+      slot, _, _ = self.CAN_ID_STATS_PAGE_HEADER_STRUCT.unpack(dat[:self.CAN_ID_STATS_PAGE_HEADER_STRUCT.size])
+      for offset in range(self.CAN_ID_STATS_PAGE_HEADER_STRUCT.size, len(dat), self.CAN_ID_SUPPRESSED_RECORD_STRUCT.size):
+        key, cnt = self.CAN_ID_SUPPRESSED_RECORD_STRUCT.unpack_from(dat, offset)
+        counts[(key >> 30, key & 0x1FFFFFFF)] = cnt
+    return counts
+
+  def set_can_silent(self, silent, bus=None):
+    # set can silent mode for one bus, or all buses
+    if bus is None:
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf5, int(silent), 0, b'')
+    else:
+      self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xf8, bus, int(silent), b'')
 
   def set_panda_power(self, enabled):
     self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xa0, int(enabled), 0, b'')
@@ -610,29 +1223,69 @@ class PandaJungle:
   CAN_SEND_TIMEOUT_MS = 10
 
   def can_reset_communications(self):
+    # also falls back to the uncompressed RX stream
+    assert self._can_reader is None, "stop the CAN reader first"
     self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xc0, 0, 0, b'')
+    self._can_sender.reset()
+    self.can_rx_overflow_buffer = b''
+    self.can_rx_decompressor = None
+
+  @ensure_can_packet_version
+  def set_can_rx_compression(self, enabled):
+    # compressed RX stream for the rest of the connection, decoded transparently by can_recv
+    assert self._can_reader is None, "stop the CAN reader first"
+    self._handle.controlWrite(PandaJungle.REQUEST_OUT, 0xdc, int(enabled), 0, b'')
+    self.can_rx_overflow_buffer = b''
+    self.can_rx_decompressor = CanRxDecompressor() if enabled else None
 
   @ensure_can_packet_version
   def can_send_many(self, arr, timeout=CAN_SEND_TIMEOUT_MS):
-    snds = pack_can_buffer(arr)
-    while True:
-      try:
-        for tx in snds:
-          while True:
-            bs = self._handle.bulkWrite(3, tx, timeout=timeout)
-            tx = tx[bs:]
-            if len(tx) == 0:
-              break
-            logging.error("CAN: PARTIAL SEND MANY, RETRYING")
-        break
-      except (usb1.USBErrorIO, usb1.USBErrorOverflow):
-        logging.error("CAN: BAD SEND MANY, RETRYING")
+    # raises CanSendTimeout with the number of frames the jungle accepted when its TX queues stay full past the timeout
+    sent = self._can_sender.send(b''.join(pack_can_buffer(arr)), timeout)
+    if sent < len(arr):
+      raise CanSendTimeout(sent)
 
   def can_send(self, addr, dat, bus, timeout=CAN_SEND_TIMEOUT_MS):
     self.can_send_many([[addr, None, dat, bus]], timeout=timeout)
 
+  @ensure_can_packet_version
+  def can_recv_start(self, num_transfers=4, transfer_size=16384, max_frames=100000, event_thread=True, columnar=False):
+    # keep num_transfers bulk reads in flight on a background thread, can_recv then returns the frames received since.
+    # Without event_thread, the events are handled by whatever drives the USB context, like a UsbMonitor.
+    # columnar decodes the transfers into CanFrameBatches for can_recv_batch, can_recv then converts them to tuples.
+    self.can_recv_stop()
+    if columnar:
+      decode = self.can_rx_decompressor.decode_batch if self.can_rx_decompressor is not None else CanFrameBatch.from_buffer
+    else:
+      decode = self.can_rx_decompressor.decode if self.can_rx_decompressor is not None else unpack_can_buffer
+    self._can_reader = CanRxReader(self._handle, decode, 1, num_transfers, transfer_size, max_frames, self.can_rx_overflow_buffer,
+                                   batches=columnar)
+    self.can_rx_overflow_buffer = b''
+    self._can_reader.start(event_thread)
+
+  def can_recv_stop(self):
+    # back to synchronous reads, returns the frames still queued
+    msgs = []
+    if self._can_reader is not None:
+      self._can_reader.stop()
+      msgs = self._can_reader.recv()
+      if self._can_reader.batches:
+        msgs = [f for batch in msgs for f in batch.to_tuples()]
+      self.can_rx_overflow_buffer = self._can_reader.tail
+      self._can_reader = None
+    return msgs
+
+  def can_recv_overflow_cnt(self):
+    # frames dropped because the host side queue of the CAN reader was full
+    return 0 if self._can_reader is None else self._can_reader.overflow_cnt
+
   @ensure_can_packet_version
   def can_recv(self):
+    if self._can_reader is not None:
+      if self._can_reader.batches:
+        return [f for batch in self._can_reader.recv() for f in batch.to_tuples()]
+      return self._can_reader.recv()
+
     dat = bytearray()
     while True:
       try:
@@ -641,9 +1294,35 @@ class PandaJungle:
       except (usb1.USBErrorIO, usb1.USBErrorOverflow):
         logging.error("CAN: BAD RECV, RETRYING")
         time.sleep(0.1)
-    msgs, self.can_rx_overflow_buffer = unpack_can_buffer(self.can_rx_overflow_buffer + dat)
+    if self.can_rx_decompressor is not None:
+      msgs, self.can_rx_overflow_buffer = self.can_rx_decompressor.decode(self.can_rx_overflow_buffer + dat)
+    else:
+      msgs, self.can_rx_overflow_buffer = unpack_can_buffer(self.can_rx_overflow_buffer + dat)
     return msgs
 
+  @ensure_can_packet_version
+  def can_recv_batch(self):
+    # frames of one read in columns, see CanFrameBatch. can_recv is the tuple equivalent.
+    # With the async reader, it needs to be started columnar, a tuple reader's frames are copied over.
+    if self._can_reader is not None:
+      if self._can_reader.batches:
+        return CanFrameBatch.concat(self._can_reader.recv())
+      return CanFrameBatch.from_tuples(self._can_reader.recv())
+
+    dat = bytearray()
+    while True:
+      try:
+        dat = self._handle.bulkRead(1, 16384) # Max receive batch size + 2 extra reserve frames
+        break
+      except (usb1.USBErrorIO, usb1.USBErrorOverflow):
+        logging.error("CAN: BAD RECV, RETRYING")
+        time.sleep(0.1)
+    if self.can_rx_decompressor is not None:
+      batch, self.can_rx_overflow_buffer = self.can_rx_decompressor.decode_batch(self.can_rx_overflow_buffer + dat)
+    else:
+      batch, self.can_rx_overflow_buffer = CanFrameBatch.from_buffer(self.can_rx_overflow_buffer + dat)
+    return batch
+
   def can_clear(self, bus):
     """Clears all messages from the specified internal CAN ringbuffer as
     though it were drained.
@@ -1,5 +1,5 @@
 from abc import ABC, abstractmethod
-from typing import List
+from typing import Callable, List, Optional
 
 from .constants import McuType
 
@@ -31,6 +31,30 @@ class BaseHandle(ABC):
   def bulkRead(self, endpoint: int, length: int, timeout: int = TIMEOUT) -> bytes:
     ...
 
+  def controlReadAsync(self, request_type: int, request: int, value: int, index: int, length: int,
+                       callback: Callable[[Optional[bytes]], None]):
+    """Submit a control IN transfer that completes from handleEvents. callback gets the data, or None on failure."""
+    raise NotImplementedError
+
+  def bulkReadAsync(self, endpoint: int, length: int, callback: Callable[[Optional[bytes]], bool]):
+    """
+      Submit a bulk IN transfer that completes from handleEvents. callback gets the received data and returns
+      whether to resubmit, or gets None once the transfer is cancelled or the device is gone.
+      Returns an object with a cancel() method.
+    """
+    raise NotImplementedError
+
+  def bulkWriteAsync(self, endpoint: int, data: bytes, callback: Callable[[int, bool], None]):
+    """
+      Submit a bulk OUT transfer that completes from handleEvents. callback gets the number of bytes the device
+      acknowledged and whether the transfer failed or was cancelled. Returns an object with a cancel() method.
+    """
+    raise NotImplementedError
+
+  def handleEvents(self, timeout: float) -> None:
+    """Run the callbacks of completed async transfers, waiting up to timeout seconds."""
+    raise NotImplementedError
+
 
 class BaseSTBootloaderHandle(ABC):
   """
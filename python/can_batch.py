@@ -0,0 +1,166 @@
+import time
+from array import array
+from itertools import accumulate
+from typing import List, Tuple
+
+from .constants import CANPACKET_HEAD_SIZE, DLC_TO_LEN
+
+CAN_FLAG_REJECTED = 0x1
+CAN_FLAG_RETURNED = 0x2
+CAN_FLAG_EXTENDED = 0x4
+
+def column_offsets(count: int, payload_len: int) -> Tuple[int, int, int, int, int, int]:
+  # addr u32[count], data_offsets u32[count + 1], bus u8[count], flags u8[count], dlc u8[count], payload, in one buffer
+  addr = 0
+  data_offsets = addr + 4 * count
+  bus = data_offsets + 4 * (count + 1)
+  flags = bus + count
+  dlc = flags + count
+  payload = dlc + count
+  return addr, data_offsets, bus, flags, dlc, payload + payload_len
+
+def unpack_can_columns_py(dat) -> Tuple[int, bytearray, bytes]:
+  """Columnar unpack of CANPacket_t data: (frame count, column buffer, incomplete tail)."""
+  # first pass for the sizes and checksums, second one fills the columns
+  packets = []
+  pos = 0
+  payload_len = 0
+  while len(dat) - pos >= CANPACKET_HEAD_SIZE:
+    data_len = DLC_TO_LEN[dat[pos] >> 4]
+    if data_len > len(dat) - pos - CANPACKET_HEAD_SIZE:
+      break
+    checksum = 0
+    for b in dat[pos:pos + CANPACKET_HEAD_SIZE + data_len]:
+      checksum ^= b
+    assert checksum == 0, "CAN packet checksum incorrect"
+    packets.append(pos)
+    payload_len += data_len
+    pos += CANPACKET_HEAD_SIZE + data_len
+
+  count = len(packets)
+  o_addr, o_offsets, o_bus, o_flags, o_dlc, size = column_offsets(count, payload_len)
+  buf = bytearray(size)
+  addr = memoryview(buf)[o_addr:o_offsets].cast('I')
+  offsets = memoryview(buf)[o_offsets:o_bus].cast('I')
+  data_pos = 0
+  payload = o_dlc + count
+  for i, p in enumerate(packets):
+    data_len = DLC_TO_LEN[dat[p] >> 4]
+    addr[i] = (dat[p + 4] << 24 | dat[p + 3] << 16 | dat[p + 2] << 8 | dat[p + 1]) >> 3
+    offsets[i] = data_pos
+    buf[o_bus + i] = (dat[p] >> 1) & 0x7
+    buf[o_flags + i] = dat[p + 1] & 0x7
+    buf[o_dlc + i] = dat[p] >> 4
+    buf[payload + data_pos:payload + data_pos + data_len] = dat[p + CANPACKET_HEAD_SIZE:p + CANPACKET_HEAD_SIZE + data_len]
+    data_pos += data_len
+  offsets[count] = data_pos
+  return count, buf, bytes(dat[pos:])
+
+try:
+  from ._can_buffer import unpack_can_columns
+except ImportError:
+  unpack_can_columns = unpack_can_columns_py
+
+class CanFrameBatch:
+  """
+    Frames of one read in columns backed by a single buffer. The columns are memoryviews, so numpy.asarray()
+    wraps them without a copy. Payload of frame i is payload[data_offsets[i]:data_offsets[i + 1]].
+    The CAN stream carries no per frame timestamps, timestamp is the host time of the read.
+  """
+  __slots__ = ("buf", "addr", "data_offsets", "bus", "flags", "dlc", "payload", "timestamp")
+
+  def __init__(self, count: int, buf: bytearray, timestamp: float = 0.0):
+    o_addr, o_offsets, o_bus, o_flags, o_dlc, _ = column_offsets(count, 0)
+    view = memoryview(buf)
+    self.buf = buf
+    self.addr = view[o_addr:o_offsets].cast('I')
+    self.data_offsets = view[o_offsets:o_bus].cast('I')
+    self.bus = view[o_bus:o_flags]
+    self.flags = view[o_flags:o_dlc]  # CAN_FLAG_*
+    self.dlc = view[o_dlc:o_dlc + count]
+    self.payload = view[o_dlc + count:]
+    self.timestamp = timestamp
+
+  @classmethod
+  def from_buffer(cls, dat, timestamp: float = 0.0) -> Tuple["CanFrameBatch", bytes]:
+    """Batch of the complete CANPacket_t frames in dat, and the incomplete tail for the next read."""
+    count, buf, tail = unpack_can_columns(dat)
+    return cls(count, buf, timestamp or time.monotonic()), tail
+
+  @classmethod
+  def from_columns(cls, addr: List[int], bus: bytes, flags: bytes, dlc: bytes, payload: bytes,
+                   timestamp: float = 0.0) -> "CanFrameBatch":
+    """Batch of frames decoded column by column, like the compressed stream is"""
+    count = len(addr)
+    o_addr, o_offsets, o_bus, o_flags, o_dlc, size = column_offsets(count, len(payload))
+    buf = bytearray(size)
+    buf[o_addr:o_offsets] = array('I', addr).tobytes()
+    buf[o_offsets:o_bus] = array('I', accumulate((DLC_TO_LEN[d] for d in dlc), initial=0)).tobytes()
+    buf[o_bus:o_flags] = bus
+    buf[o_flags:o_dlc] = flags
+    buf[o_dlc:o_dlc + count] = dlc
+    buf[o_dlc + count:] = payload
+    return cls(count, buf, timestamp or time.monotonic())
+
+  @classmethod
+  def concat(cls, batches: List["CanFrameBatch"]) -> "CanFrameBatch":
+    """One batch of the frames of several, with the timestamp of the last. Copies the columns once."""
+    if len(batches) == 1:
+      return batches[0]
+    offsets = array('I', [0])
+    for b in batches:
+      base = offsets.pop()
+      offsets.extend(o + base for o in b.data_offsets)
+    count = sum(len(b) for b in batches)
+    o_addr, o_offsets, o_bus, o_flags, o_dlc, size = column_offsets(count, offsets[-1])
+    buf = bytearray(size)
+    buf[o_addr:o_offsets] = b''.join(b.addr.tobytes() for b in batches)
+    buf[o_offsets:o_bus] = offsets.tobytes()
+    buf[o_bus:o_flags] = b''.join(b.bus for b in batches)
+    buf[o_flags:o_dlc] = b''.join(b.flags for b in batches)
+    buf[o_dlc:o_dlc + count] = b''.join(b.dlc for b in batches)
+    buf[o_dlc + count:] = b''.join(b.payload for b in batches)
+    return cls(count, buf, batches[-1].timestamp if len(batches) > 0 else time.monotonic())
+
+  @classmethod
+  def from_tuples(cls, frames: List, timestamp: float = 0.0) -> "CanFrameBatch":
+    # from the legacy (address, _, data, bus) frames, with the returned/rejected bus offsets.
+    # The tuples don't carry the extended flag, it's guessed from the address.
+    payload_len = sum(len(f[2]) for f in frames)
+    o_addr, o_offsets, o_bus, o_flags, o_dlc, size = column_offsets(len(frames), payload_len)
+    batch = cls(len(frames), bytearray(size), timestamp or time.monotonic())
+    pos = 0
+    for i, (address, _, dat, bus) in enumerate(frames):
+      flags = CAN_FLAG_EXTENDED if address >= 0x800 else 0
+      if bus >= 192:
+        flags |= CAN_FLAG_REJECTED
+        bus -= 192
+      if bus >= 128:
+        flags |= CAN_FLAG_RETURNED
+        bus -= 128
+      batch.addr[i] = address
+      batch.data_offsets[i] = pos
+      batch.bus[i] = bus
+      batch.flags[i] = flags
+      batch.dlc[i] = DLC_TO_LEN.index(len(dat))
+      batch.payload[pos:pos + len(dat)] = dat
+      pos += len(dat)
+    batch.data_offsets[len(frames)] = pos
+    return batch
+
+  def __len__(self) -> int:
+    return len(self.dlc)
+
+  def data(self, i: int) -> memoryview:
+    return self.payload[self.data_offsets[i]:self.data_offsets[i + 1]]
+
+  def to_tuples(self) -> List:
+    """Legacy (address, 0, data, bus) frames, returned and rejected frames on bus + 128 and bus + 192."""
+    ret = []
+    payload = bytes(self.payload)
+    offsets = self.data_offsets
+    for i in range(len(self)):
+      flags = self.flags[i]
+      bus = self.bus[i] + (128 if flags & CAN_FLAG_RETURNED else 0) + (192 if flags & CAN_FLAG_REJECTED else 0)
+      ret.append((self.addr[i], 0, payload[offsets[i]:offsets[i + 1]], bus))
+    return ret
@@ -0,0 +1,261 @@
+// Compiled pack_can_buffer / unpack_can_buffer and unpack_can_columns, same semantics as the pure Python versions in
+// __init__.py and can_batch.py.
+// Built as python/_can_buffer by the top level SConscript. __init__.py falls back to Python when it's missing.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CANPACKET_HEAD_SIZE 6U
+#define CHUNK_SIZE_LIMIT 256U
+
+static const uint8_t dlc_to_len[] = {0U, 1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U, 12U, 16U, 20U, 24U, 32U, 48U, 64U};
+
+static int len_to_dlc(Py_ssize_t len) {
+  int ret = -1;
+  for (int dlc = 0; dlc < 16; dlc++) {
+    if (dlc_to_len[dlc] == len) {
+      ret = dlc;
+      break;
+    }
+  }
+  return ret;
+}
+
+static uint8_t calculate_checksum(const uint8_t *data, size_t len) {
+  uint8_t res = 0U;
+  for (size_t i = 0U; i < len; i++) {
+    res ^= data[i];
+  }
+  return res;
+}
+
+// Appends one packet to the chunk, starts a new chunk once it's over the limit. Returns -1 with an exception set on failure.
+static int pack_frame(PyObject *chunks, PyObject *frame, uint8_t *buf, size_t *buf_len) {
+  PyObject *seq = PySequence_Fast(frame, "CAN frame must be a sequence of (address, _, data, bus)");
+  if (seq == NULL) {
+    return -1;
+  }
+
+  int ret = -1;
+  Py_buffer dat = {0};
+  if (PySequence_Fast_GET_SIZE(seq) != 4) {
+    PyErr_SetString(PyExc_ValueError, "CAN frame must be a sequence of (address, _, data, bus)");
+  } else if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, 2), &dat, PyBUF_SIMPLE) == 0) {
+    int dlc = len_to_dlc(dat.len);
+    if (dlc < 0) {
+      PyErr_SetNone(PyExc_AssertionError);
+    } else {
+      PyObject *address_obj = PySequence_Fast_GET_ITEM(seq, 0);
+      int overflow = 0;
+      long long address_signed = PyLong_AsLongLongAndOverflow(address_obj, &overflow);
+      unsigned long long address = PyErr_Occurred() ? 0U : PyLong_AsUnsignedLongLongMask(address_obj);
+      long bus = PyErr_Occurred() ? 0 : PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, 3));
+      if (!PyErr_Occurred()) {
+        unsigned long long extended = ((overflow > 0) || ((overflow == 0) && (address_signed >= 0x800))) ? 1U : 0U;
+        long header0 = ((long)dlc << 4) | (bus << 1);
+        if ((bus < 0) || (header0 > 0xFF)) {
+          PyErr_SetString(PyExc_ValueError, "byte must be in range(0, 256)");
+        } else {
+          uint32_t word_4b = (uint32_t)((address << 3) | (extended << 2));
+          uint8_t *pkt = &buf[*buf_len];
+          pkt[0] = (uint8_t)header0;
+          pkt[1] = word_4b & 0xFFU;
+          pkt[2] = (word_4b >> 8) & 0xFFU;
+          pkt[3] = (word_4b >> 16) & 0xFFU;
+          pkt[4] = (word_4b >> 24) & 0xFFU;
+          memcpy(&pkt[CANPACKET_HEAD_SIZE], dat.buf, dat.len);
+          pkt[5] = calculate_checksum(pkt, 5U) ^ calculate_checksum(&pkt[CANPACKET_HEAD_SIZE], dat.len);
+          *buf_len += CANPACKET_HEAD_SIZE + dat.len;
+          ret = 0;
+
+          if (*buf_len > CHUNK_SIZE_LIMIT) {
+            PyObject *chunk = PyBytes_FromStringAndSize((const char *)buf, *buf_len);
+            if ((chunk == NULL) || (PyList_Append(chunks, chunk) < 0)) {
+              ret = -1;
+            }
+            Py_XDECREF(chunk);
+            *buf_len = 0U;
+          }
+        }
+      }
+    }
+    PyBuffer_Release(&dat);
+  }
+  Py_DECREF(seq);
+  return ret;
+}
+
+static PyObject *pack_can_buffer(PyObject *self, PyObject *arr) {
+  (void)self;
+  // a chunk is cut right after it grows past the limit, so it never exceeds the limit plus one packet
+  uint8_t buf[CHUNK_SIZE_LIMIT + CANPACKET_HEAD_SIZE + 64U];
+  size_t buf_len = 0U;
+
+  PyObject *chunks = PyList_New(0);
+  PyObject *it = (chunks != NULL) ? PyObject_GetIter(arr) : NULL;
+  if (it == NULL) {
+    Py_XDECREF(chunks);
+    return NULL;
+  }
+
+  PyObject *frame;
+  bool ok = true;
+  while (ok && ((frame = PyIter_Next(it)) != NULL)) {
+    ok = (pack_frame(chunks, frame, buf, &buf_len) == 0);
+    Py_DECREF(frame);
+  }
+  Py_DECREF(it);
+
+  if (ok && !PyErr_Occurred()) {
+    PyObject *chunk = PyBytes_FromStringAndSize((const char *)buf, buf_len);
+    if ((chunk != NULL) && (PyList_Append(chunks, chunk) == 0)) {
+      Py_DECREF(chunk);
+      return chunks;
+    }
+    Py_XDECREF(chunk);
+  }
+  Py_DECREF(chunks);
+  return NULL;
+}
+
+// Slices keep the type of the input like Python slicing: bytearray in, bytearray out, bytes otherwise
+static PyObject *slice(bool bytearray, const uint8_t *data, Py_ssize_t len) {
+  return bytearray ? PyByteArray_FromStringAndSize((const char *)data, len) : PyBytes_FromStringAndSize((const char *)data, len);
+}
+
+static PyObject *unpack_can_buffer(PyObject *self, PyObject *arg) {
+  (void)self;
+  Py_buffer dat;
+  if (PyObject_GetBuffer(arg, &dat, PyBUF_SIMPLE) < 0) {
+    return NULL;
+  }
+  bool bytearray = PyByteArray_Check(arg);
+  const uint8_t *buf = dat.buf;
+  Py_ssize_t pos = 0;
+
+  PyObject *ret = PyList_New(0);
+  PyObject *zero = PyLong_FromLong(0);
+  bool ok = (ret != NULL) && (zero != NULL);
+  while (ok && ((dat.len - pos) >= (Py_ssize_t)CANPACKET_HEAD_SIZE)) {
+    const uint8_t *header = &buf[pos];
+    Py_ssize_t data_len = dlc_to_len[header[0] >> 4];
+
+    long bus = (header[0] >> 1) & 0x7;
+    uint32_t address = (((uint32_t)header[4] << 24) | ((uint32_t)header[3] << 16) | ((uint32_t)header[2] << 8) | header[1]) >> 3;
+    if ((header[1] >> 1) & 0x1U) {
+      // returned
+      bus += 128;
+    }
+    if (header[1] & 0x1U) {
+      // rejected
+      bus += 192;
+    }
+
+    // we need more from the next transfer
+    if (data_len > (dat.len - pos - (Py_ssize_t)CANPACKET_HEAD_SIZE)) {
+      break;
+    }
+
+    if (calculate_checksum(header, CANPACKET_HEAD_SIZE + data_len) != 0U) {
+      PyErr_SetString(PyExc_AssertionError, "CAN packet checksum incorrect");
+      ok = false;
+      break;
+    }
+
+    PyObject *frame = Py_BuildValue("(kONl)", (unsigned long)address, zero, slice(bytearray, &header[CANPACKET_HEAD_SIZE], data_len), bus);
+    ok = (frame != NULL) && (PyList_Append(ret, frame) == 0);
+    Py_XDECREF(frame);
+    pos += CANPACKET_HEAD_SIZE + data_len;
+  }
+
+  PyObject *result = NULL;
+  if (ok) {
+    PyObject *rest = slice(bytearray, &buf[pos], dat.len - pos);
+    if (rest != NULL) {
+      result = Py_BuildValue("(NN)", ret, rest);
+      ret = NULL;
+    }
+  }
+  Py_XDECREF(ret);
+  Py_XDECREF(zero);
+  PyBuffer_Release(&dat);
+  return result;
+}
+
+// Columnar unpack, see can_batch.py for the column layout. Returns (frame count, column buffer, incomplete tail).
+static PyObject *unpack_can_columns(PyObject *self, PyObject *arg) {
+  (void)self;
+  Py_buffer dat;
+  if (PyObject_GetBuffer(arg, &dat, PyBUF_SIMPLE) < 0) {
+    return NULL;
+  }
+  const uint8_t *buf = dat.buf;
+
+  // first pass for the sizes and checksums, second one fills the columns
+  Py_ssize_t pos = 0;
+  Py_ssize_t count = 0;
+  Py_ssize_t payload_len = 0;
+  bool ok = true;
+  while ((dat.len - pos) >= (Py_ssize_t)CANPACKET_HEAD_SIZE) {
+    Py_ssize_t data_len = dlc_to_len[buf[pos] >> 4];
+    if (data_len > (dat.len - pos - (Py_ssize_t)CANPACKET_HEAD_SIZE)) {
+      break;
+    }
+    if (calculate_checksum(&buf[pos], CANPACKET_HEAD_SIZE + data_len) != 0U) {
+      PyErr_SetString(PyExc_AssertionError, "CAN packet checksum incorrect");
+      ok = false;
+      break;
+    }
+    count += 1;
+    payload_len += data_len;
+    pos += CANPACKET_HEAD_SIZE + data_len;
+  }
+
+  PyObject *result = NULL;
+  PyObject *columns = ok ? PyByteArray_FromStringAndSize(NULL, (4 * count) + (4 * (count + 1)) + (3 * count) + payload_len) : NULL;
+  if (columns != NULL) {
+    uint8_t *out = (uint8_t *)PyByteArray_AS_STRING(columns);
+    uint32_t *addr = (uint32_t *)out;
+    uint32_t *offsets = &addr[count];
+    uint8_t *bus = (uint8_t *)&offsets[count + 1];
+    uint8_t *flags = &bus[count];
+    uint8_t *dlc = &flags[count];
+    uint8_t *payload = &dlc[count];
+
+    uint32_t data_pos = 0U;
+    Py_ssize_t p = 0;
+    for (Py_ssize_t i = 0; i < count; i++) {
+      const uint8_t *header = &buf[p];
+      uint32_t data_len = dlc_to_len[header[0] >> 4];
+      addr[i] = (((uint32_t)header[4] << 24) | ((uint32_t)header[3] << 16) | ((uint32_t)header[2] << 8) | header[1]) >> 3;
+      offsets[i] = data_pos;
+      bus[i] = (header[0] >> 1) & 0x7U;
+      flags[i] = header[1] & 0x7U;
+      dlc[i] = header[0] >> 4;
+      memcpy(&payload[data_pos], &header[CANPACKET_HEAD_SIZE], data_len);
+      data_pos += data_len;
+      p += CANPACKET_HEAD_SIZE + data_len;
+    }
+    offsets[count] = data_pos;
+
+    result = Py_BuildValue("(nNN)", count, columns, PyBytes_FromStringAndSize((const char *)&buf[pos], dat.len - pos));
+  }
+  PyBuffer_Release(&dat);
+  return result;
+}
+
+static PyMethodDef methods[] = {
+  {"pack_can_buffer", pack_can_buffer, METH_O, "Pack (address, _, data, bus) frames into CANPacket_t chunks of about 256 bytes."},
+  {"unpack_can_buffer", unpack_can_buffer, METH_O, "Unpack CANPacket_t frames, returns (frames, incomplete tail)."},
+  {"unpack_can_columns", unpack_can_columns, METH_O, "Unpack CANPacket_t frames into columns, returns (count, column buffer, incomplete tail)."},
+  {NULL, NULL, 0, NULL},
+};
+
+static struct PyModuleDef module = {
+  PyModuleDef_HEAD_INIT, "_can_buffer", NULL, -1, methods, NULL, NULL, NULL, NULL,
+};
+
+PyMODINIT_FUNC PyInit__can_buffer(void) {
+  return PyModule_Create(&module);
+}
@@ -0,0 +1,136 @@
+import time
+import threading
+from collections import deque
+from typing import Callable, List, Tuple
+
+from .base import BaseHandle
+
+class CanRxReader:
+  """
+    Keeps several bulk IN transfers in flight so the CAN RX endpoint never idles between can_recv calls.
+    A background thread runs the transfer callbacks, which decode each transfer into a bounded frame queue.
+    Frames that don't fit in the queue are dropped and counted in overflow_cnt.
+    With batches, decode returns a CanFrameBatch per transfer and the queue holds those whole, so columnar reads
+    stay zero-copy. A batch that doesn't fit is dropped whole.
+    If decoding a transfer fails, the reader stops resubmitting transfers and recv raises the error.
+  """
+
+  def __init__(self, handle: BaseHandle, decode: Callable[[bytes], Tuple[List, bytes]], endpoint: int = 1,
+               num_transfers: int = 4, transfer_size: int = 16384, max_frames: int = 100000, tail: bytes = b'',
+               batches: bool = False):
+    self.handle = handle
+    self.decode = decode  # (data) -> (frames, incomplete tail), like unpack_can_buffer
+    self.endpoint = endpoint
+    self.num_transfers = num_transfers
+    self.transfer_size = transfer_size
+    self.max_frames = max_frames
+    self.batches = batches
+
+    self.frames: deque = deque()  # frames, or CanFrameBatches with batches
+    self.queued = 0  # frames in the queue
+    self.overflow_cnt = 0
+    self.transfer_cnt = 0
+    self.rx_bytes = 0
+
+    self.tail = tail  # incomplete packet of the last transfer
+    self.error = None  # exception of a failed decode, raised by recv
+
+    self._cond = threading.Condition()
+    self._transfers: List = []
+    self._pending = 0
+    self._running = False
+    self._thread = None
+
+  def start(self, event_thread: bool = True):
+    # without an event thread, something else has to handle the events of the handle's context, like a UsbMonitor
+    assert not self._running, "reader already started"
+    self._running = True
+    self._pending = self.num_transfers
+    self._transfers = [self.handle.bulkReadAsync(self.endpoint, self.transfer_size, self._done) for _ in range(self.num_transfers)]
+    if event_thread:
+      self._thread = threading.Thread(target=self._run, daemon=True)
+      self._thread.start()
+
+  def stop(self, timeout: float = 1.0):
+    if not self._running:
+      return
+    self._running = False
+    for transfer in self._transfers:
+      try:
+        transfer.cancel()
+      except Exception:
+        # already completed and not resubmitted
+        pass
+    if self._thread is not None:
+      self._thread.join()
+      self._thread = None
+    else:
+      end = time.monotonic() + timeout
+      while self._pending > 0 and time.monotonic() < end:
+        self.handle.handleEvents(0.01)
+    self._transfers = []
+
+  def _run(self):
+    while self._pending > 0:
+      self.handle.handleEvents(0.1)
+
+  def _done(self, data):
+    # transfer callback on the event thread. Transfers of one endpoint complete in order, so the tail carries over.
+    if data is None or self.error is not None:
+      self._pending -= 1
+      return False
+
+    try:
+      frames, self.tail = self.decode(self.tail + data)
+    except Exception as e:
+      # the stream can't be followed anymore, the other transfers run out without decoding
+      with self._cond:
+        self.error = e
+        self._pending -= 1
+        self._cond.notify_all()
+      return False
+
+    with self._cond:
+      self.transfer_cnt += 1
+      self.rx_bytes += len(data)
+      room = self.max_frames - self.queued
+      if len(frames) > room:
+        if self.batches:
+          self.overflow_cnt += len(frames)
+          frames = []
+        else:
+          self.overflow_cnt += len(frames) - room
+          frames = frames[:room]
+      if len(frames) > 0:
+        if self.batches:
+          self.frames.append(frames)
+        else:
+          self.frames.extend(frames)
+        self.queued += len(frames)
+        self._cond.notify_all()
+
+    if not self._running:
+      self._pending -= 1
+    return self._running
+
+  def recv(self, timeout: float = 0.0, max_frames: int = 0) -> List:
+    """All queued frames, or at most max_frames. Waits up to timeout seconds for the first one.
+       Raises the decode error once the frames decoded before it are all returned.
+       With batches, the queued batches, whole ones up to max_frames frames but at least one."""
+    with self._cond:
+      if len(self.frames) == 0 and timeout > 0 and self.error is None:
+        self._cond.wait(timeout)
+      if len(self.frames) == 0 and self.error is not None:
+        raise self.error
+      if not self.batches:
+        cnt = len(self.frames) if max_frames == 0 else min(max_frames, len(self.frames))
+        self.queued -= cnt
+        return [self.frames.popleft() for _ in range(cnt)]
+
+      ret = []
+      cnt = 0
+      while len(self.frames) > 0 and (max_frames == 0 or len(ret) == 0 or cnt + len(self.frames[0]) <= max_frames):
+        ret.append(self.frames.popleft())
+        cnt += len(ret[-1])
+      self.queued -= cnt
+      return ret
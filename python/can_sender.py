@@ -0,0 +1,122 @@
+import time
+import logging
+import threading
+from collections import deque
+
+from .base import BaseHandle
+from .constants import CANPACKET_HEAD_SIZE, DLC_TO_LEN
+
+class _Transfer:
+  def __init__(self, start, length):
+    self.start = start
+    self.length = length
+    self.actual = 0
+    self.error = False
+    self.done = False
+    self.usb_transfer = None
+
+class CanTxSender:
+  """
+    Sends the CAN TX stream with several bulk OUT transfers in flight.
+    The jungle NAKs the endpoint while its TX queues are full. A send that runs past its timeout is cut at the
+    last byte the jungle acknowledged. The rest of a packet cut in half is sent first on the next call, because
+    the jungle keeps the first half and waits for the rest.
+  """
+
+  def __init__(self, handle: BaseHandle, endpoint: int = 3, num_transfers: int = 4, transfer_size: int = 4096):
+    self.handle = handle
+    self.endpoint = endpoint
+    self.num_transfers = num_transfers
+    self.transfer_size = transfer_size
+    self.retry_cnt = 0
+
+    self._tail = b''
+    self._lock = threading.Lock()
+
+  def reset(self):
+    # the jungle dropped its partial packet, along with the communications reset
+    self._tail = b''
+
+  def send(self, data: bytes, timeout_ms: int = 0) -> int:
+    """
+      Send packed CANPacket_t data, returns the number of packets accepted.
+      Gives up after timeout_ms without progress, 0 waits forever.
+    """
+    data = self._tail + data
+    acked = self._send(data, timeout_ms)
+
+    # packets up to the last acknowledged byte, the one cut in half counts as it will be completed
+    pos = len(self._tail)
+    packets = 0
+    while pos < acked:
+      pos += CANPACKET_HEAD_SIZE + DLC_TO_LEN[data[pos] >> 4]
+      packets += 1
+    self._tail = data[acked:pos]
+    return packets
+
+  def _done(self, transfer, actual, error):
+    # transfer callback, on whichever thread handles the events
+    with self._lock:
+      transfer.actual = actual
+      transfer.error = error
+      transfer.done = True
+
+  def _submit(self, data, start):
+    transfer = _Transfer(start, min(self.transfer_size, len(data) - start))
+    transfer.usb_transfer = self.handle.bulkWriteAsync(self.endpoint, data[start:start + transfer.length],
+                                                       lambda actual, error: self._done(transfer, actual, error))
+    return transfer
+
+  def _wait(self, transfer, deadline):
+    while not transfer.done and (deadline is None or time.monotonic() < deadline):
+      self.handle.handleEvents(0.01 if deadline is None else max(0.0, min(0.01, deadline - time.monotonic())))
+
+  def _cancel(self, in_flight):
+    # newest first, so nothing queued behind a cancelled transfer gets out ahead of it
+    for transfer in reversed(in_flight):
+      if not transfer.done:
+        try:
+          transfer.usb_transfer.cancel()
+        except Exception:
+          # completed in the meantime
+          pass
+    for transfer in in_flight:
+      self._wait(transfer, None)
+
+  def _send(self, data, timeout_ms):
+    # returns the number of bytes acknowledged in order
+    deadline = None
+    acked = 0
+    offset = 0
+    in_flight: deque = deque()
+    while acked < len(data):
+      while offset < len(data) and len(in_flight) < self.num_transfers:
+        in_flight.append(self._submit(data, offset))
+        offset += in_flight[-1].length
+
+      head = in_flight[0]
+      if timeout_ms != 0 and deadline is None:
+        deadline = time.monotonic() + timeout_ms / 1000
+      self._wait(head, deadline)
+      if head.done and not head.error and head.actual == head.length:
+        acked += head.length
+        in_flight.popleft()
+        deadline = None
+        continue
+
+      # timed out or failed: stop everything behind the head and resume from its last acknowledged byte
+      self._cancel(in_flight)
+      acked += head.actual
+      if any(t.actual > 0 for t in list(in_flight)[1:]):
+        raise RuntimeError("CAN: TX transfers completed out of order")
+      in_flight.clear()
+      offset = acked
+
+      if deadline is None or time.monotonic() < deadline:
+        logging.error("CAN: BAD SEND MANY, RETRYING")
+        self.retry_cnt += 1
+      elif head.actual == 0:
+        # no progress within the timeout
+        break
+      deadline = None
+    return acked
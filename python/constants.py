@@ -5,6 +5,9 @@ from typing import List, NamedTuple
 BASEDIR = os.path.join(os.path.dirname(os.path.realpath(__file__)), "../")
 FW_PATH = os.path.join(BASEDIR, "board/obj/")
 
+CANPACKET_HEAD_SIZE = 0x6
+DLC_TO_LEN = [0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64]
+
 class McuConfig(NamedTuple):
   mcu: str
   mcu_idcode: int
@@ -0,0 +1,278 @@
+import time
+import usb1
+import struct
+import hashlib
+import threading
+from collections import deque
+from typing import Dict, List, Optional
+
+from . import PandaJungle
+from .base import BaseHandle, TIMEOUT
+from .constants import McuType
+
+SIG_SIZE = 128
+
+def sim_signature(dat: bytes) -> bytes:
+  # stands in for the RSA signature, the simulated bootstub checks it the same way
+  return hashlib.sha512(dat).digest() * 2
+
+def sim_image(size: int, seed: bytes = b'') -> bytes:
+  """Signed-looking app image: length word, code, signature over both"""
+  length = size - SIG_SIZE
+  body = b''
+  while len(body) < length - 4:
+    body += hashlib.sha256(seed + len(body).to_bytes(4, 'little')).digest()
+  dat = struct.pack("<I", length) + body[:length - 4]
+  return dat + sim_signature(dat)
+
+class SimDevice:
+  """
+    A jungle in memory, running either the app or the bootstub flasher protocol of board/flasher.h.
+    Erase, programming, USB turnaround and re-enumeration take time like on hardware, so fleets of them show
+    how a flasher scales. fail_writes makes the next bulk OUT transfers fail.
+  """
+  def __init__(self, serial: str, mcu_type: McuType = McuType.H7, image: Optional[bytes] = None,
+               erase_time: float = 0.2, program_rate: float = 500e3, turnaround: float = 0.0005,
+               enumerate_time: float = 0.3, fail_writes: int = 0):
+    self.serial = serial
+    self.mcu_type = mcu_type
+    self.erase_time = erase_time
+    self.program_rate = program_rate
+    self.turnaround = turnaround
+    self.enumerate_time = enumerate_time
+    self.fail_writes = fail_writes
+
+    self.sector_sizes = mcu_type.config.sector_sizes
+    self.flash = bytearray(b'\xff' * sum(self.sector_sizes[1:]))  # app sectors, from sector 1
+    self.flash_word_size = 32 if mcu_type == McuType.H7 else 4
+    self._sector_at = {self.sector_offset(s): s for s in range(1, len(self.sector_sizes))}
+    self.erase_cnt = 0
+    self.bytes_programmed = 0
+    if image is not None:
+      self.flash[:len(image)] = image
+
+    self._cond = threading.Condition()
+    self.generation = 0
+    self.present = True
+    self.bootstub = not self.valid()
+    self._unlocked = False
+    self._erase_ahead = False
+    self._ptr = 0
+    self._word = b''
+
+  def valid(self) -> bool:
+    # the bootstub's check of the length word and the signature
+    length = struct.unpack("<I", self.flash[:4])[0]
+    if length < 8 or length + SIG_SIZE > len(self.flash):
+      return False
+    return bytes(self.flash[length:length + SIG_SIZE]) == sim_signature(bytes(self.flash[:length]))
+
+  def signature(self) -> bytes:
+    length = struct.unpack("<I", self.flash[:4])[0]
+    return bytes(self.flash[length:length + SIG_SIZE])
+
+  def open(self) -> Optional["SimHandle"]:
+    with self._cond:
+      return SimHandle(self, self.generation) if self.present else None
+
+  def wait_for(self, present: bool, timeout: Optional[float] = None) -> bool:
+    with self._cond:
+      return self._cond.wait_for(lambda: self.present == present, timeout)
+
+  def reset(self, bootstub: bool = False):
+    # off the bus now, back after enumerate_time
+    with self._cond:
+      self.generation += 1
+      self.present = False
+      self._cond.notify_all()
+
+    def enumerate():
+      with self._cond:
+        self.bootstub = bootstub or not self.valid()
+        self._unlocked = False
+        self.present = True
+        self._cond.notify_all()
+    threading.Timer(self.enumerate_time, enumerate).start()
+
+  def sector_offset(self, sector: int) -> int:
+    return sum(self.sector_sizes[1:sector])
+
+  def _erase(self, sector: int):
+    start = self.sector_offset(sector)
+    self.flash[start:start + self.sector_sizes[sector]] = b'\xff' * self.sector_sizes[sector]
+    self.erase_cnt += 1
+    time.sleep(self.erase_time)
+
+  def _program(self, word: bytes):
+    if self._erase_ahead and self._ptr in self._sector_at:
+      self._erase(self._sector_at[self._ptr])
+    # flash only clears bits
+    self.flash[self._ptr:self._ptr + len(word)] = bytes(a & b for a, b in zip(self.flash[self._ptr:self._ptr + len(word)], word))
+    self._ptr += len(word)
+    self.bytes_programmed += len(word)
+
+  def _flush(self):
+    if len(self._word) > 0:
+      self._program(self._word.ljust(self.flash_word_size, b'\xff'))
+      self._word = b''
+
+  def control(self, request: int, value: int, length: int) -> bytes:
+    if request == 0xc1:
+      return PandaJungle.HW_TYPE_V2 if self.mcu_type == McuType.H7 else PandaJungle.HW_TYPE_V1
+    if request == 0xd6:
+      return b"sim-bootstub" if self.bootstub else b"sim-app"
+    if request == 0xd1:
+      self.reset(bootstub=value == 1)
+      return b''
+    if request == 0xd8:
+      if self.bootstub:
+        self._flush()
+      self.reset()
+      return b''
+
+    if not self.bootstub:
+      if request == 0xdd:
+        return bytes([PandaJungle.HEALTH_PACKET_VERSION, PandaJungle.CAN_PACKET_VERSION, PandaJungle.CAN_HEALTH_PACKET_VERSION])
+      if request == 0xd3:
+        return self.signature()[:0x40]
+      if request == 0xd4:
+        return self.signature()[0x40:]
+      return b''
+
+    # flasher machine
+    resp = bytearray(b'\xff\x00' + bytes([request, ~request & 0xff]) + b'\xde\xad\xd0\x0d' + b'\x00' * 4)
+    if request == 0xb0:
+      resp[1] = 0xff
+    elif request == 0xb1:
+      self._unlocked = True
+      self._erase_ahead = False
+      self._ptr = 0
+      self._word = b''
+      resp[1] = 0xff
+    elif request == 0xb2:
+      if self._unlocked and 0 < value < len(self.sector_sizes):
+        self._erase(value)
+        resp[1] = 0xff
+    elif request == 0xb3:
+      if self._unlocked:
+        self._erase_ahead = True
+        resp[1] = 0xff
+    elif request == 0xb4:
+      if 0 < value < len(self.sector_sizes):
+        start = self.sector_offset(value)
+        return hashlib.sha1(self.flash[start:start + self.sector_sizes[value]]).digest()
+    elif request == 0xb5:
+      if self._unlocked and 0 < value < len(self.sector_sizes):
+        self._flush()
+        self._ptr = self.sector_offset(value)
+        resp[1] = 0xff
+    return bytes(resp[:length])
+
+  def write(self, data: bytes) -> int:
+    # EP2 OUT, returns the bytes accepted before a failure
+    time.sleep(self.turnaround + len(data) / self.program_rate)
+    if self.fail_writes > 0:
+      self.fail_writes -= 1
+      raise usb1.USBErrorIO()
+    if self.bootstub and self._unlocked:
+      self._word += data
+      while len(self._word) >= self.flash_word_size:
+        self._program(self._word[:self.flash_word_size])
+        self._word = self._word[self.flash_word_size:]
+    return len(data)
+
+class _SimTransfer:
+  def __init__(self, data, callback):
+    self.data = data
+    self.callback = callback
+    self.cancelled = False
+
+  def cancel(self):
+    self.cancelled = True
+
+class SimHandle(BaseHandle):
+  """USB handle of a SimDevice. Stops working once the device resets, like a real one."""
+  def __init__(self, device: SimDevice, generation: int):
+    self.device = device
+    self.generation = generation
+    self._transfers: deque = deque()
+
+  def _check(self):
+    if self.device.generation != self.generation:
+      raise usb1.USBErrorNoDevice()
+
+  def close(self):
+    pass
+
+  def controlWrite(self, request_type: int, request: int, value: int, index: int, data, timeout: int = TIMEOUT, expect_disconnect: bool = False):
+    self._check()
+    time.sleep(self.device.turnaround)
+    self.device.control(request, value, 0)
+    return len(data)
+
+  def controlRead(self, request_type: int, request: int, value: int, index: int, length: int, timeout: int = TIMEOUT):
+    self._check()
+    time.sleep(self.device.turnaround)
+    return self.device.control(request, value, length)[:length]
+
+  def bulkWrite(self, endpoint: int, data: List[int], timeout: int = TIMEOUT) -> int:
+    self._check()
+    return self.device.write(bytes(data))
+
+  def bulkRead(self, endpoint: int, length: int, timeout: int = TIMEOUT) -> bytes:
+    self._check()
+    return b''
+
+  def bulkWriteAsync(self, endpoint: int, data: bytes, callback):
+    self._check()
+    transfer = _SimTransfer(bytes(data), callback)
+    self._transfers.append(transfer)
+    return transfer
+
+  def handleEvents(self, timeout: float) -> None:
+    # the transfers are processed in order, one per call
+    if len(self._transfers) == 0:
+      time.sleep(timeout)
+      return
+    transfer = self._transfers.popleft()
+    if transfer.cancelled or self.device.generation != self.generation:
+      transfer.callback(0, True)
+      return
+    try:
+      transfer.callback(self.device.write(transfer.data), False)
+    except Exception:
+      transfer.callback(0, True)
+
+class SimPandaJungle(PandaJungle):
+  """PandaJungle connected to a SimDevice instead of USB"""
+  def __init__(self, device: SimDevice):
+    self._sim_device = device
+    super().__init__(device.serial)
+
+  def usb_connect(self, serial, claim=True, context=None):
+    handle = self._sim_device.open()
+    if handle is None:
+      return None, None, None, None
+    return handle, self._sim_device.serial, self._sim_device.bootstub, None
+
+  def reconnect(self, timeout: float = 15.0):
+    if self._handle_open:
+      self.close()
+      self._sim_device.wait_for(False, timeout=1.0)
+    if not self._sim_device.wait_for(True, timeout):
+      raise Exception("reconnect failed")
+    self.connect()
+
+class SimBackend:
+  """Device backend of the FleetFlasher, with simulated jungles"""
+  def __init__(self, devices: List[SimDevice]):
+    self.devices: Dict[str, SimDevice] = {d.serial: d for d in devices}
+
+  def list(self) -> List[str]:
+    return [s for s, d in self.devices.items() if d.present]
+
+  def open(self, serial: str) -> PandaJungle:
+    return SimPandaJungle(self.devices[serial])
+
+  def wait_for(self, serial: str, timeout: Optional[float] = None) -> bool:
+    return self.devices[serial].wait_for(True, timeout)
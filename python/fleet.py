@@ -0,0 +1,168 @@
+import time
+import logging
+import threading
+from typing import Dict, List, Optional
+
+from . import PandaJungle
+from .usb_monitor import UsbMonitor, UsbDevice, JUNGLE_BOOTSTUB_IDS, DFU_IDS
+
+CAN_HEALTH_TOTALS = ("total_rx_cnt", "total_tx_cnt", "total_rx_lost_cnt", "total_tx_lost_cnt", "total_error_cnt", "bus_off_cnt")
+
+class JungleFleet:
+  """
+    Many jungles on one libusb context, driven by the one event thread of a UsbMonitor.
+    Jungles are opened as they enumerate and dropped when they leave. Health is polled with async control transfers
+    and CAN RX, if enabled, runs on async bulk transfers, so no call blocks per jungle and scripts need no thread each.
+  """
+  CAN_NUMBERS = (0, 1, 2)
+
+  def __init__(self, serials: Optional[List[str]] = None, health_interval: float = 1.0, can_rx: bool = False,
+               monitor: Optional[UsbMonitor] = None):
+    self.monitor = monitor if monitor is not None else UsbMonitor.shared()
+    self.serials = None if serials is None else set(serials)  # None for every jungle
+    self.health_interval = health_interval
+    self.can_rx = can_rx
+
+    self.jungles: Dict[str, PandaJungle] = {}
+    self.health: Dict[str, dict] = {}
+    self.can_health: Dict[str, Dict[int, dict]] = {}
+    self.connect_cnt: Dict[str, int] = {}
+    self.health_error_cnt: Dict[str, int] = {}
+
+    self._cond = threading.Condition()
+    self._last_poll = 0.0
+    self._started = False
+
+  def __enter__(self):
+    self.start()
+    return self
+
+  def __exit__(self, *args):
+    self.close()
+
+  def start(self):
+    self._started = True
+    self.monitor.add_tick(self._tick)
+    self.monitor.add_listener(self._device_event)
+
+  def close(self):
+    if self._started:
+      self._started = False
+      self.monitor.remove_listener(self._device_event)
+      self.monitor.remove_tick(self._tick)
+    with self._cond:
+      jungles = list(self.jungles.values())
+      self.jungles.clear()
+    for jungle in jungles:
+      self._close_jungle(jungle)
+
+  def wait_for(self, count: Optional[int] = None, timeout: Optional[float] = None) -> bool:
+    """Wait for count jungles, or all the given serials, to be connected."""
+    if count is None:
+      assert self.serials is not None, "count needed without a serial list"
+      count = len(self.serials)
+    with self._cond:
+      return self._cond.wait_for(lambda: len(self.jungles) >= count, timeout)
+
+  def recv(self) -> Dict[str, list]:
+    # frames received since the last call, by serial
+    with self._cond:
+      jungles = dict(self.jungles)
+    return {serial: jungle.can_recv() for serial, jungle in jungles.items()}
+
+  def stats(self) -> dict:
+    """Latest health of every jungle, and sums over the fleet"""
+    with self._cond:
+      per_jungle = {}
+      totals = dict.fromkeys(CAN_HEALTH_TOTALS, 0)
+      totals.update(jungles=len(self.jungles), host_rx_overflow_cnt=0, health_error_cnt=sum(self.health_error_cnt.values()))
+      for serial, jungle in self.jungles.items():
+        can_health = self.can_health.get(serial, {})
+        for h in can_health.values():
+          for k in CAN_HEALTH_TOTALS:
+            totals[k] += h[k]
+        totals["host_rx_overflow_cnt"] += jungle.can_recv_overflow_cnt()
+        per_jungle[serial] = {
+          "health": self.health.get(serial),
+          "can_health": can_health,
+          "connect_cnt": self.connect_cnt.get(serial, 0),
+          "health_error_cnt": self.health_error_cnt.get(serial, 0),
+          "host_rx_overflow_cnt": jungle.can_recv_overflow_cnt(),
+        }
+      return {"jungles": per_jungle, "totals": totals}
+
+  @staticmethod
+  def _close_jungle(jungle):
+    try:
+      jungle.close()
+    except Exception:
+      logging.debug("closing a jungle that left failed", exc_info=True)
+
+  def _device_event(self, event: str, dev: UsbDevice):
+    # on the event thread
+    if (dev.vendor_id, dev.product_id) in JUNGLE_BOOTSTUB_IDS + DFU_IDS:
+      return
+    if self.serials is not None and dev.serial not in self.serials:
+      return
+
+    if event == UsbMonitor.ARRIVED:
+      try:
+        jungle = PandaJungle(dev.serial, usb_context=self.monitor.context)
+        if self.can_rx:
+          jungle.can_recv_start(event_thread=False)
+      except Exception:
+        logging.exception("failed to open jungle %s", dev.serial)
+        return
+      with self._cond:
+        old = self.jungles.pop(dev.serial, None)
+        self.jungles[dev.serial] = jungle
+        self.connect_cnt[dev.serial] = self.connect_cnt.get(dev.serial, 0) + 1
+        self._cond.notify_all()
+    else:
+      with self._cond:
+        old = self.jungles.pop(dev.serial, None)
+        self.health.pop(dev.serial, None)
+        self.can_health.pop(dev.serial, None)
+        self._cond.notify_all()
+    if old is not None:
+      self._close_jungle(old)
+
+  def _tick(self):
+    # on the event thread, the replies come back through its event handling
+    if time.monotonic() - self._last_poll < self.health_interval:
+      return
+    self._last_poll = time.monotonic()
+
+    with self._cond:
+      jungles = dict(self.jungles)
+    for serial, jungle in jungles.items():
+      if jungle.health_version != PandaJungle.HEALTH_PACKET_VERSION or jungle.can_health_version != PandaJungle.CAN_HEALTH_PACKET_VERSION:
+        continue
+      try:
+        jungle._handle.controlReadAsync(PandaJungle.REQUEST_IN, 0xd2, 0, 0, PandaJungle.HEALTH_STRUCT.size,
+                                        lambda dat, serial=serial: self._health_done(serial, dat))
+        for can_number in self.CAN_NUMBERS:
+          jungle._handle.controlReadAsync(PandaJungle.REQUEST_IN, 0xc2, can_number, 0, PandaJungle.CAN_HEALTH_STRUCT.size,
+                                          lambda dat, serial=serial, can_number=can_number: self._can_health_done(serial, can_number, dat))
+      except Exception:
+        self._count_health_error(serial)
+
+  def _count_health_error(self, serial):
+    with self._cond:
+      self.health_error_cnt[serial] = self.health_error_cnt.get(serial, 0) + 1
+
+  def _health_done(self, serial, dat):
+    if dat is None or len(dat) != PandaJungle.HEALTH_STRUCT.size:
+      self._count_health_error(serial)
+      return
+    with self._cond:
+      if serial in self.jungles:
+        self.health[serial] = PandaJungle.parse_health(dat)
+
+  def _can_health_done(self, serial, can_number, dat):
+    if dat is None or len(dat) != PandaJungle.CAN_HEALTH_STRUCT.size:
+      self._count_health_error(serial)
+      return
+    with self._cond:
+      if serial in self.jungles:
+        self.can_health.setdefault(serial, {})[can_number] = PandaJungle.parse_can_health(dat)
@@ -0,0 +1,130 @@
+import os
+import time
+import logging
+import threading
+from concurrent.futures import ThreadPoolExecutor
+from typing import Callable, Dict, List, Optional
+
+from . import PandaJungle
+from .constants import FW_PATH, McuType
+
+class UsbFlashBackend:
+  """Jungles on USB, the FleetFlasher's default backend"""
+  @staticmethod
+  def list() -> List[str]:
+    return PandaJungle.list()
+
+  @staticmethod
+  def open(serial: str) -> PandaJungle:
+    return PandaJungle(serial)
+
+  @staticmethod
+  def wait_for(serial: str, timeout: Optional[float] = None) -> bool:
+    return PandaJungle.wait_for_panda_jungle(serial, timeout)
+
+class FlashJob:
+  PENDING = "pending"
+  CHECKING = "checking"
+  FLASHING = "flashing"
+  UP_TO_DATE = "up to date"
+  DONE = "done"
+  FAILED = "failed"
+
+  def __init__(self, serial: str):
+    self.serial = serial
+    self.state = FlashJob.PENDING
+    self.written = 0
+    self.total = 0
+    self.attempts = 0
+    self.error: Optional[str] = None
+    self.start = 0.0
+    self.end = 0.0
+
+  @property
+  def finished(self) -> bool:
+    return self.state in (FlashJob.UP_TO_DATE, FlashJob.DONE, FlashJob.FAILED)
+
+  def __repr__(self):
+    return f"FlashJob({self.serial}, {self.state}, {self.written}/{self.total} bytes, {self.attempts} attempts, error={self.error})"
+
+class FleetFlasher:
+  """
+    Flashes many jungles at once from one process, one worker per jungle. A jungle already running the
+    firmware's signature is skipped. A failed attempt is retried once the jungle is back on the bus, and with delta
+    flashing it only rewrites the sectors that didn't make it. The bulk writes of each jungle are pipelined.
+  """
+  def __init__(self, code: Optional[bytes] = None, serials: Optional[List[str]] = None, backend=None,
+               retries: int = 2, max_parallel: int = 16, delta: bool = True, force: bool = False,
+               reconnect_timeout: float = 15.0, progress: Optional[Callable[[FlashJob], None]] = None):
+    self.code = code  # the app from FW_PATH for each jungle's MCU if None
+    self.serials = serials
+    self.backend = backend if backend is not None else UsbFlashBackend()
+    self.retries = retries
+    self.max_parallel = max_parallel
+    self.delta = delta
+    self.force = force
+    self.reconnect_timeout = reconnect_timeout
+    self.progress = progress
+
+    self.jobs: Dict[str, FlashJob] = {}
+    self._fw_cache: Dict[McuType, bytes] = {}
+    self._lock = threading.Lock()
+
+  def run(self) -> Dict[str, FlashJob]:
+    serials = self.serials if self.serials is not None else self.backend.list()
+    self.jobs = {s: FlashJob(s) for s in serials}
+    if len(self.jobs) > 0:
+      with ThreadPoolExecutor(max_workers=min(self.max_parallel, len(self.jobs))) as executor:
+        list(executor.map(self._flash, self.jobs.values()))
+    return self.jobs
+
+  def _firmware(self, mcu_type: McuType) -> bytes:
+    if self.code is not None:
+      return self.code
+    with self._lock:
+      if mcu_type not in self._fw_cache:
+        with open(os.path.join(FW_PATH, mcu_type.config.app_fn), "rb") as f:
+          self._fw_cache[mcu_type] = f.read()
+      return self._fw_cache[mcu_type]
+
+  def _update(self, job: FlashJob, state: Optional[str] = None):
+    if state is not None:
+      job.state = state
+    if self.progress is not None:
+      self.progress(job)
+
+  def _flash(self, job: FlashJob):
+    job.start = time.monotonic()
+    while True:
+      job.attempts += 1
+      try:
+        self._attempt(job)
+        break
+      except Exception as e:
+        job.error = f"{type(e).__name__}: {e}"
+        logging.warning("%s: attempt %d failed: %s", job.serial, job.attempts, job.error)
+        if job.attempts > self.retries:
+          self._update(job, FlashJob.FAILED)
+          break
+        self.backend.wait_for(job.serial, self.reconnect_timeout)
+    job.end = time.monotonic()
+
+  def _attempt(self, job: FlashJob):
+    self._update(job, FlashJob.CHECKING)
+    with self.backend.open(job.serial) as jungle:
+      code = self._firmware(jungle.get_mcu_type())
+      signature = code[-128:]
+      if not self.force and not jungle.bootstub and jungle.get_signature() == signature:
+        self._update(job, FlashJob.UP_TO_DATE)
+        return
+
+      def progress(written, total):
+        job.written, job.total = written, total
+        self._update(job)
+
+      self._update(job, FlashJob.FLASHING)
+      jungle.flash(code=code, delta=self.delta, progress=progress)
+      if jungle.bootstub or jungle.get_signature() != signature:
+        raise Exception("firmware didn't start after flashing")
+      job.error = None
+      self._update(job, FlashJob.DONE)
@@ -1,12 +1,15 @@
+import usb1
 import struct
-from typing import List
+import logging
+from typing import Callable, List, Optional
 
 from .base import BaseHandle, BaseSTBootloaderHandle, TIMEOUT
 from .constants import McuType
 
 class PandaJungleUsbHandle(BaseHandle):
-  def __init__(self, libusb_handle):
+  def __init__(self, libusb_handle, libusb_context=None):
     self._libusb_handle = libusb_handle
+    self._libusb_context = libusb_context
 
   def close(self):
     self._libusb_handle.close()
@@ -23,6 +26,55 @@ class PandaJungleUsbHandle(BaseHandle):
   def bulkRead(self, endpoint: int, length: int, timeout: int = TIMEOUT) -> bytes:
     return self._libusb_handle.bulkRead(endpoint, length, timeout)  # type: ignore
 
+  def controlReadAsync(self, request_type: int, request: int, value: int, index: int, length: int,
+                       callback: Callable[[Optional[bytes]], None]):
+    def done(transfer):
+      if transfer.getStatus() == usb1.TRANSFER_COMPLETED:
+        # depending on the libusb1 version, the buffer may start with the setup packet
+        buf = transfer.getBuffer()
+        start = 8 if len(buf) > length else 0
+        callback(bytes(buf[start:start + transfer.getActualLength()]))
+      else:
+        callback(None)
+
+    transfer = self._libusb_handle.getTransfer()
+    transfer.setControl(request_type, request, value, index, length, callback=done, timeout=TIMEOUT)
+    transfer.submit()
+    return transfer
+
+  def bulkReadAsync(self, endpoint: int, length: int, callback: Callable[[Optional[bytes]], bool]):
+    def done(transfer):
+      status = transfer.getStatus()
+      if status == usb1.TRANSFER_COMPLETED:
+        resubmit = callback(bytes(transfer.getBuffer()[:transfer.getActualLength()]))
+      elif status in (usb1.TRANSFER_ERROR, usb1.TRANSFER_TIMED_OUT, usb1.TRANSFER_OVERFLOW):
+        logging.error("CAN: BAD RECV, RETRYING")
+        resubmit = True
+      else:
+        # cancelled, stalled or no device
+        resubmit = False
+        callback(None)
+
+      if resubmit:
+        transfer.submit()
+
+    transfer = self._libusb_handle.getTransfer()
+    transfer.setBulk(usb1.ENDPOINT_IN | endpoint, length, callback=done, timeout=0)
+    transfer.submit()
+    return transfer
+
+  def bulkWriteAsync(self, endpoint: int, data: bytes, callback: Callable[[int, bool], None]):
+    def done(transfer):
+      callback(transfer.getActualLength(), transfer.getStatus() != usb1.TRANSFER_COMPLETED)
+
+    transfer = self._libusb_handle.getTransfer()
+    transfer.setBulk(usb1.ENDPOINT_OUT | endpoint, data, callback=done, timeout=0)
+    transfer.submit()
+    return transfer
+
+  def handleEvents(self, timeout: float) -> None:
+    self._libusb_context.handleEventsTimeout(timeout)
+
 
 
 class STBootloaderUSBHandle(BaseSTBootloaderHandle):
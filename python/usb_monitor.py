@@ -0,0 +1,189 @@
+import time
+import usb1
+import logging
+import threading
+from collections import deque
+from typing import Callable, Dict, List, NamedTuple, Optional, Tuple
+
+JUNGLE_IDS = ((0xbbaa, 0xddcf), (0xbbaa, 0xddef))
+JUNGLE_BOOTSTUB_IDS = ((0xbbaa, 0xddef), )
+DFU_IDS = ((0x0483, 0xdf11), )
+
+class UsbDevice(NamedTuple):
+  serial: str
+  vendor_id: int
+  product_id: int
+  device: usb1.USBDevice
+
+class UsbMonitor:
+  """
+    One libusb context with one event thread. Tracks jungles and DFU devices through libusb hotplug events,
+    or by polling the device list where hotplug isn't supported, and caches their serials.
+    Async transfers of handles opened on this context also complete on its thread.
+  """
+  POLL_INTERVAL = 0.5
+  ARRIVED = "arrived"
+  LEFT = "left"
+
+  _shared: Optional["UsbMonitor"] = None
+  _shared_lock = threading.Lock()
+
+  def __init__(self):
+    self.context = usb1.USBContext()
+    self.context.open()
+    self.hotplug = bool(self.context.hasCapability(usb1.CAP_HAS_HOTPLUG))
+
+    self._cond = threading.Condition()
+    self._devices: Dict[Tuple[int, int], UsbDevice] = {}
+    self._events: deque = deque()  # handled after the hotplug callback, which can't do transfers
+    self._listeners: List[Callable[[str, UsbDevice], None]] = []
+    self._ticks: List[Callable[[], None]] = []
+    self._running = True
+    self._last_poll = time.monotonic()
+
+    # the devices already present are in the cache before the constructor returns
+    if self.hotplug:
+      self._hotplug_handle = self.context.hotplugRegisterCallback(self._hotplug_callback, flags=usb1.HOTPLUG_ENUMERATE)
+    else:
+      self._poll()
+    self._handle_hotplug_events()
+    self._thread = threading.Thread(target=self._run, daemon=True)
+    self._thread.start()
+
+  @classmethod
+  def shared(cls) -> "UsbMonitor":
+    with cls._shared_lock:
+      if cls._shared is None:
+        cls._shared = cls()
+      return cls._shared
+
+  def close(self):
+    self._running = False
+    self._thread.join()
+    self.context.close()
+
+  def add_listener(self, listener: Callable[[str, UsbDevice], None]):
+    # called on the event thread with ARRIVED or LEFT, once for every device already present
+    with self._cond:
+      self._listeners.append(listener)
+      present = list(self._devices.values())
+    for dev in present:
+      listener(self.ARRIVED, dev)
+
+  def remove_listener(self, listener):
+    with self._cond:
+      self._listeners.remove(listener)
+
+  def add_tick(self, tick: Callable[[], None]):
+    # called on the event thread after every round of events, at least every 0.1 s
+    with self._cond:
+      self._ticks.append(tick)
+
+  def remove_tick(self, tick):
+    with self._cond:
+      self._ticks.remove(tick)
+
+  def devices(self, ids=JUNGLE_IDS) -> List[UsbDevice]:
+    with self._cond:
+      return [d for d in self._devices.values() if (d.vendor_id, d.product_id) in ids]
+
+  def serials(self, ids=JUNGLE_IDS) -> List[str]:
+    return [d.serial for d in self.devices(ids)]
+
+  def wait_for(self, ids=JUNGLE_IDS, serial: Optional[str] = None, timeout: Optional[float] = None) -> Optional[UsbDevice]:
+    """First device with these IDs (and serial), as soon as it enumerates. None on timeout."""
+    end = None if timeout is None else time.monotonic() + timeout
+    with self._cond:
+      while True:
+        for d in self._devices.values():
+          if (d.vendor_id, d.product_id) in ids and (serial is None or d.serial == serial):
+            return d
+        remaining = None if end is None else end - time.monotonic()
+        if remaining is not None and remaining <= 0:
+          return None
+        self._cond.wait(remaining)
+
+  def wait_for_gone(self, serial: str, timeout: Optional[float] = None) -> bool:
+    end = None if timeout is None else time.monotonic() + timeout
+    with self._cond:
+      while any(d.serial == serial for d in self._devices.values()):
+        remaining = None if end is None else end - time.monotonic()
+        if remaining is not None and remaining <= 0:
+          return False
+        self._cond.wait(remaining)
+    return True
+
+  @staticmethod
+  def _key(device) -> Tuple[int, int]:
+    return (device.getBusNumber(), device.getDeviceAddress())
+
+  @staticmethod
+  def _tracked(device) -> bool:
+    return (device.getVendorID(), device.getProductID()) in JUNGLE_IDS + DFU_IDS
+
+  def _hotplug_callback(self, context, device, event):
+    if self._tracked(device):
+      self._events.append((event == usb1.HOTPLUG_EVENT_DEVICE_ARRIVED, device))
+    return False
+
+  def _add(self, device):
+    # reads the serial, which needs synchronous transfers
+    vendor_id, product_id = device.getVendorID(), device.getProductID()
+    try:
+      if (vendor_id, product_id) in DFU_IDS:
+        serial = device.open().getASCIIStringDescriptor(3)
+      else:
+        serial = device.getSerialNumber()
+    except Exception:
+      logging.debug("can't read serial of %04x:%04x", vendor_id, product_id)
+      return
+
+    dev = UsbDevice(serial, vendor_id, product_id, device)
+    with self._cond:
+      self._devices[self._key(device)] = dev
+      listeners = list(self._listeners)
+      self._cond.notify_all()
+    for listener in listeners:
+      listener(self.ARRIVED, dev)
+
+  def _left(self, key):
+    with self._cond:
+      dev = self._devices.pop(key, None)
+      listeners = list(self._listeners)
+      self._cond.notify_all()
+    if dev is not None:
+      for listener in listeners:
+        listener(self.LEFT, dev)
+
+  def _handle_hotplug_events(self):
+    while len(self._events) > 0:
+      arrived, device = self._events.popleft()
+      if arrived:
+        self._add(device)
+      else:
+        self._left(self._key(device))
+
+  def _poll(self):
+    # device list diff, without hotplug support
+    present = {self._key(d): d for d in self.context.getDeviceList(skip_on_error=True) if self._tracked(d)}
+    with self._cond:
+      known = set(self._devices.keys())
+    for key in known - present.keys():
+      self._left(key)
+    for key in present.keys() - known:
+      self._add(present[key])
+
+  def _run(self):
+    while self._running:
+      try:
+        self.context.handleEventsTimeout(0.1)
+        if not self.hotplug and time.monotonic() - self._last_poll > self.POLL_INTERVAL:
+          self._last_poll = time.monotonic()
+          self._poll()
+        self._handle_hotplug_events()
+        with self._cond:
+          ticks = list(self._ticks)
+        for tick in ticks:
+          tick()
+      except Exception:
+        logging.exception("USB event loop error")
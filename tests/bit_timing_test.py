@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+import os
+import re
+import sys
+
+# Host-side check of the bxCAN and FDCAN bit timing tables, no hardware needed.
+# Recomputes the register fields for every speed and sample point the firmware accepts.
+
+BOARD = os.path.join(os.path.dirname(os.path.realpath(__file__)), "../board")
+LLFDCAN = os.path.join(BOARD, "stm32h7/llfdcan.h")
+LLBXCAN = os.path.join(BOARD, "stm32fx/llbxcan.h")
+
+NOMINAL_LIMITS = {"prescaler": 512, "seg1": 256, "seg2": 128}
+DATA_LIMITS = {"prescaler": 32, "seg1": 32, "seg2": 16}
+BXCAN_LIMITS = {"prescaler": 1024, "seg1": 16, "seg2": 8}
+TDCO_MAX = 127
+
+def parse_define(src, name):
+  return int(re.search(rf"#define {name} (\d+)U", src).group(1))
+
+def parse_table(src, name):
+  body = re.search(rf"#define {name}\(X\)((?:.*\\\n)*.*)", src).group(1)
+  entries = re.findall(r"X\((\d+)U, (\d+)U, (\d+)U, (\w+)\)", body)
+  return [(int(speed), int(prescaler), int(tq), parse_define(src, sp)) for speed, prescaler, tq, sp in entries]
+
+def segments(tq, sp):
+  # same integer math as CAN_SEG1 / CAN_SEG2
+  seg2 = (tq * (100 - sp) + 50) // 100
+  return tq - 1 - seg2, seg2
+
+def check(name, timings, limits, pclk, sp_range, tdc_min_speed):
+  errors = []
+  for speed, prescaler, tq, default_sp in timings:
+    if pclk * 1000 * 10 != speed * 1000 * prescaler * tq:
+      errors.append(f"{name} {speed / 10} kbps: {prescaler} x {tq} tq doesn't divide {pclk} kHz exactly")
+    if prescaler > limits["prescaler"]:
+      errors.append(f"{name} {speed / 10} kbps: prescaler {prescaler} out of range")
+    for sp in sorted(set(sp_range) | {default_sp}):
+      seg1, seg2 = segments(tq, sp)
+      actual_sp = 100 * (1 + seg1) / tq
+      if not (1 <= seg1 <= limits["seg1"] and 1 <= seg2 <= limits["seg2"]):
+        errors.append(f"{name} {speed / 10} kbps @ {sp}%: segments {seg1}/{seg2} out of range")
+      # rounded to the nearest time quantum
+      if abs(actual_sp - sp) > 50 / tq:
+        errors.append(f"{name} {speed / 10} kbps @ {sp}%: sample point at {actual_sp:.1f}%")
+      if speed >= tdc_min_speed and prescaler * (1 + seg1) > TDCO_MAX:
+        errors.append(f"{name} {speed / 10} kbps @ {sp}%: TDC offset {prescaler * (1 + seg1)} out of range")
+  return errors
+
+if __name__ == "__main__":
+  with open(LLFDCAN) as f:
+    src = f.read()
+  pclk = parse_define(src, "CAN_PCLK")
+  sp_range = range(parse_define(src, "CAN_SP_MIN"), parse_define(src, "CAN_SP_MAX") + 1)
+  tdc_min_speed = parse_define(src, "CAN_TDC_MIN_SPEED")
+  nominal = parse_table(src, "FDCAN_NOMINAL_TIMINGS")
+  data = parse_table(src, "FDCAN_DATA_TIMINGS")
+  assert len(nominal) > 0 and len(data) > 0
+
+  errors = check("FDCAN nominal", nominal, NOMINAL_LIMITS, pclk, sp_range, float("inf"))
+  errors += check("FDCAN data", data, DATA_LIMITS, pclk, sp_range, tdc_min_speed)
+  print(f"FDCAN: {len(nominal)} nominal, {len(data)} data speeds, sample points {sp_range.start}-{sp_range.stop - 1}%")
+
+  # bxCAN sample point is fixed to the table's
+  with open(LLBXCAN) as f:
+    src = f.read()
+  bxcan = parse_table(src, "BXCAN_TIMINGS")
+  assert len(bxcan) > 0
+  errors += check("bxCAN", bxcan, BXCAN_LIMITS, parse_define(src, "CAN_PCLK"), [], float("inf"))
+  print(f"bxCAN: {len(bxcan)} speeds")
+
+  for e in errors:
+    print(e)
+  print(f"{len(errors)} errors")
+  sys.exit(1 if errors else 0)
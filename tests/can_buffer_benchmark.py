@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+import os
+import sys
+import time
+import random
+import argparse
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python import pack_can_buffer, unpack_can_buffer, pack_can_buffer_py, unpack_can_buffer_py, DLC_TO_LEN
+from python.can_batch import CanFrameBatch, unpack_can_columns, unpack_can_columns_py
+
+# Checks the compiled pack_can_buffer / unpack_can_buffer / unpack_can_columns against the pure Python versions and
+# compares their speed.
+# Build the extension with scons first, without it both sides are the Python versions.
+
+CANPACKET_CHECKSUM_OFFSET = 5
+
+def random_frames(n, fd):
+  rng = random.Random(0)
+  lengths = DLC_TO_LEN if fd else DLC_TO_LEN[:9]
+  return [(rng.choice([rng.randrange(0x800), rng.randrange(0x800, 0x20000000)]), 0, rng.randbytes(rng.choice(lengths)), rng.randrange(3))
+          for _ in range(n)]
+
+def transfers(stream, rng):
+  # random transfer sizes, so packets get split across transfers
+  ret = []
+  pos = 0
+  while pos < len(stream):
+    size = rng.randrange(1, 16384)
+    ret.append(stream[pos:pos + size])
+    pos += size
+  return ret
+
+def unpack_all(chunks, unpack):
+  msgs = []
+  rest = b''
+  for chunk in chunks:
+    ret, rest = unpack(rest + chunk)
+    msgs += ret
+  return msgs, rest
+
+def check(frames):
+  rng = random.Random(1)
+  snds = pack_can_buffer(frames)
+  assert snds == pack_can_buffer_py(frames), "pack mismatch"
+  chunks = transfers(b''.join(snds), rng)
+  assert unpack_all(chunks, unpack_can_buffer) == unpack_all(chunks, unpack_can_buffer_py) == (frames, b''), "unpack mismatch"
+  assert unpack_can_buffer(bytearray(snds[0][:-1])) == unpack_can_buffer_py(bytearray(snds[0][:-1])), "bytearray unpack mismatch"
+
+  stream = b''.join(snds)
+  assert unpack_can_columns(stream + stream[:3]) == unpack_can_columns_py(stream + stream[:3]), "columnar unpack mismatch"
+  batch, _ = CanFrameBatch.from_buffer(stream)
+  assert batch.to_tuples() == frames, "batch mismatch"
+  assert bytes(batch.data(len(frames) - 1)) == frames[-1][2]
+  tuples = unpack_can_buffer(stream)[0]
+  assert CanFrameBatch.from_tuples(tuples).to_tuples() == tuples
+
+  for unpack in (unpack_can_buffer, unpack_can_buffer_py, unpack_can_columns, unpack_can_columns_py):
+    corrupted = bytearray(snds[0])
+    corrupted[CANPACKET_CHECKSUM_OFFSET] ^= 0xFF
+    try:
+      unpack(bytes(corrupted))
+      raise Exception("checksum not checked")
+    except AssertionError:
+      pass
+
+  for pack in (pack_can_buffer, pack_can_buffer_py):
+    try:
+      pack([(0x123, 0, b'\x00' * 9, 0)])
+      raise Exception("length not checked")
+    except AssertionError:
+      pass
+
+def bench(fn, arg, iterations):
+  start = time.monotonic()
+  for _ in range(iterations):
+    fn(arg)
+  return (time.monotonic() - start) / iterations
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--frames", type=int, default=10000)
+  parser.add_argument("--iterations", type=int, default=10)
+  parser.add_argument("--fd", action="store_true")
+  args = parser.parse_args()
+
+  compiled = pack_can_buffer is not pack_can_buffer_py
+  print(f"compiled extension {'loaded' if compiled else 'NOT available, comparing Python with itself'}")
+
+  frames = random_frames(args.frames, args.fd)
+  check(frames)
+
+  stream = b''.join(pack_can_buffer(frames))
+  for name, fn, fn_py, arg in (("pack", pack_can_buffer, pack_can_buffer_py, frames),
+                               ("unpack", unpack_can_buffer, unpack_can_buffer_py, stream),
+                               ("column", unpack_can_columns, unpack_can_columns_py, stream)):
+    t, t_py = bench(fn, arg, args.iterations), bench(fn_py, arg, args.iterations)
+    print(f"{name:>6}: {len(frames) / t / 1000:8.1f} kframes/s, Python {len(frames) / t_py / 1000:8.1f} kframes/s, {t_py / t:5.1f}x")
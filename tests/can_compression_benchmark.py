@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+import os
+import sys
+import csv
+import time
+import random
+import argparse
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python import PandaJungle, CanRxDecompressor, pack_can_buffer, unpack_can_buffer, DLC_TO_LEN, LEN_TO_DLC
+from python.can_batch import CanFrameBatch, CAN_FLAG_EXTENDED
+
+# Compares the CANPacket_t RX stream with the compressed one on recorded traffic: bytes per frame and host decode throughput.
+# Traffic comes from a CSV log (bus,address,hex payload per row), a capture from a connected jungle, or a synthetic car-like mix.
+# Also checks that the decoder drops a lost transfer and picks the stream up again at the next sync record.
+
+TRANSFER_SIZE = 16384
+
+class CanRxCompressor:
+  # host model of can_compress_packet in board/can_comms.h
+  def __init__(self):
+    self.dict = [None] * CanRxDecompressor.DICT_SIZE  # [header, dlc, payload]
+    self.sync_cnt = 0
+
+  def encode(self, address, dat, bus):
+    sync = b''
+    if self.sync_cnt >= CanRxDecompressor.SYNC_INTERVAL:
+      self.dict = [None] * CanRxDecompressor.DICT_SIZE
+      self.sync_cnt = 0
+      sync = CanRxDecompressor.SYNC
+    self.sync_cnt += 1
+
+    word = (address << 3) | ((1 if address >= 0x800 else 0) << 2)
+    header = bytes([bus << 1]) + word.to_bytes(4, "little")
+    hash_ = (((word ^ ((bus << 1) << 28)) * 2654435761) & 0xFFFFFFFF) >> 24
+    dlc = LEN_TO_DLC[len(dat)]
+
+    flags = CanRxDecompressor.REC_NO_INDEX
+    idx = entry = None
+    for i in range(CanRxDecompressor.DICT_SIZE):
+      idx = (hash_ + i) % CanRxDecompressor.DICT_SIZE
+      if self.dict[idx] is None:
+        entry = self.dict[idx] = [header, None, b'']
+        flags = CanRxDecompressor.REC_NEW
+        break
+      if self.dict[idx][0] == header:
+        entry = self.dict[idx]
+        flags = 0
+        break
+
+    rec = b'' if entry is None else bytes([idx])
+    if flags:
+      rec += header
+
+    bitmap_len = (len(dat) + 7) // 8
+    diffs = [(i, a ^ b) for i, (a, b) in enumerate(zip(dat, entry[2])) if a != b] if flags == 0 else []
+    if flags == 0 and entry[1] == dlc and bitmap_len + len(diffs) < len(dat):
+      flags = CanRxDecompressor.REC_XOR
+      bitmap = bytearray(bitmap_len)
+      for i, _ in diffs:
+        bitmap[i // 8] |= 1 << (i % 8)
+      rec += bitmap + bytes(d for _, d in diffs)
+    else:
+      rec += dat
+
+    check = dlc << 4
+    for b in header + dat:
+      check ^= b
+    rec += bytes([check])
+
+    if entry is not None:
+      entry[1:] = [dlc, dat]
+    return sync + bytes([(dlc << 4) | flags]) + rec
+
+def load_log(path):
+  with open(path) as f:
+    return [(int(addr, 0), 0, bytes.fromhex(dat), int(bus)) for bus, addr, dat in csv.reader(f)]
+
+def capture(seconds):
+  jungle = PandaJungle()
+  frames = []
+  end = time.monotonic() + seconds
+  while time.monotonic() < end:
+    frames += [f for f in jungle.can_recv() if f[3] < 128]
+  return frames
+
+def synthesize(n_frames, fd):
+  # periodic IDs at 10-100 Hz, each payload with a rolling counter, a checksum and slowly changing signals
+  rng = random.Random(0)
+  ids = []
+  for bus in range(3):
+    for addr in rng.sample(range(0x100, 0x7FF), 40) + rng.sample(range(0x800, 0x1FFFFFFF), 5):
+      length = rng.choice([12, 16, 24, 32, 48, 64]) if fd and rng.random() < 0.5 else 8
+      ids.append([addr, bus, rng.choice([10, 20, 50, 100]), bytearray(rng.randbytes(length)), 0])
+
+  frames = []
+  t = 0
+  while len(frames) < n_frames:
+    t += 1
+    for msg in ids:
+      addr, bus, period, dat, cnt = msg
+      if t % period == 0:
+        msg[4] = cnt = (cnt + 1) & 0xF
+        dat[1] = (dat[1] & 0xF0) | cnt
+        if rng.random() < 0.1:
+          dat[rng.randrange(2, len(dat))] ^= 1 << rng.randrange(8)
+        dat[0] = sum(dat[1:]) & 0xFF
+        frames.append((addr, 0, bytes(dat), bus))
+  return frames[:n_frames]
+
+def transfers(stream):
+  return [stream[i:i + TRANSFER_SIZE] for i in range(0, len(stream), TRANSFER_SIZE)]
+
+def decode_all(chunks, decode):
+  msgs = []
+  rest = b''
+  start = time.monotonic()
+  for chunk in chunks:
+    ret, rest = decode(rest + chunk)
+    msgs += ret
+  return msgs, time.monotonic() - start
+
+def batch_decoder(decompressor):
+  # decode_batch for decode_all, which collects lists
+  def decode(dat):
+    batch, rest = decompressor.decode_batch(dat)
+    return [batch], rest
+  return decode
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--log", help="CSV of bus,address,hex payload")
+  parser.add_argument("--capture", type=float, help="seconds of traffic to record from a connected jungle")
+  parser.add_argument("--frames", type=int, default=200000, help="synthetic frames")
+  parser.add_argument("--fd", action="store_true", help="synthetic CAN FD payloads")
+  args = parser.parse_args()
+
+  if args.log:
+    frames = load_log(args.log)
+  elif args.capture:
+    frames = capture(args.capture)
+  else:
+    frames = synthesize(args.frames, args.fd)
+  assert len(frames) > 0, "no traffic"
+  assert all(len(f[2]) in DLC_TO_LEN for f in frames)
+
+  legacy = b''.join(pack_can_buffer(frames))
+  compressor = CanRxCompressor()
+  compressed = b''.join(compressor.encode(addr, dat, bus) for addr, _, dat, bus in frames)
+
+  legacy_msgs, legacy_time = decode_all(transfers(legacy), unpack_can_buffer)
+  compressed_msgs, compressed_time = decode_all(transfers(compressed), CanRxDecompressor().decode)
+  assert legacy_msgs == frames, "CANPacket_t stream mismatch"
+  assert compressed_msgs == frames, "compressed stream mismatch"
+
+  batches, batch_time = decode_all(transfers(compressed), batch_decoder(CanRxDecompressor()))
+  batch = CanFrameBatch.concat(batches)
+  assert batch.to_tuples() == frames, "columnar decode mismatch"
+  assert all(bool(batch.flags[i] & CAN_FLAG_EXTENDED) == (batch.addr[i] >= 0x800) for i in range(len(batch))), "extended flag lost"
+
+  # lose one transfer: what follows up to the next sync record is dropped, the rest decodes
+  chunks = transfers(compressed)
+  if len(chunks) > 2:
+    decompressor = CanRxDecompressor()
+    lossy_msgs, _ = decode_all(chunks[:1] + chunks[2:], decompressor.decode)
+    assert decompressor.error_cnt > 0, "lost transfer not detected"
+    assert lossy_msgs[-1000:] == frames[-1000:], "stream not resynced"
+    assert len(frames) - len(lossy_msgs) < len(chunks[1]) + 2 * CanRxDecompressor.SYNC_INTERVAL, "too many frames dropped"
+
+  print(f"{len(frames)} frames, {sum(len(f[2]) for f in frames) / len(frames):.1f} payload bytes/frame")
+  for name, stream, t in (("CANPacket_t", legacy, legacy_time), ("compressed", compressed, compressed_time)):
+    print(f"{name:>12}: {len(stream) / len(frames):5.2f} bytes/frame, decode {len(frames) / t / 1000:7.1f} kframes/s")
+  print(f"{'columnar':>12}: {'':>5}             decode {len(frames) / batch_time / 1000:7.1f} kframes/s")
+  print(f"compression ratio {len(legacy) / len(compressed):.2f}")
@@ -34,5 +34,26 @@ def can_printer():
       print(dd)
       lp = sec_since_boot()
 
+# Same view from the jungle's per ID statistics, without streaming every frame over USB
+def can_printer_fw():
+  p = PandaJungle()
+  p.clear_can_id_stats()
+  p.set_can_id_stats(True)
+
+  start = sec_since_boot()
+  canbus = int(os.getenv("CAN", 0))
+  while True:
+    stats, overflow_cnt = p.get_can_id_stats()
+    dd = chr(27) + "[2J"
+    dd += "%5.2f%s\n" % (sec_since_boot() - start, " (%d frames of untracked IDs)" % overflow_cnt if overflow_cnt else "")
+    for (bus, k), s in sorted(stats.items()):
+      if bus == canbus:
+        dd += "%s(%6d) %s %6.1f ms\n" % ("%04X(%4d)" % (k,k), s["cnt"], binascii.hexlify(s["data"]), s["period_mean"] * 1e3)
+    print(dd)
+    time.sleep(0.1)
+
 if __name__ == "__main__":
-  can_printer()
+  if os.getenv("FW") is not None:
+    can_printer_fw()
+  else:
+    can_printer()
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+import os
+import sys
+import time
+import random
+import threading
+import argparse
+from collections import deque
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python import pack_can_buffer, unpack_can_buffer
+from python.can_batch import CanFrameBatch
+from python.can_reader import CanRxReader
+
+# Runs the asynchronous CAN reader against a stand-in handle that serves a packed frame stream,
+# cut into transfers of random length like the jungle's short packets, with a fixed completion latency per transfer.
+
+class MockTransfer:
+  def __init__(self, handle, length, callback):
+    self.handle = handle
+    self.length = length
+    self.callback = callback
+    self.cancelled = False
+
+  def cancel(self):
+    with self.handle.lock:
+      if self not in self.handle.in_flight:
+        raise Exception("transfer not submitted")
+      self.cancelled = True
+
+class MockHandle:
+  def __init__(self, stream, latency):
+    self.stream = stream
+    self.pos = 0
+    self.latency = latency
+    self.lock = threading.Lock()
+    self.in_flight = deque()
+    self.max_in_flight = 0
+    self.rng = random.Random(0)
+
+  def bulkReadAsync(self, endpoint, length, callback):
+    transfer = MockTransfer(self, length, callback)
+    self._submit(transfer)
+    return transfer
+
+  def _submit(self, transfer):
+    with self.lock:
+      self.in_flight.append(transfer)
+      self.max_in_flight = max(self.max_in_flight, len(self.in_flight))
+
+  def handleEvents(self, timeout):
+    # the oldest transfer completes first, with whatever the device has queued
+    with self.lock:
+      transfer = self.in_flight.popleft() if len(self.in_flight) > 0 else None
+    if transfer is None:
+      time.sleep(timeout)
+      return
+
+    time.sleep(self.latency)
+    if transfer.cancelled:
+      transfer.callback(None)
+      return
+    size = min(transfer.length, self.rng.randrange(0, 4096))
+    data = self.stream[self.pos:self.pos + size]
+    self.pos += len(data)
+    if transfer.callback(data):
+      self._submit(transfer)
+
+def frames(n):
+  rng = random.Random(1)
+  return [(rng.randrange(0x20000000), 0, rng.randbytes(rng.choice([0, 1, 8, 12, 64])), rng.randrange(3)) for _ in range(n)]
+
+def test_in_order(n_frames, num_transfers):
+  sent = frames(n_frames)
+  handle = MockHandle(b''.join(pack_can_buffer(sent)), 0.0005)
+  reader = CanRxReader(handle, unpack_can_buffer, num_transfers=num_transfers)
+  start = time.monotonic()
+  reader.start()
+  received = []
+  while len(received) < len(sent):
+    assert time.monotonic() - start < 30, "timed out"
+    received += reader.recv(timeout=0.1)
+  elapsed = time.monotonic() - start
+  reader.stop()
+
+  assert received == sent, "frames lost or reordered"
+  assert handle.max_in_flight == num_transfers
+  assert len(handle.in_flight) == 0, "transfers left after stop"
+  print(f"{num_transfers} transfers in flight: {len(sent)} frames in {reader.transfer_cnt} transfers, {elapsed:.2f} s")
+
+def test_batches(n_frames):
+  # columnar: one batch per transfer, in order, and a batch that doesn't fit is dropped whole
+  sent = frames(n_frames)
+  handle = MockHandle(b''.join(pack_can_buffer(sent)), 0)
+  reader = CanRxReader(handle, CanFrameBatch.from_buffer, max_frames=n_frames // 2, batches=True)
+  reader.start()
+  while handle.pos < len(handle.stream):
+    time.sleep(0.01)
+  time.sleep(0.1)
+  reader.stop()
+
+  batches = reader.recv()
+  received = CanFrameBatch.concat(batches).to_tuples()
+  it = iter(sent)
+  assert all(f in it for f in received), "frames reordered"
+  assert len(received) + reader.overflow_cnt == n_frames, f"{len(received)} frames, overflow count {reader.overflow_cnt}"
+  assert len(received) <= n_frames // 2 and reader.queued == 0
+  print(f"batches: {len(received)} frames in {len(batches)} batches, {reader.overflow_cnt} dropped")
+
+def test_overflow(n_frames, max_frames):
+  sent = frames(n_frames)
+  handle = MockHandle(b''.join(pack_can_buffer(sent)), 0)
+  reader = CanRxReader(handle, unpack_can_buffer, max_frames=max_frames)
+  reader.start()
+  while handle.pos < len(handle.stream):
+    time.sleep(0.01)
+  time.sleep(0.1)
+  reader.stop()
+
+  received = reader.recv()
+  assert len(received) == max_frames
+  assert received == sent[:max_frames], "queued frames should be the oldest"
+  assert reader.overflow_cnt == n_frames - max_frames, f"overflow count {reader.overflow_cnt}"
+  print(f"overflow: {reader.overflow_cnt} frames dropped with a {max_frames} frame queue")
+
+def test_decode_error(n_frames):
+  # a stream the decoder rejects halfway: the frames before still arrive, then recv raises and stop returns
+  sent = frames(n_frames)
+  stream = b''.join(pack_can_buffer(sent))
+  handle = MockHandle(stream[:len(stream) // 2] + b'\xff' * 64 + stream[len(stream) // 2:], 0.0005)
+  reader = CanRxReader(handle, unpack_can_buffer)
+  reader.start()
+  received = []
+  start = time.monotonic()
+  try:
+    while True:
+      assert time.monotonic() - start < 30, "timed out"
+      received += reader.recv(timeout=0.1)
+  except AssertionError as e:
+    assert "checksum" in str(e), e
+  reader.stop()
+
+  assert 0 < len(received) < len(sent) and received == sent[:len(received)]
+  assert reader._thread is None and reader._pending == 0
+  print(f"decode error: raised after {len(received)} frames")
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--frames", type=int, default=20000)
+  args = parser.parse_args()
+
+  for num_transfers in (1, 4, 8):
+    test_in_order(args.frames, num_transfers)
+  test_batches(args.frames)
+  test_overflow(args.frames, 1000)
+  test_decode_error(args.frames)
+  print("PASSED")
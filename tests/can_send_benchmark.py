@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+import os
+import sys
+import time
+import random
+import argparse
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python import pack_can_buffer
+from python.can_sender import CanTxSender
+
+# Compares the pipelined CAN sender with the previous synchronous can_send_many on a mock handle, then checks that a
+# send cut short by backpressure resumes exactly at the last acknowledged byte.
+# The mock models a fixed turnaround per transfer (submission, scheduling, completion) and a wire rate. The jungle NAKs
+# once accept_limit bytes are in, like it does while its TX queues are full.
+
+class MockTransfer:
+  def __init__(self, data, callback, start, done_at):
+    self.data = data
+    self.callback = callback
+    self.start = start  # offset in the device stream
+    self.done_at = done_at
+    self.cancelled = False
+
+  def cancel(self):
+    self.cancelled = True
+
+class MockHandle:
+  def __init__(self, turnaround, rate):
+    self.turnaround = turnaround
+    self.rate = rate
+    self.received = bytearray()
+    self.accept_limit = None
+    self.in_flight = []
+    self.bus_free_at = 0.0
+
+  def _accepted(self, start, length):
+    limit = len(self.received) + length if self.accept_limit is None else self.accept_limit
+    return max(0, min(length, limit - start))
+
+  def bulkWrite(self, endpoint, data, timeout=0):
+    time.sleep(self.turnaround + len(data) / self.rate)
+    n = self._accepted(len(self.received), len(data))
+    self.received += data[:n]
+    return n
+
+  def bulkWriteAsync(self, endpoint, data, callback):
+    now = time.monotonic()
+    done_at = max(now + self.turnaround, self.bus_free_at) + len(data) / self.rate
+    self.bus_free_at = done_at
+    transfer = MockTransfer(bytes(data), callback, len(self.received) + sum(len(t.data) for t in self.in_flight), done_at)
+    self.in_flight.append(transfer)
+    return transfer
+
+  def handleEvents(self, timeout):
+    if len(self.in_flight) == 0:
+      time.sleep(timeout)
+      return
+
+    head = self.in_flight[0]
+    accepted = self._accepted(head.start, len(head.data))
+    if head.cancelled or accepted < len(head.data):
+      if not head.cancelled:
+        # NAKed until cancelled
+        time.sleep(timeout)
+        return
+      self.in_flight.pop(0)
+      self.received += head.data[:accepted]
+      head.callback(accepted, True)
+      # cancelled transfers behind the head never started
+      for t in self.in_flight:
+        t.start = head.start + accepted
+      self.bus_free_at = time.monotonic()
+      return
+
+    wait = head.done_at - time.monotonic()
+    if wait > timeout:
+      time.sleep(timeout)
+      return
+    time.sleep(max(0.0, wait))
+    self.in_flight.pop(0)
+    self.received += head.data
+    head.callback(len(head.data), False)
+
+def legacy_send_many(handle, arr, timeout):
+  # can_send_many before the pipelined sender
+  for tx in pack_can_buffer(arr):
+    while True:
+      bs = handle.bulkWrite(3, tx, timeout=timeout)
+      tx = tx[bs:]
+      if len(tx) == 0:
+        break
+
+def frames(n, rng):
+  return [(rng.randrange(0x800), 0, rng.randbytes(8), rng.randrange(3)) for _ in range(n)]
+
+def bench(args):
+  rng = random.Random(0)
+  batches = [frames(args.batch, rng) for _ in range(args.batches)]
+  n_frames = args.batch * args.batches
+
+  handle = MockHandle(args.turnaround, args.rate)
+  start = time.monotonic()
+  for batch in batches:
+    legacy_send_many(handle, batch, 10)
+  legacy = n_frames / (time.monotonic() - start)
+
+  handle = MockHandle(args.turnaround, args.rate)
+  sender = CanTxSender(handle, num_transfers=args.transfers, transfer_size=args.transfer_size)
+  start = time.monotonic()
+  for batch in batches:
+    assert sender.send(b''.join(pack_can_buffer(batch)), 10) == len(batch)
+  pipelined = n_frames / (time.monotonic() - start)
+  assert bytes(handle.received) == b''.join(b''.join(pack_can_buffer(b)) for b in batches)
+
+  print(f"synchronous: {legacy / 1000:6.1f} kframes/s")
+  print(f"  pipelined: {pipelined / 1000:6.1f} kframes/s, {pipelined / legacy:.1f}x")
+
+def test_backpressure():
+  rng = random.Random(1)
+  handle = MockHandle(0.0001, 1e6)
+  sender = CanTxSender(handle, num_transfers=4, transfer_size=512)
+  stream = b''
+  for _ in range(20):
+    batch = frames(rng.randrange(1, 300), rng)
+    dat = b''.join(pack_can_buffer(batch))
+    # NAK somewhere in the middle of this batch, usually mid packet
+    handle.accept_limit = len(stream) + rng.randrange(len(dat))
+    sent = sender.send(dat, 20)
+    assert len(handle.received) == handle.accept_limit, "stopped before the NAK"
+
+    # the sent frames are the ones started before the NAK, the rest of the batch goes again with the next one
+    started = 0
+    pos = 0
+    while len(stream) + pos < handle.accept_limit:
+      pos += len(b''.join(pack_can_buffer([batch[started]])))
+      started += 1
+    assert sent == started, f"{sent} frames reported sent, {started} started"
+    stream += dat[:pos]
+
+    handle.accept_limit = None
+    assert sender.send(b''.join(pack_can_buffer(batch[sent:])), 20) == len(batch) - sent
+    stream += b''.join(pack_can_buffer(batch[sent:]))
+    assert bytes(handle.received) == stream, "bytes lost or sent twice"
+
+  assert sender.retry_cnt == 0
+  print("backpressure: PASSED")
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--batch", type=int, default=200, help="frames per can_send_many call")
+  parser.add_argument("--batches", type=int, default=50)
+  parser.add_argument("--turnaround", type=float, default=0.0002, help="s per transfer")
+  parser.add_argument("--rate", type=float, default=1e6, help="bytes/s on the wire")
+  parser.add_argument("--transfers", type=int, default=4, help="transfers in flight")
+  parser.add_argument("--transfer-size", type=int, default=4096)
+  args = parser.parse_args()
+
+  bench(args)
+  test_backpressure()
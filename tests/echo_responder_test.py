@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+import os
+import sys
+import time
+import argparse
+from termcolor import cprint
+import contextlib
+import random
+from collections import Counter
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python import PandaJungle
+
+# Continuous round-trip benchmark against the jungle's own echo responder, no second device needed.
+# Frames with IDs below ADDR_OFFSET are sent, the responder answers with ID + ADDR_OFFSET and the payload reversed.
+# By default every bus runs in internal loopback, where a controller receives its own frames, and answers itself.
+# A controller never receives its own frames on a real bus: with --wired A B, buses A and B are wired together,
+# frames are sent on A and the responder on B answers on B, received back on A.
+# For the same test against panda's echo.py, see echo_loopback_test.py.
+
+ADDR_OFFSET = PandaJungle.RESPONDER_ADDR_OFFSET
+BATCH_SIZE = 32
+BATCH_TIMEOUT = 1.0
+
+#################################################################
+############################# UTILS #############################
+#################################################################
+def print_colored(text, color):
+  cprint(text + " "*40, color, end="\r")
+
+def get_test_string():
+  return b"test"+os.urandom(4)
+
+#################################################################
+############################# TEST ##############################
+#################################################################
+
+def test_round_trip(routes):
+  # Send a batch on every sending bus, then collect the responses as they come in
+  expected = Counter()
+  sends = []
+  for bus in routes:
+    for _ in range(BATCH_SIZE):
+      address = random.randint(1, ADDR_OFFSET - 1)
+      data = get_test_string()
+      expected[(address + ADDR_OFFSET, data[::-1], bus)] += 1
+      sends.append([address, None, data, bus])
+
+  start = time.monotonic()
+  jungle.can_send_many(sends)
+  remaining = len(sends)
+  while remaining > 0:
+    if time.monotonic() - start > BATCH_TIMEOUT:
+      cprint(f"\nFAILED: {remaining} responses missing", "red")
+      assert False
+    for address, _, data, bus in jungle.can_recv():
+      key = (address, bytes(data), bus)
+      if expected[key] > 0:
+        expected[key] -= 1
+        remaining -= 1
+  return time.monotonic() - start
+
+#################################################################
+############################# MAIN ##############################
+#################################################################
+jungle = None
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--buses", type=int, nargs="+", default=[0, 1, 2], help="buses answering themselves in internal loopback")
+  parser.add_argument("--wired", type=int, nargs=2, metavar=("A", "B"), help="send on bus A, answer from bus B wired to it")
+  args = parser.parse_args()
+
+  # sending bus -> responding bus
+  routes = {args.wired[0]: args.wired[1]} if args.wired is not None else {bus: bus for bus in args.buses}
+
+  # Connect to jungle silently
+  print_colored("Connecting to jungle", "blue")
+  with open(os.devnull, "w") as devnull:
+    with contextlib.redirect_stdout(devnull):
+      jungle = PandaJungle()
+  jungle.set_panda_power(True)
+  jungle.set_ignition(False)
+  jungle.set_can_loopback(args.wired is None)
+  for bus, responder in routes.items():
+    # only the responses are checked, skip the echoes of the sent frames
+    jungle.set_can_echo(bus, PandaJungle.CAN_ECHO_OFF)
+    jungle.set_can_echo_responder(responder, PandaJungle.RESPONDER_REVERSE, addr_offset=ADDR_OFFSET)
+  jungle.can_clear(0xFFFF)
+
+  # Run test
+  counter = 0
+  frames = 0
+  start = time.monotonic()
+  try:
+    while True:
+      batch_time = test_round_trip(routes)
+      counter += 1
+      frames += BATCH_SIZE * len(routes)
+      rate = frames / (time.monotonic() - start)
+      stats = [jungle.get_can_echo_responder_stats(responder) for responder in routes.values()]
+      fw_latency = max(s["latency_max_us"] for s in stats)
+      print_colored(f"{counter} batches, {rate:.0f} round trips/s, batch {batch_time * 1000:.1f} ms, max responder latency {fw_latency} us", "blue")
+  finally:
+    for bus, responder in routes.items():
+      jungle.set_can_echo_responder(responder, PandaJungle.RESPONDER_OFF)
+      jungle.set_can_echo(bus, PandaJungle.CAN_ECHO_FULL)
+    jungle.set_can_loopback(False)
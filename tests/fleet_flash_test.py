@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+import os
+import sys
+import time
+import argparse
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python.flash_sim import SimBackend, SimDevice, sim_image, sim_signature
+from python.fleet_flasher import FleetFlasher, FlashJob
+
+# Flashes a fleet of simulated jungles: some already up to date, some on an older build, some stuck in the bootstub
+# with a broken image and some with failing transfers. Every one has to end up running the new image, with only the
+# changed sectors rewritten where the bootstub could tell. Then compares the time with one jungle at a time.
+
+IMAGE_SIZE = 300 * 1024
+
+def old_build(new):
+  # differs in sector 2, and through the signature in the last sector
+  dat = bytearray(new[:-128])
+  dat[0x30000:0x30010] = bytes(0x10)
+  return bytes(dat) + sim_signature(bytes(dat))
+
+def fleet(n, new, old):
+  devices = []
+  for i in range(n):
+    kind = i % 4
+    image = new if kind == 0 else old if kind in (1, 3) else new[:1000]  # kind 2: cut short
+    devices.append(SimDevice(f"{i:024x}", image=image, fail_writes=2 if kind == 3 else 0))
+  return devices
+
+def run(image, devices, max_parallel):
+  start = time.monotonic()
+  jobs = FleetFlasher(image, backend=SimBackend(devices), max_parallel=max_parallel).run()
+  return jobs, time.monotonic() - start
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--jungles", type=int, default=8)
+  args = parser.parse_args()
+
+  new_image = sim_image(IMAGE_SIZE, b'new')
+  old_image = old_build(new_image)
+
+  devices = fleet(args.jungles, new_image, old_image)
+  jobs, parallel = run(new_image, devices, args.jungles)
+  for i, d in enumerate(devices):
+    job = jobs[d.serial]
+    assert d.valid() and d.signature() == new_image[-128:], f"{d.serial} not running the new image: {job}"
+    kind = i % 4
+    if kind == 0:
+      assert job.state == FlashJob.UP_TO_DATE and d.erase_cnt == 0, job
+    else:
+      assert job.state == FlashJob.DONE and job.written == job.total, job
+    if kind == 1:
+      # the middle sector and the last one with the signature
+      assert d.erase_cnt == 2, f"{d.erase_cnt} sectors erased"
+    if kind == 3:
+      assert job.attempts == 3, job
+  print(f"{args.jungles} jungles in parallel: {parallel:.2f} s")
+
+  jobs, serial = run(new_image, fleet(args.jungles, new_image, old_image), 1)
+  assert all(j.finished and j.state != FlashJob.FAILED for j in jobs.values())
+  print(f"     one jungle at a time: {serial:.2f} s, {serial / parallel:.1f}x")
+  print("PASSED")
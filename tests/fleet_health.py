@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+import time
+import argparse
+from pprint import pprint
+
+from panda_jungle.fleet import JungleFleet
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("serials", nargs="*", help="jungles to use, all of them by default")
+  parser.add_argument("--can-rx", action="store_true", help="also receive CAN on every jungle")
+  args = parser.parse_args()
+
+  with JungleFleet(args.serials or None, can_rx=args.can_rx) as fleet:
+    while True:
+      time.sleep(1)
+      rx = fleet.recv() if args.can_rx else {}
+      stats = fleet.stats()
+      for serial, s in stats["jungles"].items():
+        print(serial, f"connects: {s['connect_cnt']}", f"host rx: {len(rx.get(serial, []))}")
+      pprint(stats["totals"])
+      print()
@@ -0,0 +1,28 @@
+#!/usr/bin/env python3
+
+import time
+import argparse
+from panda_jungle import PandaJungle
+
+# Measures the CAN round trip through a DUT that forwards src_bus to dst_bus
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--src", type=int, default=0)
+  parser.add_argument("--dst", type=int, default=2)
+  parser.add_argument("--addr", type=lambda x: int(x, 0), default=0x7FF)
+  args = parser.parse_args()
+
+  jungle = PandaJungle()
+  jungle.can_latency_probe_configure(args.src, args.dst, args.addr)
+  jungle.can_latency_probe_start()
+
+  try:
+    while True:
+      time.sleep(1)
+      stats = jungle.can_latency_probe_stats()
+      hist = stats.pop("histogram")
+      print(stats)
+      print("  " + "  ".join(f"<{2 ** (i + 1)}us: {n}" for i, n in enumerate(hist) if n > 0))
+  finally:
+    jungle.can_latency_probe_stop()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+import os
+import sys
+import time
+import argparse
+
+sys.path.append(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+from python import PandaJungle
+
+# Uploads a CAN response table and checks the jungle answers requests with the canned frames.
+# The jungle runs in internal loopback, so requests sent with can_send reach the table
+# and the responses come back through can_recv. No bus wiring needed.
+# Checks the hit and entry counts read back afterwards.
+
+TIMEOUT = 1.0
+
+# (bus, addr, match, mask, resp_addr, resp_data)
+def table(bus):
+  return [
+    # OBD mode 01 PID 0D, vehicle speed
+    (bus, 0x7DF, b'\x02\x01\x0d', None, 0x7E8, b'\x03\x41\x0d\x32\x00\x00\x00\x00'),
+    # UDS tester present on the physical address, any padding
+    (bus, 0x7E0, b'\x02\x3e', None, 0x7E8, b'\x02\x7e\x00'),
+    # extended ID, first and last byte of the prefix
+    (bus, 0x18DA10F1, b'\x02\x00\x00\xff', b'\xff\x00\x00\xff', 0x18DAF110, b'\x01\x02\x03\x04\x05\x06\x07\x08'),
+  ]
+
+def recv_responses(jungle, bus, cnt):
+  responses = []
+  end = time.monotonic() + TIMEOUT
+  while time.monotonic() < end and len(responses) < cnt:
+    responses += [(addr, bytes(dat)) for addr, _, dat, b in jungle.can_recv() if b == bus and addr in (0x7E8, 0x18DAF110)]
+  return responses
+
+def test_requests(jungle, bus, entries, iterations):
+  requests = [
+    (0x7DF, b'\x02\x01\x0d\x55\x55\x55\x55\x55', 0),
+    (0x7E0, b'\x02\x3e\x00\xcc\xcc\xcc\xcc\xcc', 1),
+    (0x18DA10F1, b'\x02\x12\x34\xff', 2),
+  ]
+  # no entry matches: wrong PID, wrong ID, and a request shorter than the matched prefix
+  misses = [
+    (0x7DF, b'\x02\x01\x0c\x55\x55\x55\x55\x55'),
+    (0x7E1, b'\x02\x3e\x00\xcc\xcc\xcc\xcc\xcc'),
+    (0x7DF, b'\x02\x01'),
+  ]
+
+  for _ in range(iterations):
+    for addr, dat, idx in requests:
+      jungle.can_send(addr, dat, bus)
+      responses = recv_responses(jungle, bus, 1)
+      assert responses == [(entries[idx][4], entries[idx][5])], f"request {addr:#x} {dat.hex()}: got {responses}"
+    for addr, dat in misses:
+      jungle.can_send(addr, dat, bus)
+    assert recv_responses(jungle, bus, 1) == [], "unmatched request answered"
+
+  hits = jungle.get_can_response_table_hits()
+  assert hits["hits"] == [iterations] * len(entries), f"hit counts {hits}"
+  assert hits["drop_cnt"] == 0, f"responses dropped {hits}"
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser()
+  parser.add_argument("--bus", type=int, default=0)
+  parser.add_argument("--iterations", type=int, default=20)
+  args = parser.parse_args()
+
+  jungle = PandaJungle()
+  jungle.set_can_loopback(True, bus=args.bus)
+  jungle.set_can_echo(args.bus, PandaJungle.CAN_ECHO_OFF)
+  entries = table(args.bus)
+  jungle.set_can_response_table(entries)
+  jungle.set_can_response_table_enabled(True)
+  jungle.can_clear(0xFFFF)
+
+  try:
+    test_requests(jungle, args.bus, entries, args.iterations)
+
+    # a new upload replaces the table and resets the counts
+    jungle.set_can_response_table(entries[:1])
+    assert jungle.get_can_response_table_hits() == {"hits": [0], "drop_cnt": 0}, "table not replaced"
+    print(f"PASSED: {len(entries)} entries, {args.iterations * len(entries)} responses")
+  finally:
+    jungle.set_can_response_table_enabled(False)
+    jungle.set_can_response_table([])
+    jungle.set_can_echo(args.bus, PandaJungle.CAN_ECHO_FULL)
+    jungle.set_can_loopback(False, bus=args.bus)